@@ -6,7 +6,7 @@ include $(CLEAR_VARS)
 
 LOCAL_C_INCLUDES := external/sqlite/dist external/zlib
 
-LOCAL_SRC_FILES:= aplogd.c log_io.c rambuf.c aplogd_util.c
+LOCAL_SRC_FILES:= aplogd.c log_io.c rambuf.c aplogd_util.c rotate.c filter.c stats.c segment.c
 
 ifeq ($(APLOGD_TEST),true)
 LOCAL_SHARED_LIBRARIES := liblogtest libcutils libsqlite libz
@@ -26,6 +26,57 @@ include $(BUILD_EXECUTABLE)
 
 include $(CLEAR_VARS)
 
+LOCAL_C_INCLUDES := external/zlib
+LOCAL_SRC_FILES := aplogd_decode.c
+LOCAL_SHARED_LIBRARIES := liblog libz
+LOCAL_CFLAGS := -Wall
+LOCAL_MODULE := aplogd_decode
+LOCAL_MODULE_TAGS := eng debug
+include $(BUILD_EXECUTABLE)
+
+#########################
+
+# Host check of aplogd_decode against damaged captures; see aplogd_decode_check.c
+include $(CLEAR_VARS)
+
+LOCAL_C_INCLUDES := external/zlib
+LOCAL_SRC_FILES := aplogd_decode_check.c
+LOCAL_STATIC_LIBRARIES := liblog libcutils libz
+LOCAL_CFLAGS := -Wall -DAPLOGD_DECODE_CHECK
+LOCAL_MODULE := aplogd_decode_check
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+#########################
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := aplogd_stats.c
+LOCAL_SHARED_LIBRARIES := libcutils
+LOCAL_CFLAGS := -Wall
+LOCAL_MODULE := aplogd_stats
+LOCAL_MODULE_TAGS := eng debug
+include $(BUILD_EXECUTABLE)
+
+#########################
+
+# Host benchmark of the read/format/write path; see aplogd_bench.c
+include $(CLEAR_VARS)
+
+LOCAL_C_INCLUDES := external/zlib
+LOCAL_SRC_FILES := aplogd_bench.c aplogd.c log_io.c rambuf.c aplogd_util.c \
+	rotate.c filter.c stats.c segment.c
+LOCAL_STATIC_LIBRARIES := liblog libcutils libz
+LOCAL_LDLIBS := -lpthread -lrt
+LOCAL_CFLAGS := -Wall -DAPLOGD_BENCH
+LOCAL_MODULE := aplogd_bench
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+#########################
+
+include $(CLEAR_VARS)
+
 LOCAL_SRC_FILES := modemlog.c
 LOCAL_SHARED_LIBRARIES := libcutils liblog
 LOCAL_MODULE := modemlog
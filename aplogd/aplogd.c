@@ -77,6 +77,8 @@
 #include "aplogd_util.h"
 #include "log_io.h"
 #include "rambuf.h"
+#include "rotate.h"
+#include "filter.h"
 /***********************************************************
  * Local Constants
  ***********************************************************/
@@ -86,7 +88,7 @@
 /***********************************************************
  * Local Macros
  ***********************************************************/
-#define MAX_ARGC 12
+#define MAX_ARGC 16
 #define USR_CFG_PROP "persist.log.aplogd.config"
 #define MAX_USR_CFG_VALUE 25
 #define DEFAULT_USR_CFG_COLLECT "mrsek"
@@ -96,7 +98,9 @@
 /***********************************************************
  * Local Function Prototypes
  ************************************************************/
+#ifndef APLOGD_BENCH
 static void aplogd_signal_handler(int);
+#endif
 
 /***********************************************************
  * Global Variables
@@ -108,6 +112,7 @@ unsigned int total_lost_size=0;
 int aplogd_continue_running = 1;
 EventTagMap* g_eventTagMap = NULL;
 AndroidLogFormat * g_logformat;
+int g_binary_format = 0;
 int config_changed =0;
 
 char* usr_cfg_collect = DEFAULT_USR_CFG_COLLECT;
@@ -116,6 +121,11 @@ unsigned int usr_cfg_size = DEFAULT_USR_CFG_SIZE;
 unsigned int usr_cfg_backup = DEFAULT_USR_CFG_MAX_DIR_COUNT;
 unsigned int usr_cfg_seq = 1;
 unsigned int usr_cfg_ext = 1;
+unsigned int usr_cfg_rambuf = DEFAULT_USR_CFG_RAMBUF_KB;
+unsigned int usr_cfg_sync = 0;
+unsigned int usr_cfg_rate = 0;
+unsigned int usr_cfg_burst = 0;
+unsigned int usr_cfg_segments = DEFAULT_USR_CFG_SEGMENTS;
 
 char* g_storage_path[STORAGE_MAX] = {NULL};
 char* g_output_path[STORAGE_MAX] = {NULL};
@@ -137,6 +147,12 @@ static int setLogFormat(const char * formatString)
 	static AndroidLogPrintFormat format;
 	g_logformat = android_log_format_new();
 
+	/* Binary capture never formats; the default format only keeps
+	 * g_logformat valid for the summary lines of the rate limiter. */
+	g_binary_format = (0 == strcmp(formatString, APLOGD_BIN_FORMAT));
+	if (g_binary_format)
+		formatString = DEFAULT_USR_CFG_FORMAT;
+
 	format = android_log_formatFromString(formatString);
 
 	if (format == FORMAT_OFF) {
@@ -149,6 +165,7 @@ static int setLogFormat(const char * formatString)
 }
 
 
+#ifndef APLOGD_BENCH
 /* aplogd_signal_handler()
  *
  * Description: This function handles signals which call for the aplog
@@ -164,14 +181,16 @@ static void aplogd_signal_handler(int signal)
 {
 	DPRINT("Received signal: %d\n", signal);
 	if (signal == SIGTERM){
-		fflush(NULL);
-		exit(1);
+		/* Leave through the main loop, so the rotation worker can
+		 * finish the file it is compressing. */
+		aplogd_continue_running = 0;
 	}
 	if (signal == SIGUSR1){
 		config_changed=1;
 	}
 	return;
 }
+#endif /* APLOGD_BENCH */
 
 /* aplogd_config_load()
  *
@@ -183,6 +202,8 @@ static void aplogd_signal_handler(int signal)
 
 void aplogd_config_load(void)
 {
+	int was_binary = g_binary_format;
+
    DPRINT("Enter aplogd_config_load.\n");
 	aplogd_io_array[APLOGD_INPUT_MAIN_POLL_INDEX].collect_flag = aplogd_is_collected('m');
 	aplogd_io_array[APLOGD_INPUT_RADIO_POLL_INDEX].collect_flag = aplogd_is_collected('r');
@@ -190,6 +211,17 @@ void aplogd_config_load(void)
 	aplogd_io_array[APLOGD_INPUT_SYSTEM_POLL_INDEX].collect_flag = aplogd_is_collected('s');
 	aplogd_io_array[APLOGD_INPUT_KERNEL_POLL_INDEX].collect_flag = aplogd_is_collected('k');
 	setLogFormat(usr_cfg_format);
+	/* A binary file only gets its header when it is created, so each file
+	 * must hold one format: what is buffered goes out in the old one, then
+	 * the files are rotated. Nothing is open yet on the first load. */
+	if (g_binary_format != was_binary && aplogd_output_opened) {
+		aplogd_rambuf_outputall();
+		aplogd_close_output();
+		aplogd_io_backupall(g_current_storage);
+		aplogd_output_setup(g_current_storage);
+		total_write_size = 0;
+	}
+	aplogd_filter_load();
 	aplogd_io_array[APLOGD_VOLD_STATUS_POLL_INDEX].collect_flag=1;
 	g_current_storage = aplogd_calc_storage_pref();
 	aplogd_logfile_max=aplogd_get_filesize(g_current_storage);
@@ -297,11 +329,16 @@ void usage()
 {
     printf("\nUsage for aplogd:\n");
     printf("  -c, --collect:\t Streams to collect\n");
-    printf("  -f, --format:\t Logcat format option\n");
+    printf("  -f, --format:\t Logcat format option, or \"" APLOGD_BIN_FORMAT "\" for unformatted entries\n");
     printf("  -s, --size:\t Maximum set size in MB\n");
     printf("  -b, --backup:\t Max number for backup log folders\n");
     printf("  -q, --seq:\t Keep logs sequential when moving\n");
     printf("  -x, --ext:\t Store to external storage if available\n");
+    printf("  -r, --rambuf:\t RAM buffer size per stream in KB, rounded up to a power of two\n");
+    printf("  -y, --sync:\t fdatasync log files after each buffered write\n");
+    printf("  -l, --ratelimit:\t Max entries/s per tag and pid, optionally :burst\n");
+    printf("  -g, --segments:\t Rotated segments kept per stream, up to %d\n",
+            MAX_USR_CFG_SEGMENTS);
     printf("  -h, --help:\t usage help\n");
     printf("Example: aplogd -c mrsek -f threadtime -s 50 -b 15 -q -x\n");
     exit(0);
@@ -317,13 +354,18 @@ void parse_usr_cfg(int argc, char* argv[]) {
         {"seq",         0,    NULL,    'q'},
         {"sdcard",      0,    NULL,    'x'}, // Left for backwards compatibility
         {"ext",         0,    NULL,    'x'},
+        {"rambuf",      1,    NULL,    'r'},
+        {"sync",        0,    NULL,    'y'},
+        {"ratelimit",   1,    NULL,    'l'},
+        {"segments",    1,    NULL,    'g'},
         {"help",        0,    NULL,    'h'},
     };
     /* Boolean values must be initialized to 0, because their omission
      * indicates they should be 0. */
     usr_cfg_seq = 0;
     usr_cfg_ext = 0;
-    while ((cmd = getopt_long(argc, argv, "c:f:s:b:qxh", longopts, NULL)) != -1) {
+    usr_cfg_sync = 0;
+    while ((cmd = getopt_long(argc, argv, "c:f:s:b:qxr:yl:g:h", longopts, NULL)) != -1) {
         switch (cmd) {
             case 'c':
                 usr_cfg_collect = optarg;
@@ -347,6 +389,26 @@ void parse_usr_cfg(int argc, char* argv[]) {
             case 'x':
                 usr_cfg_ext = 1;
                 break;
+            case 'y':
+                usr_cfg_sync = 1;
+                break;
+            case 'l':
+                usr_cfg_burst = 0;
+                if (1 > sscanf(optarg, "%u:%u", &usr_cfg_rate, &usr_cfg_burst))
+                    usr_cfg_rate = 0;
+                if (0 == usr_cfg_burst)
+                    usr_cfg_burst = usr_cfg_rate * DEFAULT_USR_CFG_BURST_SECS;
+                break;
+            case 'r':
+                usr_cfg_rambuf = atoi(optarg);
+                if (0 >= (int)usr_cfg_rambuf || MAX_USR_CFG_RAMBUF_KB < usr_cfg_rambuf)
+                    usr_cfg_rambuf = DEFAULT_USR_CFG_RAMBUF_KB;
+                break;
+            case 'g':
+                usr_cfg_segments = atoi(optarg);
+                if (0 >= (int)usr_cfg_segments || MAX_USR_CFG_SEGMENTS < usr_cfg_segments)
+                    usr_cfg_segments = DEFAULT_USR_CFG_SEGMENTS;
+                break;
             case 'h':
             default:
                 usage(argv[0]);
@@ -428,6 +490,10 @@ void aplogd_load_usr_cfg(int argc, char* argv[])
     DPRINT("usr_cfg_size=%u\n", usr_cfg_size);
     DPRINT("usr_cfg_seq=%u\n", usr_cfg_seq);
     DPRINT("usr_cfg_ext=%u\n", usr_cfg_ext);
+    DPRINT("usr_cfg_rambuf=%u\n", usr_cfg_rambuf);
+    DPRINT("usr_cfg_sync=%u\n", usr_cfg_sync);
+    DPRINT("usr_cfg_rate=%u usr_cfg_burst=%u\n", usr_cfg_rate, usr_cfg_burst);
+    DPRINT("usr_cfg_segments=%u\n", usr_cfg_segments);
 }
 
 void aplogd_init_storage_refs(void)
@@ -466,6 +532,9 @@ void aplogd_init_storage_refs(void)
     }
 }
 
+#ifndef APLOGD_BENCH
+/* aplogd_bench has its own main() driving aplogd_io_poll_round() */
+
 /* main()
  *
  * Description: The main startup function of aplogd.
@@ -494,7 +563,12 @@ int main (int argc, char* argv[])
 	if(signal(SIGTERM, aplogd_signal_handler) == SIG_ERR)
 		return -1;
 	aplogd_rambuf_init();
+	if (aplogd_rotate_init() < 0)
+		return -1;
 	DPRINT("Starting logging I/O loop\n");
 	aplogd_log_io();    /* This function will run until aplogd is stopped */
+	aplogd_rotate_stop();
+	fflush(NULL);
 	return 0;
 }
+#endif /* APLOGD_BENCH */
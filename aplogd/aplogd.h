@@ -43,6 +43,7 @@
 
 #ifndef _APLOGD_H_
 #define _APLOGD_H_
+#include <stdint.h>
 #define LOG_TAG				"aplogd"
 #define MAX_PATH_LEN                    255
 #define APLOGD_LOGFILE_PATH_LEN     	32
@@ -50,15 +51,35 @@
 #define CONFIG_LOGFILE_MAX_VALUE_USERDATA  10*1024*1024     /* 10M */
 #define CONFIG_LOGFILE_MAX_VALUE_EXTERNAL 50*1024*1024      /* 50M */
 #define DEFAULT_USR_CFG_MAX_DIR_COUNT    10   /* the default max backup log folder numbers */
+#define DEFAULT_USR_CFG_RAMBUF_KB        32   /* the default per-stream RAM buffer size */
+#define MAX_USR_CFG_RAMBUF_KB            1024
+#define DEFAULT_USR_CFG_BURST_SECS       5    /* default burst, in seconds of --ratelimit */
+#define DEFAULT_USR_CFG_SEGMENTS         10   /* the default segments kept per stream */
+#define MAX_USR_CFG_SEGMENTS             100
 #define SZ_1G	1024*1024*1024 /* 1G */
 
 /* 4 byte field for the message id of binary messages */
 
+/* "-f binary" stores logger entries unformatted: each output file starts
+ * with an aplogd_bin_header, followed by records made of a 4 byte length
+ * and the logger_entry exactly as read from the driver. aplogd_decode
+ * renders such files offline. The kernel stream stays plain text. */
+#define APLOGD_BIN_FORMAT	"binary"
+#define APLOGD_BIN_MAGIC	"APLOGBIN"
+#define APLOGD_BIN_VERSION	1
+
+struct aplogd_bin_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t stream;	/* enum aplogd_poll_indexes */
+};
+
 struct log_io_struct{
 	int input_fd;
 	int output_fd;
 	unsigned int collect_flag;
-	char *input_buf;
+	unsigned int input_head;	/* ring write count, see rambuf.c */
+	unsigned int input_tail;	/* ring read count */
 	char *output_buf;
 	char *input_buf_base;
 	char *output_buf_base;
@@ -77,6 +98,7 @@ extern unsigned int aplogd_logfile_max;
 extern unsigned int total_write_size;
 extern int config_changed;
 extern int g_current_storage;
+extern int g_binary_format;
 extern struct log_io_struct aplogd_io_array[];
 extern char* usr_cfg_collect;
 extern char* usr_cfg_format;
@@ -84,6 +106,11 @@ extern unsigned int usr_cfg_size;
 extern unsigned int usr_cfg_backup;
 extern unsigned int usr_cfg_seq;
 extern unsigned int usr_cfg_ext;
+extern unsigned int usr_cfg_rambuf;
+extern unsigned int usr_cfg_sync;
+extern unsigned int usr_cfg_rate;
+extern unsigned int usr_cfg_burst;
+extern unsigned int usr_cfg_segments;
 extern char* g_storage_path[STORAGE_MAX];
 extern char* g_output_path[STORAGE_MAX];
 
@@ -0,0 +1,517 @@
+/********************************************************************
+ * File Name: aplogd_bench.c
+ *
+ * General Description: Host benchmark for the aplogd hot path. Socket
+ * pairs stand in for the logger devices and kmsg; a producer thread feeds
+ * them with recorded or synthetic entries following a load profile, and
+ * the daemon's own poll round (aplogd_io_poll_round) reads, formats and
+ * writes them to an output directory, a tmpfs by default. Reports
+ * entries/s, bytes lost and CPU time per MB, followed by the counters of
+ * the stats socket.
+ *
+ * Usage: aplogd_bench [-p flood|steady|burst] [-n entries] [-r rate]
+ *            [-B burst] [-P period_ms] [-s msg_size] [-d driver_kb]
+ *            [-o dir] [file...] [-- aplogd options]
+ *
+ * Files are "-f binary" captures (plain or .gz); each is replayed into the
+ * stream named in its header, cycling through all of them. Without files
+ * entries are synthetic. aplogd options (-f, -r, -y, -l, -c...) after "--"
+ * configure the pipeline exactly as on the device.
+ *
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <zlib.h>
+#include <log/logger.h>
+#include <log/logd.h>
+
+#include "aplogd.h"
+#include "log_io.h"
+#include "rambuf.h"
+#include "rotate.h"
+#include "filter.h"
+#include "stats.h"
+
+#define BENCH_DEFAULT_DIR	"/dev/shm/aplogd_bench"
+#define BENCH_DRIVER_KB		256	/* logger driver ring size */
+#define BENCH_MSG_MAX		(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
+
+enum bench_profile {
+	BENCH_FLOOD = 0,	/* as fast as the driver takes them */
+	BENCH_STEADY,		/* rate entries/s, evenly spaced */
+	BENCH_BURST,		/* burst entries back to back every period */
+};
+
+struct bench_record {
+	int stream;
+	int len;
+	char *data;		/* logger_entry as read from the driver */
+};
+
+/* Defined in aplogd.c */
+void parse_usr_cfg(int argc, char *argv[]);
+
+/* Bench configuration */
+static int bench_profile = BENCH_BURST;
+static unsigned long long bench_entries = 200000;
+static unsigned int bench_rate = 20000;
+static unsigned int bench_burst = 5000;
+static unsigned int bench_period_ms = 250;
+static unsigned int bench_msg_size = 80;
+static unsigned int bench_driver_kb = BENCH_DRIVER_KB;
+static struct bench_record *bench_records = NULL;
+static unsigned int bench_record_count = 0;
+
+/* Write ends are the producer's, read ends aplogd's input fds */
+static int bench_feed[APLOGD_INPUT_LAST+1];
+static int bench_drain[APLOGD_INPUT_LAST+1];
+/* Producer counters; bench_sent is read by the poll loop */
+static unsigned long long bench_sent[APLOGD_INPUT_LAST+1];
+static unsigned long long bench_sent_entries = 0;
+static unsigned long long bench_overrun = 0;
+static unsigned long long bench_overrun_entries = 0;
+static unsigned long long bench_producer_cpu_us = 0;
+static int bench_done = 0;
+
+/* Stream mix of a busy phone, in 1/20ths */
+static const int bench_mix[20] = {
+	APLOGD_INPUT_MAIN_POLL_INDEX, APLOGD_INPUT_MAIN_POLL_INDEX,
+	APLOGD_INPUT_SYSTEM_POLL_INDEX, APLOGD_INPUT_MAIN_POLL_INDEX,
+	APLOGD_INPUT_RADIO_POLL_INDEX, APLOGD_INPUT_MAIN_POLL_INDEX,
+	APLOGD_INPUT_MAIN_POLL_INDEX, APLOGD_INPUT_SYSTEM_POLL_INDEX,
+	APLOGD_INPUT_EVENTS_POLL_INDEX, APLOGD_INPUT_MAIN_POLL_INDEX,
+	APLOGD_INPUT_MAIN_POLL_INDEX, APLOGD_INPUT_SYSTEM_POLL_INDEX,
+	APLOGD_INPUT_MAIN_POLL_INDEX, APLOGD_INPUT_RADIO_POLL_INDEX,
+	APLOGD_INPUT_MAIN_POLL_INDEX, APLOGD_INPUT_MAIN_POLL_INDEX,
+	APLOGD_INPUT_SYSTEM_POLL_INDEX, APLOGD_INPUT_MAIN_POLL_INDEX,
+	APLOGD_INPUT_KERNEL_POLL_INDEX, APLOGD_INPUT_MAIN_POLL_INDEX,
+};
+static const char *bench_tags[] = {
+	"ActivityManager", "WindowManager", "RILJ", "AudioFlinger",
+	"wpa_supplicant", "dalvikvm", "PowerManagerService", "LocationManager",
+};
+
+#ifndef HAVE_ANDROID_OS
+/* Bionic only; aplogd_log_io() swaps config_changed with it */
+int __atomic_swap(int new_value, volatile int *ptr)
+{
+	return __sync_lock_test_and_set(ptr, new_value);
+}
+#endif
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: aplogd_bench [-p flood|steady|burst] [-n entries] [-r rate]\n"
+		"           [-B burst] [-P period_ms] [-s msg_size] [-d driver_kb]\n"
+		"           [-o dir] [file...] [-- aplogd options]\n");
+	exit(1);
+}
+
+static unsigned long long bench_now_us(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void bench_sleep_until(unsigned long long us)
+{
+	struct timespec ts;
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/* aplogd_bench_log_len()
+ *
+ * Description: This function replaces the LOGGER_GET_LOG_LEN ioctl for
+ * the socket pairs: what was sent minus what aplogd has read.
+ *
+ * Return: (int) bytes readable on @fd
+ *
+ * Notes: Called from the poll loop only, between batches, so bytes_in is
+ *        up to date.
+ */
+int aplogd_bench_log_len(int fd)
+{
+	unsigned long long pending;
+	int i;
+
+	for (i = 0; i <= APLOGD_INPUT_LAST; i++) {
+		if (bench_drain[i] != fd)
+			continue;
+		pending = __sync_fetch_and_add(&bench_sent[i], 0) -
+				aplogd_stream_stats[i].bytes_in;
+		return pending > INT_MAX ? INT_MAX : (int)pending;
+	}
+	return 0;
+}
+
+static unsigned long long bench_pending(void)
+{
+	unsigned long long pending = 0;
+	int i;
+
+	for (i = 0; i <= APLOGD_INPUT_LAST; i++)
+		pending += __sync_fetch_and_add(&bench_sent[i], 0) -
+				aplogd_stream_stats[i].bytes_in;
+	return pending;
+}
+
+/* bench_load()
+ *
+ * Description: This function appends the records of a binary capture to
+ * bench_records.
+ *
+ * Return: (int) 0 on success; -1 on failure
+ */
+static int bench_load(const char *path)
+{
+	struct aplogd_bin_header header;
+	struct bench_record *rec;
+	uint32_t rec_len;
+	gzFile in;
+	int ret = 0;
+
+	if ((in = gzopen(path, "rb")) == NULL) {
+		fprintf(stderr, "%s: can't open\n", path);
+		return -1;
+	}
+	if (gzread(in, &header, sizeof(header)) != sizeof(header) ||
+			memcmp(header.magic, APLOGD_BIN_MAGIC, sizeof(header.magic)) ||
+			header.version != APLOGD_BIN_VERSION ||
+			header.stream >= APLOGD_INPUT_KERNEL_POLL_INDEX) {
+		fprintf(stderr, "%s: not an aplogd binary log\n", path);
+		gzclose(in);
+		return -1;
+	}
+	while (gzread(in, &rec_len, sizeof(rec_len)) == sizeof(rec_len)) {
+		if (rec_len < sizeof(struct logger_entry) || rec_len > LOGGER_ENTRY_MAX_LEN) {
+			fprintf(stderr, "%s: bad record length %u\n", path, rec_len);
+			ret = -1;
+			break;
+		}
+		if ((bench_record_count & 1023) == 0) {
+			rec = realloc(bench_records, (bench_record_count + 1024) * sizeof(*rec));
+			if (!rec) {
+				ret = -1;
+				break;
+			}
+			bench_records = rec;
+		}
+		rec = &bench_records[bench_record_count];
+		rec->stream = header.stream;
+		rec->len = rec_len;
+		if ((rec->data = malloc(rec_len)) == NULL ||
+				gzread(in, rec->data, rec_len) != (int)rec_len) {
+			free(rec->data);
+			break;
+		}
+		bench_record_count++;
+	}
+	gzclose(in);
+	return ret;
+}
+
+/* bench_synth()
+ *
+ * Description: This function builds synthetic entry @n of @stream, a
+ * logger_entry or, for the kernel, a kmsg line.
+ *
+ * Return: (int) length in @buf
+ */
+static int bench_synth(int stream, unsigned long long n, char *buf)
+{
+	struct logger_entry *entry = (struct logger_entry *)buf;
+	unsigned long long now = bench_now_us(CLOCK_REALTIME);
+	const char *tag = bench_tags[n % (sizeof(bench_tags) / sizeof(bench_tags[0]))];
+	int32_t value = (int32_t)n;
+	uint32_t event_tag;
+	int len;
+
+	if (APLOGD_INPUT_KERNEL_POLL_INDEX == stream)
+		return sprintf(buf, "<6>[%5llu.%06llu] bench kernel message %llu\n",
+				now / 1000000 % 100000, now % 1000000, n);
+
+	entry->__pad = 0;
+	entry->pid = 1000 + n % 37;
+	entry->tid = entry->pid + n % 5;
+	entry->sec = now / 1000000;
+	entry->nsec = now % 1000000 * 1000;
+	if (APLOGD_INPUT_EVENTS_POLL_INDEX == stream) {
+		/* One EVENT_TYPE_INT value */
+		event_tag = 2700 + n % 16;
+		memcpy(entry->msg, &event_tag, sizeof(event_tag));
+		entry->msg[4] = 0;
+		memcpy(entry->msg + 5, &value, sizeof(value));
+		len = 9;
+	} else {
+		entry->msg[0] = ANDROID_LOG_DEBUG + n % 4;
+		len = 1 + sprintf(entry->msg + 1, "%s", tag) + 1;
+		len += sprintf(entry->msg + len, "bench message %llu ", n);
+		for (; len < (int)bench_msg_size + 1; len++)
+			entry->msg[len] = 'a' + len % 26;
+		entry->msg[len++] = '\0';
+	}
+	entry->len = len;
+	return sizeof(*entry) + len;
+}
+
+/* bench_send()
+ *
+ * Description: This function writes entry @n to its stream, or counts it
+ * as overrun if the stream's driver buffer is full (the logger driver
+ * would overwrite the oldest entries instead; the loss is the same).
+ *
+ * Return: None
+ */
+static void bench_send(unsigned long long n)
+{
+	char buf[LOGGER_ENTRY_MAX_LEN] __attribute__((aligned(4)));
+	struct bench_record *rec;
+	const char *data = buf;
+	int stream, len, ret;
+
+	if (bench_record_count) {
+		rec = &bench_records[n % bench_record_count];
+		stream = rec->stream;
+		data = rec->data;
+		len = rec->len;
+	} else {
+		stream = bench_mix[n % 20];
+		if (!aplogd_io_array[stream].collect_flag)
+			return;
+		len = bench_synth(stream, n, buf);
+	}
+	/* Counted before it is sent: the poll loop must never see an entry
+	 * before aplogd_bench_log_len() does, or it would spin on it. */
+	__sync_fetch_and_add(&bench_sent[stream], len);
+	ret = send(bench_feed[stream], data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (ret < 0) {
+		__sync_fetch_and_sub(&bench_sent[stream], len);
+		bench_overrun += len;
+		bench_overrun_entries++;
+		return;
+	}
+	/* Only the kernel's stream socket can take part of a line */
+	if (ret < len)
+		__sync_fetch_and_sub(&bench_sent[stream], len - ret);
+	bench_sent_entries++;
+}
+
+static void *bench_producer(void *arg)
+{
+	unsigned long long start = bench_now_us(CLOCK_MONOTONIC);
+	unsigned long long n, due;
+	(void)arg;
+
+	for (n = 0; n < bench_entries; n++) {
+		if (BENCH_STEADY == bench_profile) {
+			due = start + n * 1000000 / bench_rate;
+			if (due > bench_now_us(CLOCK_MONOTONIC) + 1000)
+				bench_sleep_until(due);
+		} else if (BENCH_BURST == bench_profile && n && n % bench_burst == 0) {
+			bench_sleep_until(start + n / bench_burst * bench_period_ms * 1000ULL);
+		}
+		bench_send(n);
+	}
+	bench_producer_cpu_us = bench_now_us(CLOCK_THREAD_CPUTIME_ID);
+	__sync_lock_test_and_set(&bench_done, 1);
+	/* The hangup wakes the poll loop up even if nothing is left to read */
+	close(bench_feed[APLOGD_INPUT_KERNEL_POLL_INDEX]);
+	return NULL;
+}
+
+/* bench_setup_inputs()
+ *
+ * Description: This function creates the socket pairs and adds their read
+ * ends to aplogd's poll set in place of the logger devices.
+ *
+ * Return: (int) 0 on success; -1 on failure
+ */
+static int bench_setup_inputs(void)
+{
+	int sv[2];
+	int sndbuf = bench_driver_kb * 1024;
+	int i;
+
+	for (i = 0; i <= APLOGD_INPUT_LAST; i++) {
+		/* Logger devices return one entry per read(); so does SEQPACKET */
+		if (socketpair(AF_UNIX, i == APLOGD_INPUT_KERNEL_POLL_INDEX ?
+				SOCK_STREAM : SOCK_SEQPACKET, 0, sv) < 0) {
+			perror("socketpair");
+			return -1;
+		}
+		setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+		fcntl(sv[0], F_SETFL, O_NONBLOCK);
+		bench_drain[i] = sv[0];
+		bench_feed[i] = sv[1];
+		aplogd_io_array[i].input_fd = sv[0];
+		aplogd_io_add_poll_fd(sv[0], POLLIN, i);
+	}
+	return 0;
+}
+
+static void bench_report(unsigned long long wall_us, unsigned long long loop_cpu_us,
+		unsigned long long proc_cpu_us)
+{
+	static const char *profiles[] = { "flood", "steady", "burst" };
+	struct aplogd_rotate_stats rotate;
+	unsigned long long entries = 0, bytes = 0, written = 0;
+	unsigned long long dropped = 0, discarded = 0;
+	char dump[4096];
+	double mb;
+	int i;
+
+	for (i = 0; i <= APLOGD_INPUT_LAST; i++) {
+		entries += aplogd_stream_stats[i].entries_in;
+		bytes += aplogd_stream_stats[i].bytes_in;
+		written += aplogd_stream_stats[i].bytes_written;
+		dropped += aplogd_stream_stats[i].bytes_dropped;
+		discarded += aplogd_stream_stats[i].bytes_discarded;
+	}
+	mb = bytes / (1024.0 * 1024.0);
+	aplogd_rotate_get_stats(&rotate);
+
+	printf("profile %s, format %s, rambuf %u KB%s\n", profiles[bench_profile],
+			usr_cfg_format, usr_cfg_rambuf, usr_cfg_sync ? ", sync" : "");
+	printf("read %llu entries, %.2f MB in %.3f s: %.0f entries/s, %.2f MB/s\n",
+			entries, mb, wall_us / 1e6, entries * 1e6 / wall_us,
+			mb * 1e6 / wall_us);
+	printf("written %.2f MB\n", written / (1024.0 * 1024.0));
+	printf("lost at the driver: %llu entries, %llu bytes\n",
+			bench_overrun_entries, bench_overrun);
+	printf("lost in aplogd: %llu bytes dropped, %llu bytes discarded, "
+			"%u entries filtered, %u suppressed\n", dropped, discarded,
+			aplogd_entries_filtered, aplogd_entries_suppressed);
+	printf("cpu: poll loop %.1f ms (%.2f ms/MB), all aplogd threads %.1f ms (%.2f ms/MB)\n",
+			loop_cpu_us / 1e3, mb > 0 ? loop_cpu_us / 1e3 / mb : 0,
+			proc_cpu_us / 1e3, mb > 0 ? proc_cpu_us / 1e3 / mb : 0);
+	printf("rotation: %u jobs, %llu ms\n\n", rotate.jobs_done, rotate.compress_ms);
+	aplogd_stats_format(dump, sizeof(dump));
+	fputs(dump, stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *out_dir = BENCH_DEFAULT_DIR;
+	struct aplogd_rotate_stats rotate;
+	struct rusage usage_end;
+	pthread_t producer;
+	unsigned long long wall_start, loop_cpu_start, wall_us, loop_cpu_us;
+	int cmd;
+
+	/* '+': stop at the first file, so "--" is left for below */
+	while ((cmd = getopt(argc, argv, "+p:n:r:B:P:s:d:o:h")) != -1) {
+		switch (cmd) {
+		case 'p':
+			if (!strcmp(optarg, "flood"))
+				bench_profile = BENCH_FLOOD;
+			else if (!strcmp(optarg, "steady"))
+				bench_profile = BENCH_STEADY;
+			else if (!strcmp(optarg, "burst"))
+				bench_profile = BENCH_BURST;
+			else
+				usage();
+			break;
+		case 'n':
+			bench_entries = strtoull(optarg, NULL, 10);
+			break;
+		case 'r':
+			bench_rate = atoi(optarg);
+			break;
+		case 'B':
+			bench_burst = atoi(optarg);
+			break;
+		case 'P':
+			bench_period_ms = atoi(optarg);
+			break;
+		case 's':
+			bench_msg_size = atoi(optarg);
+			break;
+		case 'd':
+			bench_driver_kb = atoi(optarg);
+			break;
+		case 'o':
+			out_dir = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!bench_rate || !bench_burst || bench_msg_size >= BENCH_MSG_MAX - 64)
+		usage();
+	if (optind > 1 && !strcmp(argv[optind - 1], "--"))
+		optind--;
+	for (; optind < argc && strcmp(argv[optind], "--"); optind++) {
+		if (bench_load(argv[optind]) < 0)
+			return 1;
+	}
+	/* Whatever follows "--" is for parse_usr_cfg(), which wants an argv[0] */
+	if (optind < argc) {
+		argv[optind] = "aplogd";
+		argc -= optind;
+		argv += optind;
+		optind = 1;
+		parse_usr_cfg(argc, argv);
+	} else {
+		usr_cfg_ext = 0;
+	}
+
+	aplogd_io_array_init();
+	mkdir(out_dir, 0750);
+	g_output_path[STORAGE_USERDATA] = (char *)out_dir;
+	aplogd_config_load();
+	aplogd_rambuf_init();
+	if (aplogd_rotate_init() < 0 || aplogd_output_setup(STORAGE_USERDATA) != 0) {
+		fprintf(stderr, "Can't write to %s\n", out_dir);
+		return 1;
+	}
+	if (bench_setup_inputs() < 0)
+		return 1;
+
+	wall_start = bench_now_us(CLOCK_MONOTONIC);
+	loop_cpu_start = bench_now_us(CLOCK_THREAD_CPUTIME_ID);
+	if (pthread_create(&producer, NULL, bench_producer, NULL) != 0) {
+		perror("pthread_create");
+		return 1;
+	}
+	while (!__sync_fetch_and_add(&bench_done, 0) || bench_pending() > 0)
+		aplogd_io_poll_round();
+	aplogd_rambuf_outputall();
+	wall_us = bench_now_us(CLOCK_MONOTONIC) - wall_start;
+	loop_cpu_us = bench_now_us(CLOCK_THREAD_CPUTIME_ID) - loop_cpu_start;
+	pthread_join(producer, NULL);
+
+	/* Let the rotation worker finish what the run queued */
+	do {
+		aplogd_rotate_get_stats(&rotate);
+		if (rotate.queue_depth)
+			usleep(10000);
+	} while (rotate.queue_depth);
+	getrusage(RUSAGE_SELF, &usage_end);
+
+	bench_report(wall_us, loop_cpu_us,
+			(usage_end.ru_utime.tv_sec + usage_end.ru_stime.tv_sec) * 1000000ULL +
+			usage_end.ru_utime.tv_usec + usage_end.ru_stime.tv_usec -
+			bench_producer_cpu_us);
+	return 0;
+}
@@ -0,0 +1,148 @@
+/********************************************************************
+ * File Name: aplogd_decode.c
+ *
+ * General Description: Offline renderer for log files aplogd wrote with
+ * "-f binary". Records are formatted with the same logprint rules aplogd
+ * uses for text output. Rotated .gz files can be passed directly.
+ *
+ * Usage: aplogd_decode [-f format] [-t event-log-tags] file...
+ *
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <zlib.h>
+
+#include "aplogd.h"
+#include <log/logger.h>
+#include <log/logd.h>
+#include <log/logprint.h>
+#include <log/event_tag_map.h>
+
+#include "log_io.h"
+
+/* decode_file()
+ *
+ * Description: This function prints every record of one binary log file.
+ *
+ * Return: (int) 0 on success; -1 if the file is not a binary log, is
+ *         truncated or holds a bad record
+ *
+ * Notes: A truncated last record (e.g. the daemon was killed mid-write)
+ *        ends the file without being printed. A record whose entry
+ *        claims more payload than the record holds is skipped.
+ */
+static int decode_file(const char *path, AndroidLogFormat *format,
+		const EventTagMap *tag_map)
+{
+	struct aplogd_bin_header header;
+	unsigned char buf[LOGGER_ENTRY_MAX_LEN + 1] __attribute__((aligned(4)));
+	struct logger_entry *entry = (struct logger_entry *) buf;
+	AndroidLogEntry log_entry;
+	char binaryMsgBuf[1024];
+	uint32_t rec_len;
+	gzFile in;
+	int ret = 0;
+	int err;
+
+	/* gzread() passes uncompressed files through unchanged */
+	if ((in = gzopen(path, "rb")) == NULL) {
+		fprintf(stderr, "%s: can't open\n", path);
+		return -1;
+	}
+	if (gzread(in, &header, sizeof(header)) != sizeof(header) ||
+			memcmp(header.magic, APLOGD_BIN_MAGIC, sizeof(header.magic)) ||
+			header.version != APLOGD_BIN_VERSION ||
+			header.stream >= APLOGD_INPUT_KERNEL_POLL_INDEX) {
+		fprintf(stderr, "%s: not an aplogd binary log\n", path);
+		gzclose(in);
+		return -1;
+	}
+	while (gzread(in, &rec_len, sizeof(rec_len)) == sizeof(rec_len)) {
+		if (rec_len < sizeof(struct logger_entry) || rec_len > LOGGER_ENTRY_MAX_LEN) {
+			fprintf(stderr, "%s: bad record length %u\n", path, rec_len);
+			ret = -1;
+			break;
+		}
+		if (gzread(in, buf, rec_len) != (int)rec_len) {
+			fprintf(stderr, "%s: truncated record\n", path);
+			ret = -1;
+			break;
+		}
+		/* Files come off devices; the payload must fit in its record */
+		if (entry->len > rec_len - sizeof(struct logger_entry)) {
+			fprintf(stderr, "%s: bad entry length %u in a %u byte record\n",
+					path, entry->len, rec_len);
+			ret = -1;
+			continue;
+		}
+		entry->msg[entry->len] = '\0';
+		if (APLOGD_INPUT_EVENTS_POLL_INDEX == header.stream)
+			err = android_log_processBinaryLogBuffer(entry, &log_entry,
+					tag_map, binaryMsgBuf, sizeof(binaryMsgBuf));
+		else
+			err = android_log_processLogBuffer(entry, &log_entry);
+		if (err < 0)
+			continue;
+		if (android_log_shouldPrintLine(format, log_entry.tag, log_entry.priority))
+			android_log_printLogLine(format, STDOUT_FILENO, &log_entry);
+	}
+	gzclose(in);
+	return ret;
+}
+
+#ifndef APLOGD_DECODE_CHECK
+static void usage(void)
+{
+	fprintf(stderr, "Usage: aplogd_decode [-f format] [-t event-log-tags] file...\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *format_string = "threadtime";
+	const char *tag_file = EVENT_TAG_MAP_FILE;
+	AndroidLogFormat *format;
+	AndroidLogPrintFormat print_format;
+	EventTagMap *tag_map;
+	int ret = 0;
+	int cmd;
+
+	while ((cmd = getopt(argc, argv, "f:t:h")) != -1) {
+		switch (cmd) {
+		case 'f':
+			format_string = optarg;
+			break;
+		case 't':
+			tag_file = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind >= argc)
+		usage();
+
+	format = android_log_format_new();
+	print_format = android_log_formatFromString(format_string);
+	if (print_format == FORMAT_OFF) {
+		fprintf(stderr, "Invalid format: %s\n", format_string);
+		return 1;
+	}
+	android_log_setPrintFormat(format, print_format);
+	/* Only needed for the events stream; decode the rest without it. */
+	tag_map = android_openEventTagMap(tag_file);
+
+	for (; optind < argc; optind++) {
+		if (decode_file(argv[optind], format, tag_map) < 0)
+			ret = 1;
+	}
+	if (tag_map)
+		android_closeEventTagMap(tag_map);
+	android_log_format_free(format);
+	return ret;
+}
+#endif /* APLOGD_DECODE_CHECK */
@@ -0,0 +1,183 @@
+/********************************************************************
+ * File Name: aplogd_decode_check.c
+ *
+ * General Description: Host check of aplogd_decode against damaged
+ * captures. Each case writes a "-f binary" file to a temporary dir and
+ * decodes it with stdout redirected, then checks the return value and
+ * which messages were printed:
+ *
+ *   - a good capture decodes every record
+ *   - an entry len past the end of its record, including the largest len
+ *     a record can claim, is skipped and the next record still decodes
+ *   - a record length over LOGGER_ENTRY_MAX_LEN ends the file
+ *   - a truncated last record ends the file without being printed
+ *
+ * Usage: aplogd_decode_check
+ *
+ * Prints the failed cases; exits 1 if there were any. Best run under a
+ * memory checker, which catches a write past the record buffer even when
+ * the output looks right.
+ *
+ *********************************************************************/
+
+/* decode_file() is static */
+#include "aplogd_decode.c"
+
+#include <fcntl.h>
+
+#define CHECK_GOOD	"good message"
+#define CHECK_BAD	"bad message"
+
+static char check_dir[] = "/tmp/aplogd_decode_check.XXXXXX";
+static char check_out[MAX_PATH_LEN];
+static int check_failures = 0;
+
+/* check_put()
+ *
+ * Description: This function appends one main log record to @fp, with
+ * @len as the entry length; 0 takes the length of the message.
+ *
+ * Return: None
+ */
+static void check_put(FILE *fp, const char *msg, unsigned len)
+{
+	unsigned char buf[LOGGER_ENTRY_MAX_LEN] __attribute__((aligned(4)));
+	struct logger_entry *entry = (struct logger_entry *) buf;
+	uint32_t rec_len;
+	unsigned n;
+
+	memset(buf, 'x', sizeof(buf));
+	n = sprintf(entry->msg, "%cCheck", ANDROID_LOG_INFO) + 1;
+	n += sprintf(entry->msg + n, "%s", msg) + 1;
+	entry->len = len ? len : n;
+	entry->__pad = 0;
+	entry->pid = entry->tid = 1;
+	entry->sec = entry->nsec = 0;
+	rec_len = sizeof(*entry) + n;
+	fwrite(&rec_len, sizeof(rec_len), 1, fp);
+	fwrite(buf, rec_len, 1, fp);
+}
+
+static FILE *check_open(const char *name, char *path)
+{
+	struct aplogd_bin_header header;
+	FILE *fp;
+
+	snprintf(path, MAX_PATH_LEN, "%s/%s", check_dir, name);
+	if ((fp = fopen(path, "wb")) == NULL) {
+		printf("%s: can't create\n", path);
+		exit(2);
+	}
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, APLOGD_BIN_MAGIC, sizeof(header.magic));
+	header.version = APLOGD_BIN_VERSION;
+	header.stream = APLOGD_INPUT_MAIN_POLL_INDEX;
+	fwrite(&header, sizeof(header), 1, fp);
+	return fp;
+}
+
+/* check_decode()
+ *
+ * Description: This function decodes @path and checks that it returned
+ * @expected_ret and printed @good good messages and no bad one.
+ *
+ * Return: None
+ */
+static void check_decode(const char *what, const char *path,
+		AndroidLogFormat *format, int expected_ret, int good)
+{
+	char line[LOGGER_ENTRY_MAX_LEN];
+	int saved, fd, ret, n = 0, bad = 0;
+	FILE *fp;
+
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	fd = open(check_out, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (saved < 0 || fd < 0) {
+		printf("%s: can't redirect stdout\n", check_out);
+		exit(2);
+	}
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+	ret = decode_file(path, format, NULL);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+
+	if ((fp = fopen(check_out, "r")) != NULL) {
+		while (fgets(line, sizeof(line), fp)) {
+			if (strstr(line, CHECK_GOOD))
+				n++;
+			if (strstr(line, CHECK_BAD))
+				bad++;
+		}
+		fclose(fp);
+	}
+	if (ret != expected_ret || n != good || bad) {
+		printf("%s: returned %d, printed %d good and %d bad messages; "
+				"expected %d and %d good\n",
+				what, ret, n, bad, expected_ret, good);
+		check_failures++;
+	}
+	unlink(path);
+}
+
+int main(void)
+{
+	AndroidLogFormat *format;
+	char path[MAX_PATH_LEN];
+	uint32_t rec_len;
+	FILE *fp;
+
+	if (mkdtemp(check_dir) == NULL) {
+		printf("Can't create a temporary dir\n");
+		return 2;
+	}
+	snprintf(check_out, MAX_PATH_LEN, "%s/out", check_dir);
+	format = android_log_format_new();
+	android_log_setPrintFormat(format, FORMAT_BRIEF);
+
+	fp = check_open("good", path);
+	check_put(fp, CHECK_GOOD, 0);
+	check_put(fp, CHECK_GOOD, 0);
+	fclose(fp);
+	check_decode("good capture", path, format, 0, 2);
+
+	fp = check_open("oversized_len", path);
+	check_put(fp, CHECK_BAD, 4000);
+	check_put(fp, CHECK_GOOD, 0);
+	fclose(fp);
+	check_decode("entry len past its record", path, format, -1, 1);
+
+	/* what the old clamp let through: NUL well past the record buffer */
+	fp = check_open("max_len", path);
+	check_put(fp, CHECK_BAD, LOGGER_ENTRY_MAX_LEN - 1);
+	check_put(fp, CHECK_GOOD, 0);
+	fclose(fp);
+	check_decode("largest entry len", path, format, -1, 1);
+
+	fp = check_open("oversized_record", path);
+	check_put(fp, CHECK_GOOD, 0);
+	rec_len = LOGGER_ENTRY_MAX_LEN + 1;
+	fwrite(&rec_len, sizeof(rec_len), 1, fp);
+	fclose(fp);
+	check_decode("record length over the maximum", path, format, -1, 1);
+
+	fp = check_open("truncated", path);
+	check_put(fp, CHECK_GOOD, 0);
+	rec_len = 100;
+	fwrite(&rec_len, sizeof(rec_len), 1, fp);
+	fwrite(CHECK_BAD, sizeof(CHECK_BAD), 1, fp);
+	fclose(fp);
+	check_decode("truncated record", path, format, -1, 1);
+
+	android_log_format_free(format);
+	unlink(check_out);
+	rmdir(check_dir);
+
+	if (check_failures) {
+		printf("%d failed\n", check_failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
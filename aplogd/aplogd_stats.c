@@ -0,0 +1,75 @@
+/********************************************************************
+ * File Name: aplogd_stats.c
+ *
+ * General Description: Dumps the counters of a running aplogd, read from
+ * its stats socket.
+ *
+ * Usage: aplogd_stats [-i seconds]
+ *
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <cutils/sockets.h>
+
+#include "stats.h"
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: aplogd_stats [-i seconds]\n");
+	exit(1);
+}
+
+/* dump_stats()
+ *
+ * Description: This function copies one snapshot to stdout.
+ *
+ * Return: (int) 0 on success; -1 if aplogd could not be reached
+ */
+static int dump_stats(void)
+{
+	char buf[1024];
+	int fd;
+	int ret;
+
+	fd = socket_local_client(APLOGD_STATS_SOCKET,
+			ANDROID_SOCKET_NAMESPACE_ABSTRACT, SOCK_STREAM);
+	if (fd < 0) {
+		fprintf(stderr, "Can't connect to aplogd: %s\n", strerror(errno));
+		return -1;
+	}
+	while ((ret = read(fd, buf, sizeof(buf))) > 0)
+		fwrite(buf, 1, ret, stdout);
+	close(fd);
+	fflush(stdout);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int interval = 0;
+	int cmd;
+
+	while ((cmd = getopt(argc, argv, "i:h")) != -1) {
+		switch (cmd) {
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (dump_stats() < 0)
+		return 1;
+	while (interval > 0) {
+		sleep(interval);
+		printf("\n");
+		if (dump_stats() < 0)
+			return 1;
+	}
+	return 0;
+}
@@ -75,22 +75,85 @@
 #include "log_io.h"
 #include "rambuf.h"
 #include "aplogd_util.h"
+#include "rotate.h"
 /***********************************************************
  * Local Constants
  ***********************************************************/
+#define APLOGD_GZIP_MODE	"wb5"		/* same ratio as the old "gzip -5" */
+#define APLOGD_GZIP_CHUNK	(16*1024)
+
+/* aplogd_util_gzip_to()
+ *
+ * Description: This function compresses @src into @gzip_file in-process and
+ * removes @src, the same result "gzip -5" gave us without forking a shell
+ * for every rotated file.
+ *
+ * @src: (char *) full path of the file to compress
+ * @gzip_file: (char *) full path of the .gz to create; may be on another
+ *             file system than @src
+ *
+ * Return: (int) 0 on success; -1 on failure
+ *
+ * Notes: On failure @src is left in place and any partial .gz is removed.
+ */
+int aplogd_util_gzip_to(char *src, char *gzip_file)
+{
+	char buf[APLOGD_GZIP_CHUNK];
+	gzFile gz;
+	ssize_t len;
+	int sfd, dfd;
+	int ret = 0;
+
+	if ((sfd = open(src, O_RDONLY)) < 0) {
+		EPRINT("Couldn't open %s; errno=%s\n", src, strerror(errno));
+		return -1;
+	}
+	/* See comment on permissions in aplogd_output_setup(). */
+	dfd = open(gzip_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP);
+	if (dfd < 0) {
+		EPRINT("Couldn't create %s; errno=%s\n", gzip_file, strerror(errno));
+		close(sfd);
+		return -1;
+	}
+	if ((gz = gzdopen(dfd, APLOGD_GZIP_MODE)) == NULL) {
+		EPRINT("gzdopen(%s) failed\n", gzip_file);
+		close(dfd);
+		close(sfd);
+		unlink(gzip_file);
+		return -1;
+	}
+	for (;;) {
+		len = read(sfd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+		if (gzwrite(gz, buf, len) != len) {
+			EPRINT("gzwrite(%s) failed\n", gzip_file);
+			ret = -1;
+			break;
+		}
+	}
+	if (len < 0) {
+		EPRINT("read(%s) failed; errno=%s\n", src, strerror(errno));
+		ret = -1;
+	}
+	/* gzclose() also closes dfd */
+	if (gzclose(gz) != Z_OK)
+		ret = -1;
+	close(sfd);
+	if (ret == 0)
+		unlink(src);
+	else
+		unlink(gzip_file);
+	return ret;
+}
+
 int aplogd_util_gzip(char *src)
 {
-	int ret;
-	char cmd[MAX_PATH_LEN+9] = "gzip -5 ";
-	strcpy(cmd+8, src);
-	ret = system(cmd);
-	/* gzip (specifically, minigzip, part of zlib), blindly creates all gzip
-	 * output files with 0666 permissions.  So, we need to undo that damage. */
 	char gzip_file[MAX_PATH_LEN];
 	snprintf(gzip_file, MAX_PATH_LEN, "%s.gz", src);
-	/* See comment on permissions in aplogd_output_setup(). */
-	chmod(gzip_file, S_IRUSR | S_IWUSR | S_IRGRP);
-	return ret;
+	return aplogd_util_gzip_to(src, gzip_file);
 }
 
 int aplogd_util_move(char *src, char *dst, char *pstr)
@@ -177,97 +240,111 @@ void filter_numstr(const char *str, char *numstr)
 	*n_str = '\0';
 }
 
+struct numbered_dir {
+	long num;
+	char name[MAX_PATH_LEN];
+};
+
+static int numbered_dir_cmp(const void *a, const void *b)
+{
+	long na = ((const struct numbered_dir *)a)->num;
+	long nb = ((const struct numbered_dir *)b)->num;
+	return na < nb ? -1 : na > nb;
+}
+
+/* aplogd_util_cleardir()
+ *
+ * Description: This function deletes the oldest No.N log folders in @dir
+ * until at most @max_count - 1 are left, making room for a new one.
+ *
+ * Return: (long) highest N found; -1 on failure
+ *
+ * Notes: The folders are listed once and sorted by N, instead of rescanning
+ *        the directory for each one deleted.
+ */
 long aplogd_util_cleardir(char *dir, int max_count)
 {
 	struct dirent *dirp;
 	DIR *dp;
 	long ret = 0;
 	struct stat buf;
-	int count;
+	int count = 0;
+	int alloc = 0;
+	int i;
 	char path[MAX_PATH_LEN];
-	char oldest[MAX_PATH_LEN];
 	char d_name[MAX_PATH_LEN];
-	long t_num;
-	long dir_num;
-
-	do {
-		count = 0;
-		memset(path, 0, MAX_PATH_LEN);
-		memset(oldest, 0, MAX_PATH_LEN);
-		t_num = LONG_MAX;
-		dp = NULL;
-		dirp = NULL;
+	struct numbered_dir *dirs = NULL, *tmp;
 
-		if (!(dp = opendir(dir))) {
-			EPRINT("Error in opendir.\n");
-			return -1;
+	if (!(dp = opendir(dir))) {
+		EPRINT("Error in opendir.\n");
+		return -1;
+	}
+	while ((dirp=readdir(dp)) != NULL) {
+		if(strcmp(dirp->d_name, ".") ==0 ||
+		strcmp(dirp->d_name, "..") == 0 ||
+		!strstr(dirp->d_name, "No."))
+			continue;
+		snprintf(path, MAX_PATH_LEN,"%s/%s", dir, dirp->d_name);
+		if(stat(path, &buf) == -1) {
+			EPRINT("Error in stat. Errno = %d(%s)\n", errno, strerror(errno));
+			ret = -1;
+			break;
 		}
-		while ((dirp=readdir(dp)) != NULL) {
-			if(strcmp(dirp->d_name, ".") ==0 ||
-			strcmp(dirp->d_name, "..") == 0 ||
-			!strstr(dirp->d_name, "No."))
-				continue;
-			snprintf(path, MAX_PATH_LEN,"%s/%s", dir, dirp->d_name);
-			if(stat(path, &buf) == -1) {
-				EPRINT("Error in stat. Errno = %d(%s)\n", errno, strerror(errno));
-				closedir(dp);
-				return -1;
-			}
-			if(S_ISDIR(buf.st_mode)){
-				count++;
-				memset(d_name, 0, MAX_PATH_LEN);
-				filter_numstr(dirp->d_name, d_name);
-				dir_num = strtol(d_name, NULL, 10);
-				if (dir_num < t_num) {
-					strcpy(oldest, path);
-					t_num = dir_num;
-				}
-				if (dir_num > ret)
-					ret = dir_num;
+		if(!S_ISDIR(buf.st_mode))
+			continue;
+		if (count == alloc) {
+			alloc = alloc ? alloc * 2 : 16;
+			if (!(tmp = realloc(dirs, alloc * sizeof(*dirs)))) {
+				ret = -1;
+				break;
 			}
+			dirs = tmp;
 		}
-		closedir(dp);
-		DPRINT("count=%d max_count=%d oldest=%s ret=%ld\n", count, max_count, oldest, ret);
-		if (count > (max_count -1) && oldest[0]) {
-			count--;
-			if (aplogd_remove_dir(oldest) == -1)
-				return -1;
+		memset(d_name, 0, MAX_PATH_LEN);
+		filter_numstr(dirp->d_name, d_name);
+		dirs[count].num = strtol(d_name, NULL, 10);
+		strcpy(dirs[count].name, path);
+		if (dirs[count].num > ret)
+			ret = dirs[count].num;
+		count++;
+	}
+	closedir(dp);
+	if (ret != -1) {
+		qsort(dirs, count, sizeof(*dirs), numbered_dir_cmp);
+		for (i = 0; count - i > max_count - 1; i++) {
+			DPRINT("count=%d max_count=%d oldest=%s ret=%ld\n",
+					count - i, max_count, dirs[i].name, ret);
+			if (aplogd_remove_dir(dirs[i].name) == -1) {
+				ret = -1;
+				break;
+			}
 		}
-	} while (count > (max_count - 1));
-
+	}
+	free(dirs);
 	return ret;
 }
 
 /*aplogd_move_logs()
 *
-*Description: This function moves the log file storage locations
+*Description: This function moves the log file storage locations. The current
+*files are handed to the rotation worker, which files them as the newest
+*backup in the new storage.
 *
+*Notes: Closes the output files; the caller is expected to switch storage.
 */
 void aplogd_move_logs(STORAGE_T old_storage,STORAGE_T new_storage)
 {
+        char staging[MAX_PATH_LEN];
+
         if (!g_output_path[old_storage] || !g_output_path[new_storage])
             return;
-        int i;
-        char src[MAX_PATH_LEN];
-        char dst[MAX_PATH_LEN];
-        char buf[4096];
-        int sfd,dfd;
-        int ret;
-        for (i=0;i<=APLOGD_INPUT_LAST;i++){
-                snprintf(src, MAX_PATH_LEN, "%s/%s", g_output_path[old_storage], output_filename[i]);
-                snprintf(dst, MAX_PATH_LEN, "%s/%s", g_output_path[new_storage], output_filename[i]);
-                if((sfd=open(src, O_RDONLY |O_NONBLOCK ))<0)
-                        continue;
-                if((dfd=open(dst, O_WRONLY |O_NONBLOCK |O_APPEND | O_CREAT, 0755))<0)
-                        continue;
-                while((ret = read(sfd,buf,4095))>0){
-			if(ret>4095)ret=4095;
-                        write(dfd,buf,ret);
-		}
-                close(sfd);
-                close(dfd);
-                unlink(src);
-        }
+        aplogd_close_output();
+        if (aplogd_rotate_stage(old_storage, staging) < 0)
+                return;
+        /* The worker may get to it before aplogd_output_setup() has created
+         * the new path. See comments on permissions there. */
+        mkdir(g_output_path[new_storage], 0750);
+        aplogd_rotate_queue(APLOGD_ROTATE_BACKUP, new_storage, staging);
 }
 
 unsigned int aplogd_get_filesize(STORAGE_T storage)
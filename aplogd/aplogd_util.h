@@ -50,6 +50,7 @@
  ***********************************************************/
 
 int aplogd_util_gzip(char *src);
+int aplogd_util_gzip_to(char *src, char *gzip_file);
 int aplogd_util_move(char *src, char *dst, char *pstr);
 long aplogd_util_cleardir(char *dir, int max_count);
 void aplogd_move_logs(STORAGE_T,STORAGE_T);
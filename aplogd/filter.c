@@ -0,0 +1,258 @@
+/********************************************************************
+ * File Name: filter.c
+ *
+ * General Description: This file provides the aplogd pre-format entry
+ * filter. Per-tag minimum priorities are compiled once into a hash index
+ * by aplogd_config_load(), and each tag/pid can be rate limited with a
+ * token bucket so a single chatty app can't push everything else out of
+ * the log files. Both checks run on the raw logger_entry, before any
+ * parsing or formatting.
+ *
+ *********************************************************************/
+
+/* Includes */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <cutils/properties.h>
+#include <log/logger.h>
+#include <log/logd.h>
+
+/* Aplogd includes */
+#include "aplogd.h"
+#include "log_io.h"
+#include "filter.h"
+
+/* Macros */
+#define FILTER_TAG_BUCKETS	256	/* power of 2 */
+#define FILTER_RATE_SLOTS	512	/* power of 2 */
+#define FILTER_TOKEN		1000	/* one entry, in milli-tokens */
+
+struct tag_rule {
+	struct tag_rule *next;
+	uint32_t hash;
+	int priority;
+	char tag[APLOGD_FILTER_TAG_MAX];
+};
+
+struct rate_slot {
+	int used;
+	int stream;
+	uint32_t hash;
+	int pid;
+	unsigned long long tokens;	/* milli-tokens */
+	unsigned long long last_ms;
+	unsigned int suppressed;
+	char tag[APLOGD_FILTER_TAG_MAX];
+};
+
+/* Globals */
+unsigned int aplogd_entries_filtered = 0;
+unsigned int aplogd_entries_suppressed = 0;
+
+/* Locals */
+static struct tag_rule *tag_index[FILTER_TAG_BUCKETS];
+static int tag_rule_count = 0;
+/* Direct mapped: a colliding tag/pid takes over the slot and the previous
+ * owner's suppressed count is reported right away. */
+static struct rate_slot rate_slots[FILTER_RATE_SLOTS];
+
+/* Functions */
+
+static uint32_t filter_hash(const char *s, size_t len)
+{
+	uint32_t hash = 2166136261u;	/* FNV-1a */
+	while (len--) {
+		hash ^= (unsigned char)*s++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Same letters logcat filter specs use */
+static int filter_char_to_priority(char c)
+{
+	switch (toupper((unsigned char)c)) {
+	case 'V': return ANDROID_LOG_VERBOSE;
+	case 'D': return ANDROID_LOG_DEBUG;
+	case 'I': return ANDROID_LOG_INFO;
+	case 'W': return ANDROID_LOG_WARN;
+	case 'E': return ANDROID_LOG_ERROR;
+	case 'F': return ANDROID_LOG_FATAL;
+	case 'S': return ANDROID_LOG_SILENT;
+	default:  return ANDROID_LOG_UNKNOWN;
+	}
+}
+
+static void filter_add_rule(const char *key, const char *value, void *cookie)
+{
+	struct tag_rule *rule;
+	const char *tag;
+	int priority;
+	(void)cookie;
+
+	if (strncmp(key, APLOGD_FILTER_PROP_PREFIX, strlen(APLOGD_FILTER_PROP_PREFIX)))
+		return;
+	tag = key + strlen(APLOGD_FILTER_PROP_PREFIX);
+	priority = filter_char_to_priority(value[0]);
+	if ('\0' == tag[0] || strlen(tag) >= APLOGD_FILTER_TAG_MAX ||
+			ANDROID_LOG_UNKNOWN == priority) {
+		WPRINT("Ignoring filter %s=%s\n", key, value);
+		return;
+	}
+	if ((rule = malloc(sizeof(*rule))) == NULL)
+		return;
+	strcpy(rule->tag, tag);
+	rule->hash = filter_hash(tag, strlen(tag));
+	rule->priority = priority;
+	rule->next = tag_index[rule->hash & (FILTER_TAG_BUCKETS - 1)];
+	tag_index[rule->hash & (FILTER_TAG_BUCKETS - 1)] = rule;
+	tag_rule_count++;
+	DPRINT("Filter %s at priority %d\n", tag, priority);
+}
+
+/* aplogd_filter_load()
+ *
+ * Description: This function (re)builds the tag index from the
+ * ap.log.filter.MOT_* properties and resets the rate limiter.
+ *
+ * Return: None
+ *
+ * Notes: Called from aplogd_config_load(), i.e. at start and on SIGUSR1.
+ */
+void aplogd_filter_load(void)
+{
+	struct tag_rule *rule, *next;
+	int i;
+
+	for (i = 0; i < FILTER_TAG_BUCKETS; i++) {
+		for (rule = tag_index[i]; rule; rule = next) {
+			next = rule->next;
+			free(rule);
+		}
+		tag_index[i] = NULL;
+	}
+	tag_rule_count = 0;
+	memset(rate_slots, 0, sizeof(rate_slots));
+	property_list(filter_add_rule, NULL);
+	DPRINT("%d tag filters, rate limit %u/s burst %u\n",
+			tag_rule_count, usr_cfg_rate, usr_cfg_burst);
+}
+
+/* aplogd_filter_enabled()
+ *
+ * Return: (int) non-zero if aplogd_filter_entry() may drop anything
+ */
+int aplogd_filter_enabled(void)
+{
+	return tag_rule_count || usr_cfg_rate;
+}
+
+static const struct tag_rule *filter_find_rule(uint32_t hash, const char *tag, size_t len)
+{
+	const struct tag_rule *rule;
+
+	for (rule = tag_index[hash & (FILTER_TAG_BUCKETS - 1)]; rule; rule = rule->next) {
+		if (rule->hash == hash && !strncmp(rule->tag, tag, len) && '\0' == rule->tag[len])
+			return rule;
+	}
+	return NULL;
+}
+
+static void filter_report(struct rate_slot *slot, struct aplogd_filter_report *report)
+{
+	report->suppressed = slot->suppressed;
+	report->pid = slot->pid;
+	memcpy(report->tag, slot->tag, sizeof(report->tag));
+	slot->suppressed = 0;
+}
+
+/* aplogd_filter_entry()
+ *
+ * Description: This function decides whether an entry is kept, looking only
+ * at its priority byte, tag and pid.
+ *
+ * @stream: (int) stream index the entry was read from
+ * @entry: (const struct logger_entry *) header of the entry as read from
+ *         the driver, suitably aligned
+ * @msg: (const char *) its payload, entry->len bytes at any alignment
+ * @now_ms: (unsigned long long) CLOCK_MONOTONIC time in ms
+ * @report: (struct aplogd_filter_report *) receives a pending suppressed
+ *          count; the caller logs it when report->suppressed is non-zero
+ *
+ * Return: (int) APLOGD_FILTER_KEEP or APLOGD_FILTER_DROP
+ *
+ * Notes: Events have no priority or text tag; they are rate limited by
+ *        event tag number only.
+ */
+int aplogd_filter_entry(int stream, const struct logger_entry *entry,
+		const char *msg, unsigned long long now_ms,
+		struct aplogd_filter_report *report)
+{
+	const struct tag_rule *rule;
+	struct rate_slot *slot;
+	const char *tag = NULL;
+	size_t tag_len = 0;
+	uint32_t hash;
+	uint32_t event_tag = 0;
+	unsigned long long cap;
+
+	report->suppressed = 0;
+	if (APLOGD_INPUT_EVENTS_POLL_INDEX == stream) {
+		if (entry->len < sizeof(event_tag))
+			return APLOGD_FILTER_KEEP;
+		memcpy(&event_tag, msg, sizeof(event_tag));
+		hash = event_tag;
+	} else {
+		if (entry->len < 2)
+			return APLOGD_FILTER_KEEP;
+		tag = msg + 1;
+		tag_len = strnlen(tag, entry->len - 1);
+		hash = filter_hash(tag, tag_len);
+		if (tag_rule_count && (rule = filter_find_rule(hash, tag, tag_len)) &&
+				msg[0] < rule->priority) {
+			aplogd_entries_filtered++;
+			return APLOGD_FILTER_DROP;
+		}
+	}
+	if (!usr_cfg_rate)
+		return APLOGD_FILTER_KEEP;
+
+	slot = &rate_slots[(hash ^ ((uint32_t)entry->pid * 2654435761u) ^ stream) &
+			(FILTER_RATE_SLOTS - 1)];
+	if (!slot->used || slot->stream != stream || slot->hash != hash ||
+			slot->pid != entry->pid) {
+		if (slot->used && slot->suppressed)
+			filter_report(slot, report);
+		slot->used = 1;
+		slot->stream = stream;
+		slot->hash = hash;
+		slot->pid = entry->pid;
+		slot->tokens = (unsigned long long)usr_cfg_burst * FILTER_TOKEN;
+		slot->last_ms = now_ms;
+		slot->suppressed = 0;
+		if (tag)
+			snprintf(slot->tag, sizeof(slot->tag), "%.*s", (int)tag_len, tag);
+		else
+			snprintf(slot->tag, sizeof(slot->tag), "event %u", event_tag);
+	}
+	/* usr_cfg_rate entries/s is usr_cfg_rate milli-tokens per ms */
+	cap = (unsigned long long)usr_cfg_burst * FILTER_TOKEN;
+	if (now_ms > slot->last_ms) {
+		slot->tokens += (now_ms - slot->last_ms) * usr_cfg_rate;
+		if (slot->tokens > cap)
+			slot->tokens = cap;
+		slot->last_ms = now_ms;
+	}
+	if (slot->tokens >= FILTER_TOKEN) {
+		slot->tokens -= FILTER_TOKEN;
+		if (slot->suppressed && !report->suppressed)
+			filter_report(slot, report);
+		return APLOGD_FILTER_KEEP;
+	}
+	slot->suppressed++;
+	aplogd_entries_suppressed++;
+	return APLOGD_FILTER_DROP;
+}
@@ -0,0 +1,39 @@
+/********************************************************************
+ * File Name: filter.h
+ *
+ * General Description: Header file for the aplogd pre-format entry filter:
+ * per-tag minimum priority and per tag/pid rate limiting.
+ *
+ *********************************************************************/
+
+#ifndef _APLOGD_FILTER_H_
+#define _APLOGD_FILTER_H_
+
+#include <log/logger.h>
+
+/* Same properties logfilter-set/logfilter-get manage:
+ * ap.log.filter.MOT_<tag> = V|D|I|W|E|F|S */
+#define APLOGD_FILTER_PROP_PREFIX	"ap.log.filter.MOT_"
+#define APLOGD_FILTER_TAG_MAX		32
+
+enum aplogd_filter_verdict {
+	APLOGD_FILTER_DROP = 0,
+	APLOGD_FILTER_KEEP,
+};
+
+/* Filled when a rate limited tag/pid has suppressed entries to report */
+struct aplogd_filter_report {
+	unsigned int suppressed;
+	int pid;
+	char tag[APLOGD_FILTER_TAG_MAX];
+};
+
+extern unsigned int aplogd_entries_filtered;
+extern unsigned int aplogd_entries_suppressed;
+
+void aplogd_filter_load(void);
+int aplogd_filter_enabled(void);
+int aplogd_filter_entry(int, const struct logger_entry *, const char *,
+		unsigned long long, struct aplogd_filter_report *);
+
+#endif /* Not defined _APLOGD_FILTER_H_ */
@@ -48,6 +48,9 @@
 #include "log_io.h"
 #include "rambuf.h"
 #include "aplogd_util.h"
+#include "rotate.h"
+#include "filter.h"
+#include "stats.h"
 /************************
  * Local defines and macros
  ************************/
@@ -72,6 +75,14 @@
 #define LOG_SYSTEM_PATH "/dev/log/system"
 #define LOG_KERNEL_PATH "/proc/kmsg"
 #endif /* APLOGD_TEST */
+
+#ifdef APLOGD_BENCH
+/* aplogd_bench stands in for the logger devices */
+int aplogd_bench_log_len(int fd);
+#define APLOGD_LOG_LEN(fd)	aplogd_bench_log_len(fd)
+#else
+#define APLOGD_LOG_LEN(fd)	ioctl(fd, LOGGER_GET_LOG_LEN)
+#endif /* APLOGD_BENCH */
 /************************
  * Local Globals
  ************************/
@@ -81,6 +92,7 @@ char input_filename[APLOGD_INPUT_LAST+1][64]={LOG_MAIN_PATH, LOG_RADIO_PATH, LOG
 char output_filename[APLOGD_INPUT_LAST+1][64]={"log.main.txt", "log.radio.txt", "log.events.txt", "log.system.txt", "log.kernel.txt"};
 const unsigned int aplogd_output_buffering = 4*1024;
 int g_current_storage=STORAGE_USERDATA;
+time_t aplogd_output_opened = 0;
 extern AndroidLogFormat * g_logformat;
 
 struct log_io_struct aplogd_io_array[APLOGD_MAX_IO_FDS];
@@ -92,6 +104,13 @@ unsigned int aplogd_bytes_logged = 0;
 unsigned int aplogd_bytes_lost = 0;
 static unsigned int unwritten_bytes=0;
 
+/* Batched reads from the logger devices; one arena serves all streams
+ * since each batch is processed before the next device is read. */
+#define APLOGD_READ_ARENA_SIZE	(32*1024)
+#define APLOGD_READ_SLOT_MAX	(sizeof(uint32_t) + LOGGER_ENTRY_MAX_LEN + 1 + 3)
+static char aplogd_read_arena[APLOGD_READ_ARENA_SIZE] __attribute__((aligned(4)));
+struct aplogd_read_stats aplogd_read_stats[APLOGD_INPUT_LAST+1];
+
 extern EventTagMap* g_eventTagMap ;
 static char defaultBuffer[1024];
 
@@ -100,38 +119,40 @@ int LogfilterAndBuffering(
 		const AndroidLogEntry *entry, int index)
 {
 	char *outBuffer = NULL;
+	char *ringBuffer;
+	size_t ringLen=0;
 	size_t totalLen=0;
 	int ret_val=0;
-	size_t len=0;
-	if (0 == android_log_shouldPrintLine(p_format, entry->tag,
-				entry->priority)) {
-		VPRINT("No need to output.\n");
-		ret_val=0;
-		return ret_val;
-	}
 
-	outBuffer = android_log_formatLogLine(p_format, defaultBuffer,
-			sizeof(defaultBuffer), entry, &totalLen);
+	/* Tag filtering is done on the raw entry, see filter.c */
+	/* Format straight into the ring when it has a contiguous stretch at
+	 * least as big as defaultBuffer; otherwise fall back to copying. */
+	ringBuffer = aplogd_rambuf_reserve(index, &ringLen);
+	if (ringBuffer && ringLen >= sizeof(defaultBuffer))
+		outBuffer = android_log_formatLogLine(p_format, ringBuffer,
+				ringLen, entry, &totalLen);
+	else
+		outBuffer = android_log_formatLogLine(p_format, defaultBuffer,
+				sizeof(defaultBuffer), entry, &totalLen);
 
 	if (!outBuffer){
 		EPRINT("Failed in android_log_formatLogLine.\n");
 		ret_val=-1;
 		return ret_val;
 	}
-        len= aplogd_rambuf_space(index);
-	if(len >  totalLen ){
-		memcpy(aplogd_io_array[index].input_buf, outBuffer, totalLen);
-		aplogd_io_array[index].input_buf += totalLen;
+	if (outBuffer == ringBuffer){
+		aplogd_rambuf_commit(index, totalLen);
+		ret_val=totalLen;
+	}else if(aplogd_rambuf_write(index, outBuffer, totalLen) >= 0){
 		ret_val=totalLen;
-		if(outBuffer !=defaultBuffer)
-			free(outBuffer);
 	}else{
-		WPRINT("no enough buffer to contain log messages.len=%d totallen=%d.entry->messageLen=%d\n",len, totalLen,entry->messageLen);
-		if(outBuffer !=defaultBuffer)
-			free(outBuffer);
+		WPRINT("no enough buffer to contain log messages.totallen=%d.entry->messageLen=%d\n", totalLen,entry->messageLen);
 		ret_val=-1;
 		aplogd_bytes_lost += totalLen;
+		aplogd_stream_stats[index].bytes_dropped += totalLen;
 	}
+	if(outBuffer !=defaultBuffer && outBuffer != ringBuffer)
+		free(outBuffer);
 	return ret_val;
 }
 
@@ -265,6 +286,31 @@ void aplogd_io_remove_poll_flag(int index, int flags)
 	aplogd_io_fd[index].events &= ~flags;
 }
 
+/* aplogd_output_bin_header()
+ *
+ * Description: This function starts a new binary log file with its header.
+ *
+ * @fd: (int) output fd, opened O_APPEND
+ * @index: (int) stream written to @fd
+ *
+ * Return: None
+ *
+ * Notes: Files that already have content are left alone.
+ */
+static void aplogd_output_bin_header(int fd, int index)
+{
+	struct aplogd_bin_header header;
+	struct stat statf;
+
+	if (fstat(fd, &statf) != 0 || statf.st_size != 0)
+		return;
+	memcpy(header.magic, APLOGD_BIN_MAGIC, sizeof(header.magic));
+	header.version = APLOGD_BIN_VERSION;
+	header.stream = index;
+	if (write(fd, &header, sizeof(header)) == sizeof(header))
+		total_write_size += sizeof(header);
+}
+
 /* aplogd_output_setup()
  *
  * Description: This function sets up the output mechanisms for the aplogger
@@ -303,6 +349,7 @@ int aplogd_output_setup(STORAGE_T storage)
 		return ret_val;
 	}
 	/* Setup the fd output */
+	aplogd_output_opened = time(NULL);
 	for (i=0;i<= APLOGD_INPUT_LAST;i++)
 	{
 		snprintf(fullpath, MAX_PATH_LEN, "%s/%s",pathname,output_filename[i]);
@@ -312,6 +359,8 @@ int aplogd_output_setup(STORAGE_T storage)
 			EPRINT("Could not setup output fd on %s\n", fullpath);
 			ret_val = -1;
 		}
+		else if (g_binary_format && i < APLOGD_INPUT_KERNEL_POLL_INDEX)
+			aplogd_output_bin_header(aplogd_io_array[i].output_fd, i);
 	}
 	DPRINT("Done setting up output fd: %d\n", ret_val);
 	return ret_val;
@@ -336,7 +385,8 @@ void aplogd_io_array_init(void)
 		aplogd_io_fd[i].revents = 0;
 		aplogd_io_array[i].input_fd = -1;
 		aplogd_io_array[i].output_fd = -1;
-		aplogd_io_array[i].input_buf=NULL;
+		aplogd_io_array[i].input_head=0;
+		aplogd_io_array[i].input_tail=0;
 		aplogd_io_array[i].input_buf_base=NULL;
 		aplogd_io_array[i].output_buf=NULL;
 		aplogd_io_array[i].output_buf_base=NULL;
@@ -376,6 +426,11 @@ int aplogd_input_setup(void)
 	}else{
 		EPRINT("VOLD socket open failed.\n");
 	}
+	if(aplogd_io_array[APLOGD_STATS_POLL_INDEX].input_fd < 0){
+		aplogd_io_array[APLOGD_STATS_POLL_INDEX].input_fd = aplogd_stats_setup();
+		if(aplogd_io_array[APLOGD_STATS_POLL_INDEX].input_fd >= 0)
+			aplogd_io_add_poll_fd(aplogd_io_array[APLOGD_STATS_POLL_INDEX].input_fd, POLLIN, APLOGD_STATS_POLL_INDEX);
+	}
 	DPRINT("Done setting up: %d\n", ret_val);
 	return ret_val;
 }
@@ -476,6 +531,230 @@ int is_storage_writable(STORAGE_T storage)
     return 0;
 }
 
+/* aplogd_io_read_batch()
+ *
+ * Description: This function reads every entry a logger device has ready,
+ * or as many as fit, into aplogd_read_arena before any of them is
+ * processed.
+ *
+ * @fd: (int) logger device
+ * @readable: (int *) bytes still readable; decremented by what was read
+ *
+ * Return: (int) number of bytes of aplogd_read_arena used
+ *
+ * Notes: The arena holds a sequence of slots, each a 4 byte length followed
+ *        by the entry. Binary capture packs slots back to back so a batch
+ *        can be stored as-is. Otherwise each slot is padded to keep the
+ *        next entry aligned and to leave room for the NUL after msg.
+ */
+static int aplogd_io_read_batch(int fd, int *readable)
+{
+	int used = 0;
+	int ret;
+	uint32_t rec_len;
+
+	while (*readable > 0 && APLOGD_READ_ARENA_SIZE - used >= APLOGD_READ_SLOT_MAX) {
+		/* The logger driver hands out exactly one entry per read(), and
+		 * readv() stops after the first short segment, so we loop. */
+		ret = read(fd, aplogd_read_arena + used + sizeof(rec_len), LOGGER_ENTRY_MAX_LEN);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			perror("logcat read");
+			exit(EXIT_FAILURE);
+		}
+		else if (!ret) {
+			EPRINT("read: Unexpected EOF!\n");
+			exit(EXIT_FAILURE);
+		}
+		rec_len = ret;
+		memcpy(aplogd_read_arena + used, &rec_len, sizeof(rec_len));
+		if (g_binary_format)
+			used += sizeof(rec_len) + ret;
+		else
+			used += (sizeof(rec_len) + ret + 1 + 3) & ~3;
+		*readable -= ret;
+	}
+	return used;
+}
+
+/* aplogd_io_buffer_entry()
+ *
+ * Description: This function stores one entry in the RAM buffer of a
+ * stream, formatted or, in binary capture, as-is.
+ *
+ * @poll_num: (int) stream index
+ * @rec: (char *) slot as laid out in aplogd_read_arena: 4 byte length,
+ *       then the entry, with room for a NUL after msg
+ *
+ * Return: None
+ *
+ * Notes: None
+ */
+static void aplogd_io_buffer_entry(int poll_num, char *rec)
+{
+	struct logger_entry *entry;
+	AndroidLogEntry log_entry;
+	char binaryMsgBuf[1024];
+	uint32_t rec_len;
+	int ret;
+
+	memcpy(&rec_len, rec, sizeof(rec_len));
+	if (g_binary_format) {
+		ret = sizeof(rec_len) + rec_len;
+		if (aplogd_rambuf_write(poll_num, rec, ret) < 0) {
+			WPRINT("no enough buffer to contain log entry.\n");
+			aplogd_bytes_lost += ret;
+			aplogd_stream_stats[poll_num].bytes_dropped += ret;
+		} else {
+			unwritten_bytes += ret;
+		}
+		return;
+	}
+	entry = (struct logger_entry *)(rec + sizeof(rec_len));
+	if(entry->len >=LOGGER_ENTRY_MAX_LEN)
+		entry->len=LOGGER_ENTRY_MAX_LEN-1;
+	entry->msg[entry->len] = '\0';
+	if(APLOGD_INPUT_EVENTS_POLL_INDEX == poll_num )
+		ret = android_log_processBinaryLogBuffer(entry, &log_entry, g_eventTagMap,binaryMsgBuf, sizeof(binaryMsgBuf));
+	else
+		ret = android_log_processLogBuffer(entry, &log_entry);
+	if(ret <0) {
+		EPRINT("Error in android_log_processLogBuffer.\n");
+		return;
+	}
+	ret=LogfilterAndBuffering(g_logformat, &log_entry, poll_num);
+	if(ret<0){
+		EPRINT("Error in LogfilterAndBuffering.\n");
+		return;
+	}
+	unwritten_bytes+=ret;
+}
+
+/* aplogd_io_report_suppressed()
+ *
+ * Description: This function logs how many entries the rate limiter dropped
+ * for a tag/pid, as an aplogd warning in the same stream.
+ *
+ * @poll_num: (int) stream index
+ * @cause: (const struct logger_entry *) entry that triggered the report;
+ *         its timestamp is reused
+ * @report: (const struct aplogd_filter_report *) what was suppressed
+ *
+ * Return: None
+ *
+ * Notes: Events are binary, so their reports go to the main stream.
+ */
+static void aplogd_io_report_suppressed(int poll_num, const struct logger_entry *cause,
+		const struct aplogd_filter_report *report)
+{
+	#define REPORT_MSG_MAX	128
+	char rec[sizeof(uint32_t) + sizeof(struct logger_entry) + REPORT_MSG_MAX + 1] __attribute__((aligned(4)));
+	struct logger_entry *entry = (struct logger_entry *)(rec + sizeof(uint32_t));
+	uint32_t rec_len;
+	int len;
+
+	entry->msg[0] = ANDROID_LOG_WARN;
+	len = 1 + strlen(strcpy(entry->msg + 1, LOG_TAG)) + 1;
+	len += snprintf(entry->msg + len, REPORT_MSG_MAX - len,
+			"suppressed %u entries from %s (pid %d)",
+			report->suppressed, report->tag, report->pid);
+	if (len >= REPORT_MSG_MAX)
+		len = REPORT_MSG_MAX - 1;
+	entry->len = len + 1;
+	entry->__pad = 0;
+	entry->pid = entry->tid = getpid();
+	entry->sec = cause->sec;
+	entry->nsec = cause->nsec;
+	rec_len = sizeof(*entry) + entry->len;
+	memcpy(rec, &rec_len, sizeof(rec_len));
+	if (APLOGD_INPUT_EVENTS_POLL_INDEX == poll_num)
+		poll_num = APLOGD_INPUT_MAIN_POLL_INDEX;
+	aplogd_io_buffer_entry(poll_num, rec);
+	#undef REPORT_MSG_MAX
+}
+
+/* aplogd_io_read_logger()
+ *
+ * Description: This function drains a /dev/log device in batches: all
+ * ready entries are read first, then filtered and buffered together.
+ *
+ * @poll_num: (int) stream index
+ * @fd: (int) logger device
+ *
+ * Return: None
+ *
+ * Notes: None
+ */
+static void aplogd_io_read_logger(int poll_num, int fd)
+{
+	struct aplogd_read_stats *stats = &aplogd_read_stats[poll_num];
+	struct aplogd_stream_stats *io_stats = &aplogd_stream_stats[poll_num];
+	struct aplogd_filter_report report;
+	struct logger_entry entry;
+	const char *rec;
+	struct timespec now;
+	unsigned long long now_ms;
+	uint32_t rec_len;
+	int filtering = aplogd_filter_enabled();
+	int verdict;
+	int readable;
+	int used, off, next;
+	int count, bucket;
+
+	readable = APLOGD_LOG_LEN(fd);
+	while (readable > 0) {
+		used = aplogd_io_read_batch(fd, &readable);
+		if (used == 0)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		now_ms = (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+		if (!filtering && g_binary_format && aplogd_rambuf_write(poll_num, aplogd_read_arena, used) >= 0) {
+			/* Stored the whole batch with one copy; just count entries */
+			for (off = 0, count = 0; off < used; count++) {
+				memcpy(&rec_len, aplogd_read_arena + off, sizeof(rec_len));
+				off += sizeof(rec_len) + rec_len;
+				io_stats->bytes_in += rec_len;
+			}
+			unwritten_bytes += used;
+		} else {
+			for (off = 0, count = 0; off < used; off = next, count++) {
+				memcpy(&rec_len, aplogd_read_arena + off, sizeof(rec_len));
+				io_stats->bytes_in += rec_len;
+				if (g_binary_format)
+					next = off + sizeof(rec_len) + rec_len;
+				else
+					next = off + ((sizeof(rec_len) + rec_len + 1 + 3) & ~3);
+				if (filtering) {
+					/* Binary slots are packed, so the entry may be
+					 * unaligned; only an aligned copy of its header is
+					 * read as a struct */
+					rec = aplogd_read_arena + off + sizeof(rec_len);
+					memcpy(&entry, rec, sizeof(entry));
+					verdict = aplogd_filter_entry(poll_num, &entry,
+							rec + sizeof(entry), now_ms, &report);
+					if (report.suppressed)
+						aplogd_io_report_suppressed(poll_num, &entry, &report);
+					if (APLOGD_FILTER_DROP == verdict)
+						continue;
+				}
+				aplogd_io_buffer_entry(poll_num, aplogd_read_arena + off);
+			}
+		}
+		stats->batches++;
+		stats->entries += count;
+		io_stats->entries_in += count;
+		if ((unsigned int)count > stats->max_batch)
+			stats->max_batch = count;
+		for (bucket = 0; count > 1 && bucket < APLOGD_READ_HIST_BUCKETS - 1; count >>= 1)
+			bucket++;
+		stats->batch_hist[bucket]++;
+	}
+	stats->wakeups++;
+}
+
 /* aplogd_io_read_data()
  *
  * Description: This function reads data from an input file descriptor and adds
@@ -490,83 +769,28 @@ int is_storage_writable(STORAGE_T storage)
 static void aplogd_io_read_data(int poll_num)
 {
 	int my_fd = 0;
-	int len=0;
 	int ret=0;
-	int ReadableLogSize;
 	my_fd   = aplogd_io_fd[poll_num].fd;
 	VPRINT("aplogd_io_read_data poll_num=%d.\n",poll_num);
 	if(poll_num < APLOGD_INPUT_KERNEL_POLL_INDEX){
-		int ret=0;
-		unsigned char buf[LOGGER_ENTRY_MAX_LEN + 1] __attribute__((aligned(4)));
-		struct logger_entry *entry = (struct logger_entry *) buf;
-		AndroidLogEntry log_entry;
-		char binaryMsgBuf[1024];
-		ReadableLogSize=ioctl(my_fd, LOGGER_GET_LOG_LEN);
-		while(ReadableLogSize>0){
-			ret = read (my_fd, entry, LOGGER_ENTRY_MAX_LEN);
-			if (ret < 0) {
-				if (errno == EINTR)
-					continue;
-				if (errno == EAGAIN)
-					break;
-				perror("logcat read");
-				exit(EXIT_FAILURE);
-			}
-			else if (!ret) {
-				EPRINT("read: Unexpected EOF!\n");
-				exit(EXIT_FAILURE);
-			}
-			/* NOTE: driver guarantees we read exactly one full entry */
-			if(entry->len >=LOGGER_ENTRY_MAX_LEN)
-				entry->len=LOGGER_ENTRY_MAX_LEN-1;
-			entry->msg[entry->len] = '\0';
-			if(APLOGD_INPUT_EVENTS_POLL_INDEX == poll_num )
-				errno = android_log_processBinaryLogBuffer(entry, &log_entry, g_eventTagMap,binaryMsgBuf, sizeof(binaryMsgBuf));
-			else
-				errno = android_log_processLogBuffer(entry, &log_entry);
-			if(errno <0) {
-				EPRINT("Error in android_log_processLogBuffer.\n");
-				break;
-				}
-			ret=LogfilterAndBuffering(g_logformat, &log_entry, poll_num);
-			if(ret<0){
-				EPRINT("Error in LogfilterAndBuffering.\n");
-				break;
-			}else{
-				unwritten_bytes+=ret;
-				if(unwritten_bytes>= aplogd_output_buffering){
-					aplogd_rambuf_outputall();
-					unwritten_bytes=0;
-					aplogd_poll_timeout=-1;
-				}else{
-					aplogd_poll_timeout=60000;
-				}
-			}
-			ReadableLogSize-=ret;
-		}//while loop
+		aplogd_io_read_logger(poll_num, my_fd);
 	}else if (APLOGD_INPUT_KERNEL_POLL_INDEX == poll_num){
 		char buf[256];
 		ret = read(my_fd, buf, 255);
 		while(ret>0){
-		        len = aplogd_rambuf_space(poll_num);
-			if(len > 0 && len >= ret && ret <= 255 ){
-				buf[ret]='\0';
-                       memcpy(aplogd_io_array[poll_num].input_buf, buf, ret );
-                       aplogd_io_array[poll_num].input_buf += ret;
-               } else {
-                       WPRINT("no enough buffer to contain log messages.\n");
-                       break;
-               }
-			unwritten_bytes+=ret;
-			if(unwritten_bytes >= aplogd_output_buffering){
-				aplogd_rambuf_outputall();
-				aplogd_poll_timeout=-1;
-				unwritten_bytes=0;
-			}else{
-				aplogd_poll_timeout=60000;
+			buf[ret]='\0';
+			aplogd_stream_stats[poll_num].bytes_in += ret;
+			if (aplogd_rambuf_write(poll_num, buf, ret) < 0) {
+				WPRINT("no enough buffer to contain log messages.\n");
+				aplogd_bytes_lost += ret;
+				aplogd_stream_stats[poll_num].bytes_dropped += ret;
+				break;
 			}
+			unwritten_bytes+=ret;
 			ret=read(my_fd, buf, 255);
 		}
+	}else if (APLOGD_STATS_POLL_INDEX == poll_num){
+		aplogd_stats_serve(my_fd);
 	}else {
 		int sock_fd= aplogd_io_array[APLOGD_VOLD_STATUS_POLL_INDEX].input_fd;
 		char buf[4096];
@@ -606,6 +830,27 @@ static void aplogd_io_read_data(int poll_num)
 }
 
 
+/* aplogd_io_flush_round()
+ *
+ * Description: This function writes out the RAM buffers once per poll round
+ * when enough data has been collected, so each output file gets at most one
+ * writev() per round however many entries were read.
+ *
+ * Return: None
+ *
+ * Notes: Data below aplogd_output_buffering is flushed by the poll timeout.
+ */
+static void aplogd_io_flush_round(void)
+{
+	if(unwritten_bytes >= aplogd_output_buffering){
+		aplogd_rambuf_outputall();
+		unwritten_bytes=0;
+		aplogd_poll_timeout=-1;
+	}else if(unwritten_bytes > 0){
+		aplogd_poll_timeout=60000;
+	}
+}
+
 /* aplogd_io_boot_finish()
  *
  * Description: This function attempts to finish operations that may have been
@@ -728,15 +973,8 @@ static int aplogd_io_handle_poll(int poll_offset)
 
 void aplogd_log_save(STORAGE_T storage)
 {
-	char file_name[MAX_PATH_LEN];
-	char bak_dir[MAX_PATH_LEN];
-	int index=0;
-	int count=0;
+	char staging[MAX_PATH_LEN];
 	static int backup_flag=0;
-	time_t ltime;
-	struct tm *Tm;
-	long num = 0;
-	struct statfs fs_stat;
 
 	DPRINT("Enter aplogd_log_save.\n");
 	if (((backup_flag&1)==1) && (STORAGE_SECONDARY==storage)) return;
@@ -744,58 +982,63 @@ void aplogd_log_save(STORAGE_T storage)
 	if(STORAGE_SECONDARY == storage || STORAGE_EXTERNAL== storage ){
 		if(access(g_output_path[storage],0)!=0)
 			return;
-		if (statfs(g_output_path[storage], &fs_stat) == -1)
-			ALOGE("Error on aplogd statfs: %s errno=%d(%s)\n",
-				g_output_path[storage], errno, strerror(errno));
-		else if (fs_stat.f_bfree * fs_stat.f_bsize < SZ_1G) {
-			usr_cfg_backup = DEFAULT_USR_CFG_MAX_DIR_COUNT;
-			ALOGW("%s free space size < 1G, only save the lastest %d log folders",
-				g_output_path[storage], DEFAULT_USR_CFG_MAX_DIR_COUNT);
-		}
-		num = aplogd_util_cleardir(g_output_path[storage], usr_cfg_backup);
-		ltime=time(NULL);
-		Tm=localtime(&ltime);
-		if ((num != -1) && (Tm!=NULL)) {
-			num = (num + 1) % LONG_MAX;
-			snprintf(bak_dir, MAX_PATH_LEN,  "%s/No.%ld_%d%02d%02d%02d%02d%02d",
-				g_output_path[storage], num, Tm->tm_year+1900,Tm->tm_mon+1,
-				Tm->tm_mday,Tm->tm_hour,Tm->tm_min, Tm->tm_sec);
-		} else
-			snprintf(bak_dir,MAX_PATH_LEN,  "%s/last",g_output_path[storage]);
-		for (index=0;index <= APLOGD_INPUT_LAST;index++){
-			snprintf(file_name, MAX_PATH_LEN, "%s/%s", g_output_path[storage], output_filename[index]);
-			if(access(file_name, 0)!=0){
-				count++;
-				continue;
-			}
-			DPRINT("gzip %s.\n",file_name);
-			aplogd_util_gzip(file_name);
-		}
 		if(STORAGE_SECONDARY==storage)
 			backup_flag|=1;
 		if(STORAGE_EXTERNAL==storage)
 			backup_flag|=2;
-		if (count== APLOGD_INPUT_LAST+1)
-			return;
-		/* See comments on permissions in aplogd_output_setup(). */
-		mkdir(bak_dir, 0750);
-		DPRINT("move %s to %s.\n",g_output_path[storage], bak_dir);
-		aplogd_util_move(g_output_path[storage], bak_dir, ".gz");
-	}else if(STORAGE_USERDATA == storage) {
-		snprintf(bak_dir, MAX_PATH_LEN, "%s/last",g_output_path[storage]);
-		/* See comments on permissions in aplogd_output_setup(). */
-		mkdir(bak_dir, 0750);
-		for (index=0;index <= APLOGD_INPUT_LAST; index++){
-			snprintf(file_name, MAX_PATH_LEN, "%s/%s", g_output_path[storage], output_filename[index]);
-			aplogd_util_gzip(file_name);
-		}
-		DPRINT("move %s to %s.\n",g_output_path[storage], bak_dir);
-		aplogd_util_cleardir(bak_dir, 1);
-		aplogd_util_move(g_output_path[storage], bak_dir, ".gz");
 	}
+	/* Only rename the files here; compressing them and filing them into
+	 * a No.N (or last) folder is done by the rotation worker. Whatever an
+	 * earlier run left staged goes first, into the segments filed along. */
+	aplogd_rotate_recover(storage);
+	if (aplogd_rotate_stage(storage, staging) < 0)
+		return;
+	aplogd_rotate_queue(APLOGD_ROTATE_SAVE, storage, staging);
 	DPRINT("Leaving aplogd_log_save.\n");
 }
 
+/* aplogd_io_poll_round()
+ *
+ * Description: This function waits for input once, handles every fd that
+ * became ready and then flushes the RAM buffers if enough was collected.
+ *
+ * Return: (int) result of poll()
+ *
+ * Notes: One iteration of the aplogd_log_io() loop; aplogd_bench drives
+ *        it directly.
+ */
+int aplogd_io_poll_round(void)
+{
+	int i = 0;
+	int poll_ret = 0;
+	int ret_val;
+
+	ret_val = poll_ret = poll(aplogd_io_fd, APLOGD_MAX_IO_FDS,aplogd_poll_timeout);
+	if(poll_ret ==0) {
+		aplogd_poll_timeouts++;
+		aplogd_rambuf_outputall();
+		aplogd_poll_timeout=-1;
+		unwritten_bytes=0;
+	}else {
+		if (poll_ret > 0)
+			aplogd_poll_wakeups++;
+		while (poll_ret > 0 && i < APLOGD_MAX_IO_FDS){
+			VPRINT("poll_ret =%d.\n",poll_ret);
+			if (aplogd_io_fd[i].revents){
+				VPRINT("fd %d had revent %d\n",
+					aplogd_io_fd[i].fd,
+					aplogd_io_fd[i].revents);
+				if (aplogd_io_handle_poll(i) & APLOGD_POLL_STATUS_RM_FD)
+					i--;
+				poll_ret--;
+			}
+			i++;
+		}           /* While we have poll events returned */
+		aplogd_io_flush_round();
+	}
+	return ret_val;
+}
+
 /* aplogd_log_io()
  *
  * Description: This function provides the main log input / output
@@ -821,7 +1064,6 @@ void aplogd_log_io(void)
 	{
 		int i = 0;
 		int ret = 0;
-		int poll_ret = 0;
 		if(1== __atomic_swap(0, &config_changed)){
 			ret = aplogd_calc_storage_pref();
 			if(g_current_storage != ret){
@@ -836,26 +1078,7 @@ void aplogd_log_io(void)
 						aplogd_io_add_poll_fd(aplogd_io_array[i].input_fd, POLLIN,i);
 			}
 		}
-		i=0;
-		poll_ret = poll(aplogd_io_fd, APLOGD_MAX_IO_FDS,aplogd_poll_timeout);
-		if(poll_ret ==0) {
-			aplogd_rambuf_outputall();
-			aplogd_poll_timeout=-1;
-			unwritten_bytes=0;
-		}else {
-			while (poll_ret > 0 && i < APLOGD_MAX_IO_FDS){
-				VPRINT("poll_ret =%d.\n",poll_ret);
-				if (aplogd_io_fd[i].revents){
-					VPRINT("fd %d had revent %d\n",
-						aplogd_io_fd[i].fd,
-						aplogd_io_fd[i].revents);
-					if (aplogd_io_handle_poll(i) & APLOGD_POLL_STATUS_RM_FD)
-						i--;
-					poll_ret--;
-				}
-				i++;
-			}           /* While we have poll events returned */
-		}
+		aplogd_io_poll_round();
 		if(aplogd_io_array[APLOGD_VOLD_STATUS_POLL_INDEX].input_fd <0){
 			aplogd_io_array[APLOGD_VOLD_STATUS_POLL_INDEX].input_fd = socket_local_client("vold", ANDROID_SOCKET_NAMESPACE_RESERVED, SOCK_STREAM);
 			if(aplogd_io_array[APLOGD_VOLD_STATUS_POLL_INDEX].input_fd >= 0){
@@ -874,72 +1097,25 @@ fail:
 }
 
 
-/* aplogd_io_backup()
+/* aplogd_io_backupall()
  *
- * Description: This function will rename the output file to .old and create a new fd.
+ * Description: This function moves all output files aside and queues them
+ * to the rotation worker, which compresses them into the next segment of
+ * the store (see segment.c).
  *
- * @index:(int) index of output_filename
+ * @storage: (STORAGE_T) storage whose output files are rotated
  *
- * Return: (int)New fd of output file description
+ * Return: (int) 0 on success; -1 on failure
  *
- * Notes: None
+ * Notes: Output fds must be closed before calling this function.
  */
-
-int aplogd_io_file_backup(int index , STORAGE_T storage)
-{
-        char file_name[MAX_PATH_LEN];
-        char bak_name[MAX_PATH_LEN];
-	char cur_path[MAX_PATH_LEN];
-        int ret_val=0;
-	int i;
-	static int n=0;
-	snprintf(cur_path, MAX_PATH_LEN, "%s", g_output_path[storage]);
-	i=n;
-	while(i>0){
-		snprintf(file_name, MAX_PATH_LEN, "%s/%s.%d.%s.gz", cur_path,APLOGD_OLD_FILE_EXT,i-1,  output_filename[index]);
-		snprintf(bak_name, MAX_PATH_LEN, "%s/%s.%d.%s.gz", cur_path, APLOGD_OLD_FILE_EXT, i, output_filename[index]);
-		file_name[MAX_PATH_LEN - 1] = '\0';
-		bak_name[MAX_PATH_LEN - 1] = '\0';
-		if (rename(file_name, bak_name) < 0){
-			EPRINT("Couldn't rename %s to %s; errno=%s. We'll delete it\n",
-					file_name, bak_name, strerror(errno));
-			unlink(file_name);
-			ret_val=-1;
-		}
-		i--;
-	}
-	n++;
-	snprintf(file_name, MAX_PATH_LEN, "%s/%s", cur_path, output_filename[index]);
-	snprintf(bak_name, MAX_PATH_LEN, "%s/%s.0.%s", cur_path, APLOGD_OLD_FILE_EXT,  output_filename[index]);
-        file_name[MAX_PATH_LEN - 1] = '\0';
-        bak_name[MAX_PATH_LEN - 1] = '\0';
-        if(access(bak_name,0)==0)
-                unlink(bak_name);
-        if (rename(file_name, bak_name) < 0)
-        {
-		EPRINT("Couldn't rename %s to %s; errno=%s. We'll delete it\n",
-				file_name, bak_name, strerror(errno));
-
-                unlink(file_name);
-                ret_val=-1;
-        }
-	struct stat statf;
-        if (stat(bak_name, &statf) ){
-               total_write_size -= statf.st_size;
-        }
-	aplogd_util_gzip(bak_name);
-        DPRINT("Leaving file backup.\n");
-        return ret_val;
-}
-
 int aplogd_io_backupall(STORAGE_T storage)
 {
-        int i;
-        int ret_val=0;
-        for (i=0;i<= APLOGD_INPUT_LAST;i++){
-                ret_val+=aplogd_io_file_backup(i,storage);
-	}
-	return ret_val;
+	char staging[MAX_PATH_LEN];
+
+	if (aplogd_rotate_stage(storage, staging) < 0)
+		return -1;
+	return aplogd_rotate_queue(APLOGD_ROTATE_BACKUP, storage, staging);
 }
 
 void aplogd_close_output()
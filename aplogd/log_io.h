@@ -14,6 +14,7 @@
 #ifndef _APLOGD_LOG_INPUT_H_
 #define _APLOGD_LOG_INPUT_H_
 
+#include <time.h>
 #include "aplogd.h"
 
 enum aplogd_poll_indexes {
@@ -24,6 +25,7 @@ enum aplogd_poll_indexes {
 	APLOGD_INPUT_KERNEL_POLL_INDEX,
     APLOGD_INPUT_LAST = APLOGD_INPUT_KERNEL_POLL_INDEX,
 	APLOGD_VOLD_STATUS_POLL_INDEX,
+	APLOGD_STATS_POLL_INDEX,
 	/* Add new entries above this line */
 	APLOGD_MAX_IO_FDS
 };
@@ -31,6 +33,21 @@ enum aplogd_poll_indexes {
 extern char output_folder[STORAGE_MAX][64];
 extern char output_filename[APLOGD_INPUT_LAST+1][64];
 
+/* Per-stream reader counters. batch_hist[n] counts batches of
+ * 2^n .. 2^(n+1)-1 entries; the last bucket takes everything larger. */
+#define APLOGD_READ_HIST_BUCKETS	8
+struct aplogd_read_stats {
+	unsigned int wakeups;		/* poll wakeups on this stream */
+	unsigned int batches;		/* arena fills; > wakeups under bursts */
+	unsigned int entries;
+	unsigned int max_batch;
+	unsigned int batch_hist[APLOGD_READ_HIST_BUCKETS];
+};
+
+extern struct aplogd_read_stats aplogd_read_stats[APLOGD_INPUT_LAST+1];
+extern unsigned int aplogd_bytes_lost;
+extern time_t aplogd_output_opened;
+
 struct aplogd_output_struct {
 	int fd;
 	ssize_t (*this_write) (int, const char*, int);
@@ -38,6 +55,7 @@ struct aplogd_output_struct {
 
 /* Function prototypes */
 void aplogd_log_io(void);
+int aplogd_io_poll_round(void);
 int aplogd_io_fd_setup(const char *);
 void aplogd_io_add_poll_fd(int, short, int);
 void aplogd_io_add_poll_flag(int, int);
@@ -46,7 +64,6 @@ void aplogd_io_remove_poll_flag(int, int);
 void aplogd_io_array_init(void);
 int aplogd_input_setup(void);
 int aplogd_output_setup(STORAGE_T);
-int aplogd_io_file_backup(int index,STORAGE_T);
 int aplogd_io_backupall(STORAGE_T);
 void aplogd_close_output();
 #endif /* Not defined _APLOGD_LOG_INPUT_H_ */
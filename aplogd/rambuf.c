@@ -62,9 +62,20 @@
 //#include "aplogd_util.h"
 #include "log_io.h"
 #include "rambuf.h"
+#include "stats.h"
 /* Macros */
 
-int aplogd_ram_buff_size = 8*1024;
+/* Each stream owns a ring of aplogd_ram_buff_size bytes. input_head and
+ * input_tail count bytes ever written to / drained from it and are only
+ * reduced modulo the size when indexing, so head - tail is always the fill
+ * level, even across unsigned wrap. The size is a power of two, otherwise
+ * the offset would jump when the counters wrap at 2^32. */
+#define RAMBUF_OFFSET(n)	((n) & (aplogd_ram_buff_size - 1))
+/* Flush a stream once it is this full instead of waiting for the next
+ * aplogd_output_buffering flush, so bursts are written out, not dropped. */
+#define RAMBUF_HIGH_WATERMARK	(aplogd_ram_buff_size / 4 * 3)
+
+int aplogd_ram_buff_size = DEFAULT_USR_CFG_RAMBUF_KB*1024;
 char *aplogd_ram_buffer = NULL;
 
 /* Functions */
@@ -75,19 +86,28 @@ char *aplogd_ram_buffer = NULL;
  *
  * Return: (int) 0 on success
  *
- * Notes: None
+ * Notes: The per-stream size comes from usr_cfg_rambuf, rounded up to
+ *        a power of two.
  */
 int aplogd_rambuf_init(void)
 {
 	DPRINT("Initializing ram buffer\n");
 	int i;
+	/* Rounded up to a power of two for RAMBUF_OFFSET(); the largest
+	 * usr_cfg_rambuf is one already. */
+	for (aplogd_ram_buff_size = 1024;
+			aplogd_ram_buff_size < (int)usr_cfg_rambuf * 1024;
+			aplogd_ram_buff_size <<= 1)
+		;
+	usr_cfg_rambuf = aplogd_ram_buff_size / 1024;
 	aplogd_ram_buffer = (char *)malloc(aplogd_ram_buff_size * (APLOGD_INPUT_LAST +1));
 	if(!aplogd_ram_buffer)
 		exit(EXIT_FAILURE);
 	for (i = 0; i <=APLOGD_INPUT_LAST ; i++){
 
 		aplogd_io_array[i].input_buf_base = aplogd_ram_buffer + i * aplogd_ram_buff_size;
-		aplogd_io_array[i].input_buf = aplogd_io_array[i].input_buf_base;
+		aplogd_io_array[i].input_head = 0;
+		aplogd_io_array[i].input_tail = 0;
 
 	}
 	return 0;
@@ -115,11 +135,11 @@ void aplogd_rambuf_destroy(void)
  *
  * Description: This function returns the amount of free space in the buffer
  *
- * @buffer_type: (int) whether to get the size of the input or output buffer
+ * @index: (int) stream index
  *
  * Return: (int) amount of free space in the buffer; -1 on failure
  *
- * Notes: The rambuf lock must be held before calling this function.
+ * Notes: None
  */
 
 int aplogd_rambuf_space(int index)
@@ -135,24 +155,106 @@ int aplogd_rambuf_space(int index)
 
 /* aplogd_rambuf_bytes_filled()
  *
- * Description: This function returns the number of bytes that are free in a
- *              buffer
+ * Description: This function returns the number of bytes waiting to be
+ *              written out in a buffer
  *
- * @buffer_type: (int) input or output buffer choice
+ * @index: (int) stream index
  *
  * Return: (int) number of bytes filled in the buffer
  *
- * Notes: Rambuf lock must be held before calling this function
+ * Notes: None
  */
 
 int aplogd_rambuf_bytes_filled(int index)
 {
-	int ret_val = -1;
+	return (int)(aplogd_io_array[index].input_head - aplogd_io_array[index].input_tail);
+}
 
-	ret_val = (aplogd_io_array[index].input_buf - aplogd_io_array[index].input_buf_base);
-	return ret_val;
+/* aplogd_rambuf_write()
+ *
+ * Description: This function appends @len bytes to the ring of a stream.
+ * When the ring can't hold them it is flushed first, and it is flushed
+ * again once it passes the high watermark.
+ *
+ * @index: (int) stream index
+ * @data: (const char *) bytes to append
+ * @len: (int) number of bytes
+ *
+ * Return: (int) @len on success; -1 if the data had to be dropped
+ *
+ * Notes: None
+ */
+int aplogd_rambuf_write(int index, const char *data, int len)
+{
+	struct log_io_struct *io = &aplogd_io_array[index];
+	unsigned int off;
+	int first;
+
+	if (!io->input_buf_base || len > aplogd_ram_buff_size)
+		return -1;
+	if (len > aplogd_rambuf_space(index)) {
+		aplogd_rambuf_output(index);
+		if (len > aplogd_rambuf_space(index))
+			return -1;
+	}
+	off = RAMBUF_OFFSET(io->input_head);
+	first = aplogd_ram_buff_size - off;
+	if (first > len)
+		first = len;
+	memcpy(io->input_buf_base + off, data, first);
+	memcpy(io->input_buf_base, data + first, len - first);
+	io->input_head += len;
+	if (aplogd_rambuf_bytes_filled(index) >= RAMBUF_HIGH_WATERMARK)
+		aplogd_rambuf_output(index);
+	return len;
+}
+
+/* aplogd_rambuf_reserve()
+ *
+ * Description: This function returns the contiguous free space at the write
+ * end of a stream's ring, so a line can be formatted in place.
+ *
+ * @index: (int) stream index
+ * @len: (size_t *) receives the number of contiguous free bytes
+ *
+ * Return: (char *) start of the free space; NULL if there is none
+ *
+ * Notes: Nothing is added to the ring until aplogd_rambuf_commit().
+ */
+char *aplogd_rambuf_reserve(int index, size_t *len)
+{
+	struct log_io_struct *io = &aplogd_io_array[index];
+	unsigned int off;
+	int space;
+
+	*len = 0;
+	if (!io->input_buf_base)
+		return NULL;
+	space = aplogd_rambuf_space(index);
+	if (space <= 0)
+		return NULL;
+	off = RAMBUF_OFFSET(io->input_head);
+	*len = aplogd_ram_buff_size - off;
+	if ((int)*len > space)
+		*len = space;
+	return io->input_buf_base + off;
 }
 
+/* aplogd_rambuf_commit()
+ *
+ * Description: This function adds @len bytes written at the pointer from
+ * aplogd_rambuf_reserve() to the ring.
+ *
+ * Return: None
+ *
+ * Notes: @len must not exceed the length returned by the reserve.
+ */
+void aplogd_rambuf_commit(int index, int len)
+{
+	aplogd_io_array[index].input_head += len;
+	if (aplogd_rambuf_bytes_filled(index) >= RAMBUF_HIGH_WATERMARK)
+		aplogd_rambuf_output(index);
+}
 
 /* aplogd_rambuf_output()
  *
@@ -164,11 +266,16 @@ int aplogd_rambuf_bytes_filled(int index)
  * Output: (int) 0 on full write; -1 on partial or no write
  *
  * Notes: This function will cleanup this list after outputting its contents;
- *        it should only be called when you are ready to output data.
+ *        it should only be called when you are ready to output data. Data
+ *        that could not be written stays in the ring.
  */
 
 int aplogd_rambuf_output(int index)
 {
+	struct log_io_struct *io = &aplogd_io_array[index];
+	struct iovec iov[2];
+	int iovcnt;
+	unsigned int off;
 	int ret_val = 0;
 	int need_written = 0;
 	int size_written = 0;
@@ -178,34 +285,50 @@ int aplogd_rambuf_output(int index)
 	VPRINT("output index:%d\n", index );
 	need_written=aplogd_rambuf_bytes_filled(index);
 	VPRINT("need_written=%d.\n",need_written);
-	if(!aplogd_io_array[index].input_buf_base || !(need_written >0))
+	if(!io->input_buf_base || !(need_written >0))
 	{
 		return -1;
 	}
-	if (aplogd_io_array[index].output_fd < 0)
+	if (io->output_fd < 0)
 	{
 		WPRINT("output fd hasn't been initialized.\n");
-		aplogd_io_array[index].input_buf = aplogd_io_array[index].input_buf_base;
+		aplogd_stream_stats[index].bytes_discarded += need_written;
+		io->input_tail = io->input_head;
 		ret_val = -1;
 		return ret_val;
 	}
 
 	while(need_written >0) {
-		size_written = write(aplogd_io_array[index].output_fd, (void*)aplogd_io_array[index].input_buf_base, need_written);
+		/* The filled region wraps at most once */
+		off = RAMBUF_OFFSET(io->input_tail);
+		iov[0].iov_base = io->input_buf_base + off;
+		iov[0].iov_len = aplogd_ram_buff_size - off;
+		iovcnt = 1;
+		if ((int)iov[0].iov_len >= need_written) {
+			iov[0].iov_len = need_written;
+		} else {
+			iov[1].iov_base = io->input_buf_base;
+			iov[1].iov_len = need_written - iov[0].iov_len;
+			iovcnt = 2;
+		}
+		size_written = writev(io->output_fd, iov, iovcnt);
 		if (size_written < 0 )
 		{
+			if (EINTR == errno)
+				continue;
 			EPRINT("output write: size_written=%d, errno=%d\n", size_written, errno);
 			if (ENOSPC == errno)
 				aplogd_close_output();
 			if (EBADF == errno)
-				aplogd_io_array[index].output_fd=-1;
+				io->output_fd=-1;
 			ret_val=-1;
 			return ret_val;
 		}
+		io->input_tail += size_written;
 		need_written -= size_written;
+		aplogd_stream_stats[index].bytes_written += size_written;
 		total_write_size+=size_written;
 	}
-	aplogd_io_array[index].input_buf = aplogd_io_array[index].input_buf_base;
         if (total_write_size >=aplogd_logfile_max)
         {
 		ALOGI("aplogd_logfile_max=%d, total_write_size=%d\n",aplogd_logfile_max, total_write_size);
@@ -217,9 +340,26 @@ int aplogd_rambuf_output(int index)
 	return ret_val;
 }
 
+/* aplogd_rambuf_outputall()
+ *
+ * Description: This function writes out every stream, one writev() per
+ * output file, and with --sync then flushes them to storage together.
+ *
+ * Return: None
+ *
+ * Notes: None
+ */
 void aplogd_rambuf_outputall()
 {
 	int i;
+	int written[APLOGD_INPUT_LAST+1];
+	unsigned long long start = aplogd_stats_now_us();
 	for (i=0;i<=APLOGD_INPUT_LAST;i++)
-		aplogd_rambuf_output(i);
+		written[i] = (aplogd_rambuf_output(i) == 0);
+	if (usr_cfg_sync) {
+		for (i=0;i<=APLOGD_INPUT_LAST;i++)
+			if (written[i] && aplogd_io_array[i].output_fd >= 0)
+				fdatasync(aplogd_io_array[i].output_fd);
+	}
+	aplogd_stats_flush_done(start);
 }
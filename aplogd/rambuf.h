@@ -43,6 +43,8 @@
 #ifndef _APLOGD_RAMBUF_H_
 #define _APLOGD_RAMBUF_H_
 
+#include <sys/types.h>
+
 enum aplogd_rambuf_type {
 	APLOGD_RAMBUF_INPUT = 0,
 	APLOGD_RAMBUF_OUTPUT,
@@ -53,6 +55,9 @@ int aplogd_rambuf_init(void);
 void aplod_rambuf_destroy(void);
 int aplogd_rambuf_space(int);
 int aplogd_rambuf_bytes_filled(int);
+int aplogd_rambuf_write(int, const char *, int);
+char *aplogd_rambuf_reserve(int, size_t *);
+void aplogd_rambuf_commit(int, int);
 int aplogd_rambuf_output(int);
 void aplogd_rambuf_outputall();
 
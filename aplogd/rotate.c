@@ -0,0 +1,404 @@
+/********************************************************************
+ * File Name: rotate.c
+ *
+ * General Description: This file provides the rotation worker of aplogd.
+ * The poll loop only renames closed log files into a staging directory
+ * and queues a job; gzip, the segment store and pruning of old log
+ * folders all happen on this thread so the logger devices keep being
+ * drained while a 50M file is compressed.
+ *
+ *********************************************************************/
+
+/* Includes */
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <cutils/log.h>
+
+/* Aplogd includes */
+#include "aplogd.h"
+#include "log_io.h"
+#include "aplogd_util.h"
+#include "rotate.h"
+#include "segment.h"
+
+/* Locals */
+static struct aplogd_rotate_job rotate_queue[APLOGD_ROTATE_QUEUE_LEN];
+static unsigned int rotate_head = 0;	/* next job to run */
+static unsigned int rotate_count = 0;	/* jobs in rotate_queue */
+static int rotate_running = 0;		/* worker is inside a job */
+static int rotate_stopping = 0;		/* no new jobs; see aplogd_rotate_stop() */
+static struct aplogd_rotate_stats rotate_stats;
+static pthread_mutex_t rotate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rotate_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t rotate_not_full = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t rotate_idle = PTHREAD_COND_INITIALIZER;
+
+static unsigned long long aplogd_rotate_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* aplogd_rotate_save()
+ *
+ * Description: This function files the staged logs of a previous session,
+ * together with the backups left in the output path, into a numbered
+ * folder (external storages) or into last/ (userdata).
+ *
+ * Return: None
+ *
+ * Notes: Worker thread only.
+ */
+static void aplogd_rotate_save(struct aplogd_rotate_job *job)
+{
+	char file_name[MAX_PATH_LEN];
+	char gzip_name[MAX_PATH_LEN];
+	char bak_dir[MAX_PATH_LEN];
+	char *out_path = g_output_path[job->storage];
+	int index;
+	int count = 0;
+	struct tm *Tm;
+	long num = 0;
+	struct statfs fs_stat;
+
+	if (STORAGE_SECONDARY == job->storage || STORAGE_EXTERNAL == job->storage) {
+		if (statfs(out_path, &fs_stat) == -1)
+			ALOGE("Error on aplogd statfs: %s errno=%d(%s)\n",
+				out_path, errno, strerror(errno));
+		else if (fs_stat.f_bfree * fs_stat.f_bsize < SZ_1G) {
+			usr_cfg_backup = DEFAULT_USR_CFG_MAX_DIR_COUNT;
+			ALOGW("%s free space size < 1G, only save the lastest %d log folders",
+				out_path, DEFAULT_USR_CFG_MAX_DIR_COUNT);
+		}
+		num = aplogd_util_cleardir(out_path, usr_cfg_backup);
+		Tm = localtime(&job->queued);
+		if ((num != -1) && (Tm != NULL)) {
+			num = (num + 1) % LONG_MAX;
+			snprintf(bak_dir, MAX_PATH_LEN, "%s/No.%ld_%d%02d%02d%02d%02d%02d",
+				out_path, num, Tm->tm_year+1900, Tm->tm_mon+1,
+				Tm->tm_mday, Tm->tm_hour, Tm->tm_min, Tm->tm_sec);
+		} else
+			snprintf(bak_dir, MAX_PATH_LEN, "%s/last", out_path);
+	} else {
+		snprintf(bak_dir, MAX_PATH_LEN, "%s/last", out_path);
+		/* See comments on permissions in aplogd_output_setup(). */
+		mkdir(bak_dir, 0750);
+	}
+	for (index = 0; index <= APLOGD_INPUT_LAST; index++) {
+		snprintf(file_name, MAX_PATH_LEN, "%s/%s", job->src_dir, output_filename[index]);
+		if (access(file_name, F_OK) != 0) {
+			count++;
+			continue;
+		}
+		snprintf(gzip_name, MAX_PATH_LEN, "%s/%s.gz", out_path, output_filename[index]);
+		DPRINT("gzip %s.\n", file_name);
+		aplogd_util_gzip_to(file_name, gzip_name);
+	}
+	if (STORAGE_USERDATA == job->storage) {
+		aplogd_util_cleardir(bak_dir, 1);
+	} else {
+		if (count == APLOGD_INPUT_LAST+1)
+			return;
+		/* See comments on permissions in aplogd_output_setup(). */
+		mkdir(bak_dir, 0750);
+	}
+	DPRINT("move %s to %s.\n", out_path, bak_dir);
+	aplogd_segment_save(job->storage, bak_dir);
+	aplogd_util_move(out_path, bak_dir, ".gz");
+}
+
+static void *aplogd_rotate_thread(void *arg)
+{
+	struct aplogd_rotate_job job;
+	unsigned long long start;
+	unsigned int elapsed;
+	int i;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&rotate_lock);
+		while (rotate_count == 0 || rotate_stopping)
+			pthread_cond_wait(&rotate_not_empty, &rotate_lock);
+		job = rotate_queue[rotate_head];
+		rotate_running = 1;
+		pthread_mutex_unlock(&rotate_lock);
+
+		start = aplogd_rotate_now_ms();
+		DPRINT("Rotation job %d on %s\n", job.op, job.src_dir);
+		if (APLOGD_ROTATE_SAVE == job.op) {
+			aplogd_rotate_save(&job);
+		} else {
+			aplogd_segment_add(job.storage, job.src_dir, job.since);
+		}
+		/* Anything gzip could not handle was left behind; don't leak it. */
+		for (i = 0; i <= APLOGD_INPUT_LAST; i++) {
+			char file_name[MAX_PATH_LEN];
+			snprintf(file_name, MAX_PATH_LEN, "%s/%s", job.src_dir, output_filename[i]);
+			unlink(file_name);
+		}
+		rmdir(job.src_dir);
+
+		pthread_mutex_lock(&rotate_lock);
+		rotate_head = (rotate_head + 1) % APLOGD_ROTATE_QUEUE_LEN;
+		rotate_count--;
+		rotate_stats.queue_depth = rotate_count;
+		rotate_stats.jobs_done++;
+		elapsed = aplogd_rotate_now_ms() - start;
+		rotate_stats.compress_ms += elapsed;
+		rotate_stats.last_ms = elapsed;
+		if (elapsed > rotate_stats.max_ms)
+			rotate_stats.max_ms = elapsed;
+		rotate_running = 0;
+		pthread_cond_signal(&rotate_not_full);
+		pthread_cond_signal(&rotate_idle);
+		pthread_mutex_unlock(&rotate_lock);
+	}
+	return NULL;
+}
+
+/* aplogd_rotate_init()
+ *
+ * Description: This function starts the rotation worker thread.
+ *
+ * Return: (int) 0 on success; -1 on failure
+ *
+ * Notes: None
+ */
+int aplogd_rotate_init(void)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+	sigset_t mask, old;
+	int ret;
+
+	/* SIGTERM has to interrupt poll() in the main loop, not land here. */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &mask, &old);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&thread, &attr, aplogd_rotate_thread, NULL);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0) {
+		ALOGE("Couldn't start rotation thread; errno=%d\n", ret);
+		return -1;
+	}
+	return 0;
+}
+
+/* aplogd_rotate_stage()
+ *
+ * Description: This function moves the current log files of @storage out of
+ * the way into a fresh staging directory, so new output files can be opened
+ * immediately.
+ *
+ * @storage: (STORAGE_T) storage whose output path holds the log files
+ * @staging: (char *) receives the staging directory path; MAX_PATH_LEN long
+ *
+ * Return: (int) number of files staged; -1 on failure
+ *
+ * Notes: Output fds on the staged files must be closed by the caller first,
+ *        otherwise writes keep landing in the staged copies.
+ */
+int aplogd_rotate_stage(STORAGE_T storage, char *staging)
+{
+	static unsigned int seq = 0;
+	char file_name[MAX_PATH_LEN];
+	char stage_name[MAX_PATH_LEN];
+	int count = 0;
+	int i;
+
+	if (!g_output_path[storage])
+		return -1;
+	/* A directory left over from a previous run still holds logs; skip it
+	 * rather than overwriting them. */
+	do {
+		snprintf(staging, MAX_PATH_LEN, "%s/%s.%u", g_output_path[storage],
+				APLOGD_ROTATE_DIR, seq++);
+	} while (mkdir(staging, 0750) < 0 && errno == EEXIST);
+	if (access(staging, W_OK) != 0) {
+		EPRINT("Couldn't create %s; errno=%s\n", staging, strerror(errno));
+		return -1;
+	}
+	for (i = 0; i <= APLOGD_INPUT_LAST; i++) {
+		snprintf(file_name, MAX_PATH_LEN, "%s/%s", g_output_path[storage], output_filename[i]);
+		snprintf(stage_name, MAX_PATH_LEN, "%s/%s", staging, output_filename[i]);
+		if (rename(file_name, stage_name) == 0)
+			count++;
+		else if (errno != ENOENT)
+			EPRINT("Couldn't rename %s to %s; errno=%s\n",
+					file_name, stage_name, strerror(errno));
+	}
+	return count;
+}
+
+static int aplogd_rotate_enqueue(int op, STORAGE_T storage, const char *src_dir,
+		time_t since)
+{
+	struct aplogd_rotate_job *job;
+
+	pthread_mutex_lock(&rotate_lock);
+	while (rotate_count == APLOGD_ROTATE_QUEUE_LEN && !rotate_stopping) {
+		WPRINT("Rotation queue full; waiting\n");
+		pthread_cond_wait(&rotate_not_full, &rotate_lock);
+	}
+	if (rotate_stopping) {
+		/* Left on disk; aplogd_rotate_recover() picks it up next start. */
+		pthread_mutex_unlock(&rotate_lock);
+		return -1;
+	}
+	job = &rotate_queue[(rotate_head + rotate_count) % APLOGD_ROTATE_QUEUE_LEN];
+	job->op = op;
+	job->storage = storage;
+	job->queued = time(NULL);
+	job->since = since;
+	snprintf(job->src_dir, MAX_PATH_LEN, "%s", src_dir);
+	rotate_count++;
+	rotate_stats.queue_depth = rotate_count;
+	if (rotate_count > rotate_stats.queue_peak)
+		rotate_stats.queue_peak = rotate_count;
+	pthread_cond_signal(&rotate_not_empty);
+	pthread_mutex_unlock(&rotate_lock);
+	return 0;
+}
+
+/* aplogd_rotate_queue()
+ *
+ * Description: This function hands a staging directory to the worker.
+ *
+ * @op: (int) one of enum aplogd_rotate_op
+ * @storage: (STORAGE_T) storage whose output path receives the result
+ * @src_dir: (const char *) staging directory from aplogd_rotate_stage()
+ *
+ * Return: (int) 0 on success; -1 once aplogd_rotate_stop() was called
+ *
+ * Notes: Blocks only while APLOGD_ROTATE_QUEUE_LEN jobs are outstanding.
+ */
+int aplogd_rotate_queue(int op, STORAGE_T storage, const char *src_dir)
+{
+	return aplogd_rotate_enqueue(op, storage, src_dir, aplogd_output_opened);
+}
+
+/* aplogd_rotate_queued()
+ *
+ * Description: This function tells whether @src_dir is waiting for, or
+ * being handled by, the worker.
+ *
+ * Return: (int) 1 if queued; 0 otherwise
+ *
+ * Notes: Caller holds rotate_lock.
+ */
+static int aplogd_rotate_queued(const char *src_dir)
+{
+	unsigned int i;
+
+	for (i = 0; i < rotate_count; i++)
+		if (!strcmp(rotate_queue[(rotate_head + i) % APLOGD_ROTATE_QUEUE_LEN].src_dir,
+				src_dir))
+			return 1;
+	return 0;
+}
+
+/* aplogd_rotate_recover()
+ *
+ * Description: This function queues the staging directories a previous
+ * run of aplogd left behind in the output path of @storage, because it
+ * was killed before the worker got to them. Their files become a segment
+ * of the store, which the save job queued right after files away with the
+ * rest of that session.
+ *
+ * @storage: (STORAGE_T) storage whose output path is scanned
+ *
+ * Return: (int) number of directories queued; -1 on failure
+ *
+ * Notes: Must run before aplogd_rotate_stage() creates new directories in
+ *        the same path.
+ */
+int aplogd_rotate_recover(STORAGE_T storage)
+{
+	char src_dir[MAX_PATH_LEN];
+	struct dirent *dirp;
+	struct stat buf;
+	size_t len = strlen(APLOGD_ROTATE_DIR);
+	int queued;
+	int count = 0;
+	DIR *dp;
+
+	if (!g_output_path[storage])
+		return -1;
+	if ((dp = opendir(g_output_path[storage])) == NULL)
+		return -1;
+	while ((dirp = readdir(dp)) != NULL) {
+		if (strncmp(dirp->d_name, APLOGD_ROTATE_DIR, len) != 0 ||
+				dirp->d_name[len] != '.')
+			continue;
+		snprintf(src_dir, MAX_PATH_LEN, "%s/%s", g_output_path[storage], dirp->d_name);
+		if (lstat(src_dir, &buf) == -1 || !S_ISDIR(buf.st_mode))
+			continue;
+		pthread_mutex_lock(&rotate_lock);
+		queued = aplogd_rotate_queued(src_dir);
+		pthread_mutex_unlock(&rotate_lock);
+		if (queued)
+			continue;
+		DPRINT("Recovering %s\n", src_dir);
+		/* When the files were opened is lost; the segment falls back to
+		 * their mtime. */
+		if (aplogd_rotate_enqueue(APLOGD_ROTATE_BACKUP, storage, src_dir, 0) < 0)
+			break;
+		count++;
+	}
+	closedir(dp);
+	return count;
+}
+
+/* aplogd_rotate_stop()
+ *
+ * Description: This function stops the worker from taking new jobs and
+ * waits for the one it is running, so no half written .gz is left behind
+ * on exit. Queued jobs stay on disk as staging directories for
+ * aplogd_rotate_recover().
+ *
+ * Return: None
+ *
+ * Notes: Not async-signal-safe; call it from the main loop, not a handler.
+ */
+void aplogd_rotate_stop(void)
+{
+	pthread_mutex_lock(&rotate_lock);
+	rotate_stopping = 1;
+	pthread_cond_broadcast(&rotate_not_full);
+	while (rotate_running)
+		pthread_cond_wait(&rotate_idle, &rotate_lock);
+	pthread_mutex_unlock(&rotate_lock);
+}
+
+/* aplogd_rotate_get_stats()
+ *
+ * Description: This function returns a consistent snapshot of the worker
+ * counters.
+ *
+ * Return: None
+ *
+ * Notes: None
+ */
+void aplogd_rotate_get_stats(struct aplogd_rotate_stats *stats)
+{
+	pthread_mutex_lock(&rotate_lock);
+	*stats = rotate_stats;
+	pthread_mutex_unlock(&rotate_lock);
+}
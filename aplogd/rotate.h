@@ -0,0 +1,47 @@
+/********************************************************************
+ * File Name: rotate.h
+ *
+ * General Description: Header file for the aplogd rotation worker, which
+ * compresses and files away closed log files off the poll loop.
+ *
+ *********************************************************************/
+
+#ifndef _APLOGD_ROTATE_H_
+#define _APLOGD_ROTATE_H_
+
+#include <time.h>
+#include "aplogd.h"
+
+#define APLOGD_ROTATE_DIR	"rotating"	/* staging dir prefix */
+#define APLOGD_ROTATE_QUEUE_LEN	16
+
+enum aplogd_rotate_op {
+	APLOGD_ROTATE_BACKUP = 0,	/* gzip staged files into a new segment */
+	APLOGD_ROTATE_SAVE,		/* gzip staged files into a No.N or last dir */
+};
+
+struct aplogd_rotate_job {
+	int op;
+	STORAGE_T storage;		/* storage whose output path gets the result */
+	time_t queued;
+	time_t since;			/* when the staged files were opened */
+	char src_dir[MAX_PATH_LEN];	/* staging dir holding the closed files */
+};
+
+struct aplogd_rotate_stats {
+	unsigned int queue_depth;	/* jobs queued or running */
+	unsigned int queue_peak;
+	unsigned int jobs_done;
+	unsigned long long compress_ms;	/* wall time spent running jobs */
+	unsigned int last_ms;		/* duration of the last job */
+	unsigned int max_ms;
+};
+
+int aplogd_rotate_init(void);
+int aplogd_rotate_stage(STORAGE_T, char *);
+int aplogd_rotate_queue(int, STORAGE_T, const char *);
+int aplogd_rotate_recover(STORAGE_T);
+void aplogd_rotate_stop(void);
+void aplogd_rotate_get_stats(struct aplogd_rotate_stats *);
+
+#endif /* Not defined _APLOGD_ROTATE_H_ */
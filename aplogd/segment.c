@@ -0,0 +1,362 @@
+/********************************************************************
+ * File Name: segment.c
+ *
+ * General Description: This file provides the aplogd segment store. A
+ * rotation compresses each closed log file into a new numbered segment and
+ * appends it to the index, so nothing already stored is renamed. Only the
+ * last usr_cfg_segments segments of a stream are kept; the index
+ * tells which file is the oldest, so it is deleted without a directory
+ * scan.
+ *
+ * The store belongs to the rotation worker; no locking is needed.
+ *
+ *********************************************************************/
+
+/* Includes */
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Aplogd includes */
+#include "aplogd.h"
+#include "log_io.h"
+#include "aplogd_util.h"
+#include "segment.h"
+
+/* Macros */
+#define SEGMENT_INDEX_HEADER \
+	"# seq file first last raw_bytes stored_bytes segment\n"
+
+struct seg_entry {
+	unsigned int seq;
+	time_t first;
+	time_t last;
+	unsigned long long raw;
+	unsigned long long stored;
+};
+
+/* Segments of one stream, oldest at head; at most usr_cfg_segments */
+struct seg_ring {
+	unsigned int head;
+	unsigned int count;
+	struct seg_entry entry[MAX_USR_CFG_SEGMENTS];
+};
+
+struct seg_store {
+	int loaded;
+	int pruned;		/* the index on disk lists pruned segments */
+	unsigned int next_seq;
+	char dir[MAX_PATH_LEN];
+	struct seg_ring ring[APLOGD_INPUT_LAST+1];
+};
+
+/* Locals */
+static struct seg_store seg_stores[STORAGE_MAX];
+
+/* Functions */
+
+static void segment_base(char *buf, unsigned int seq, int index)
+{
+	snprintf(buf, MAX_PATH_LEN, "%s.%06u.%s.gz", APLOGD_SEGMENT_PREFIX,
+			seq, output_filename[index]);
+}
+
+static void segment_name(char *buf, const char *dir, unsigned int seq, int index)
+{
+	char base[MAX_PATH_LEN];
+
+	segment_base(base, seq, index);
+	snprintf(buf, MAX_PATH_LEN, "%s/%s", dir, base);
+}
+
+static int segment_stream(const char *file)
+{
+	int i;
+
+	for (i = 0; i <= APLOGD_INPUT_LAST; i++) {
+		if (!strcmp(file, output_filename[i]))
+			return i;
+	}
+	return -1;
+}
+
+/* segment_push()
+ *
+ * Description: This function adds an entry to a stream's ring, deleting
+ * the oldest segment if the ring is full.
+ *
+ * Return: (int) 1 if a segment was pruned; 0 otherwise
+ */
+static int segment_push(struct seg_store *store, int index, const struct seg_entry *e)
+{
+	struct seg_ring *ring = &store->ring[index];
+	char file_name[MAX_PATH_LEN];
+	int pruned = 0;
+
+	/* more than one if the limit went down since the index was written */
+	while (ring->count >= usr_cfg_segments) {
+		segment_name(file_name, store->dir, ring->entry[ring->head].seq, index);
+		DPRINT("Pruning %s\n", file_name);
+		if (unlink(file_name) < 0 && errno != ENOENT)
+			EPRINT("Couldn't delete %s; errno=%s\n", file_name, strerror(errno));
+		ring->head = (ring->head + 1) % MAX_USR_CFG_SEGMENTS;
+		ring->count--;
+		pruned = 1;
+	}
+	ring->entry[(ring->head + ring->count) % MAX_USR_CFG_SEGMENTS] = *e;
+	ring->count++;
+	return pruned;
+}
+
+static void segment_print(FILE *fp, int index, const struct seg_entry *e)
+{
+	char base[MAX_PATH_LEN];
+
+	segment_base(base, e->seq, index);
+	fprintf(fp, "%u %s %ld %ld %llu %llu %s\n", e->seq, output_filename[index],
+			(long)e->first, (long)e->last, e->raw, e->stored, base);
+}
+
+/* segment_write_index()
+ *
+ * Description: This function rewrites the index from memory, replacing
+ * the old one atomically.
+ *
+ * Return: None
+ *
+ * Notes: Only needed after pruning; the index holds at most
+ *        usr_cfg_segments lines per stream.
+ */
+static void segment_write_index(const struct seg_store *store)
+{
+	char index_name[MAX_PATH_LEN];
+	char tmp_name[MAX_PATH_LEN];
+	const struct seg_ring *ring;
+	FILE *fp;
+	unsigned int n;
+	int i;
+
+	snprintf(index_name, MAX_PATH_LEN, "%s/%s", store->dir, APLOGD_SEGMENT_INDEX);
+	snprintf(tmp_name, MAX_PATH_LEN, "%s.tmp", index_name);
+	if ((fp = fopen(tmp_name, "w")) == NULL) {
+		EPRINT("Couldn't create %s; errno=%s\n", tmp_name, strerror(errno));
+		return;
+	}
+	fputs(SEGMENT_INDEX_HEADER, fp);
+	for (i = 0; i <= APLOGD_INPUT_LAST; i++) {
+		ring = &store->ring[i];
+		for (n = 0; n < ring->count; n++)
+			segment_print(fp, i,
+				&ring->entry[(ring->head + n) % MAX_USR_CFG_SEGMENTS]);
+	}
+	if (fclose(fp) != 0 || rename(tmp_name, index_name) < 0) {
+		EPRINT("Couldn't write %s; errno=%s\n", index_name, strerror(errno));
+		unlink(tmp_name);
+	}
+}
+
+/* segment_append_index()
+ *
+ * Description: This function appends one segment to the index.
+ *
+ * Return: None
+ */
+static void segment_append_index(const struct seg_store *store, int index,
+		const struct seg_entry *e)
+{
+	char index_name[MAX_PATH_LEN];
+	FILE *fp;
+
+	snprintf(index_name, MAX_PATH_LEN, "%s/%s", store->dir, APLOGD_SEGMENT_INDEX);
+	if ((fp = fopen(index_name, "a")) == NULL) {
+		EPRINT("Couldn't open %s; errno=%s\n", index_name, strerror(errno));
+		return;
+	}
+	if (ftell(fp) == 0)
+		fputs(SEGMENT_INDEX_HEADER, fp);
+	segment_print(fp, index, e);
+	fclose(fp);
+}
+
+/* segment_read_index()
+ *
+ * Description: This function calls @fn for every valid line of the index
+ * in @dir.
+ *
+ * Return: (int) 0 on success; -1 if there is no index
+ */
+static int segment_read_index(const char *dir,
+		void (*fn)(void *, int, const struct seg_entry *, const char *),
+		void *cookie)
+{
+	char index_name[MAX_PATH_LEN];
+	char line[2 * MAX_PATH_LEN];
+	char file[64];
+	char segment[MAX_PATH_LEN];
+	struct seg_entry e;
+	long first, last;
+	FILE *fp;
+	int index;
+
+	snprintf(index_name, MAX_PATH_LEN, "%s/%s", dir, APLOGD_SEGMENT_INDEX);
+	if ((fp = fopen(index_name, "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		if ('#' == line[0])
+			continue;
+		if (sscanf(line, "%u %63s %ld %ld %llu %llu %254s", &e.seq, file,
+				&first, &last, &e.raw, &e.stored, segment) != 7 ||
+				(index = segment_stream(file)) < 0) {
+			WPRINT("Bad line in %s: %s", index_name, line);
+			continue;
+		}
+		e.first = first;
+		e.last = last;
+		fn(cookie, index, &e, segment);
+	}
+	fclose(fp);
+	return 0;
+}
+
+static void segment_load_one(void *cookie, int index, const struct seg_entry *e,
+		const char *segment)
+{
+	struct seg_store *store = cookie;
+
+	(void)segment;
+	if (segment_push(store, index, e))
+		store->pruned = 1;
+	if (e->seq >= store->next_seq)
+		store->next_seq = e->seq + 1;
+}
+
+static void segment_load(struct seg_store *store, const char *dir)
+{
+	memset(store, 0, sizeof(*store));
+	snprintf(store->dir, MAX_PATH_LEN, "%s", dir);
+	store->next_seq = 1;
+	segment_read_index(dir, segment_load_one, store);
+	/* Don't leave deleted segments listed, e.g. after -g went down */
+	if (store->pruned)
+		segment_write_index(store);
+	store->pruned = 0;
+	store->loaded = 1;
+	DPRINT("Segment store %s, next seq %u\n", dir, store->next_seq);
+}
+
+/* Never reuse the number of a file the index doesn't know about */
+static int segment_seq_taken(const struct seg_store *store, unsigned int seq)
+{
+	char file_name[MAX_PATH_LEN];
+	int i;
+
+	for (i = 0; i <= APLOGD_INPUT_LAST; i++) {
+		segment_name(file_name, store->dir, seq, i);
+		if (access(file_name, F_OK) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* aplogd_segment_add()
+ *
+ * Description: This function stores the staged log files of @src_dir as
+ * the next segment of @storage's output path, then prunes what falls out
+ * of the per-stream limit.
+ *
+ * @storage: (STORAGE_T) storage whose output path holds the store
+ * @src_dir: (const char *) staging directory from aplogd_rotate_stage()
+ * @since: (time_t) when the staged files were opened; 0 if unknown
+ *
+ * Return: (int) 0 on success; -1 if any file could not be stored
+ *
+ * Notes: Worker thread only. Staged files are consumed.
+ */
+int aplogd_segment_add(STORAGE_T storage, const char *src_dir, time_t since)
+{
+	struct seg_store *store = &seg_stores[storage];
+	char file_name[MAX_PATH_LEN];
+	char seg_name[MAX_PATH_LEN];
+	struct seg_entry e;
+	struct stat st;
+	int pruned = 0;
+	int ret_val = 0;
+	int i;
+
+	if (!g_output_path[storage])
+		return -1;
+	if (!store->loaded || strcmp(store->dir, g_output_path[storage]))
+		segment_load(store, g_output_path[storage]);
+	while (segment_seq_taken(store, store->next_seq))
+		store->next_seq++;
+	e.seq = store->next_seq++;
+
+	for (i = 0; i <= APLOGD_INPUT_LAST; i++) {
+		snprintf(file_name, MAX_PATH_LEN, "%s/%s", src_dir, output_filename[i]);
+		if (stat(file_name, &st) < 0)
+			continue;
+		segment_name(seg_name, store->dir, e.seq, i);
+		if (aplogd_util_gzip_to(file_name, seg_name) < 0) {
+			EPRINT("Couldn't compress %s; We'll delete it\n", file_name);
+			unlink(file_name);
+			ret_val = -1;
+			continue;
+		}
+		e.first = since ? since : st.st_mtime;
+		e.last = st.st_mtime;
+		e.raw = st.st_size;
+		e.stored = stat(seg_name, &st) == 0 ? (unsigned long long)st.st_size : 0;
+		if (segment_push(store, i, &e))
+			pruned = 1;
+		else if (!pruned)
+			segment_append_index(store, i, &e);
+	}
+	if (pruned)
+		segment_write_index(store);
+	return ret_val;
+}
+
+static void segment_drop_one(void *cookie, int index, const struct seg_entry *e,
+		const char *segment)
+{
+	char file_name[MAX_PATH_LEN];
+
+	(void)index;
+	(void)e;
+	snprintf(file_name, MAX_PATH_LEN, "%s/%s", (const char *)cookie, segment);
+	unlink(file_name);
+}
+
+/* aplogd_segment_save()
+ *
+ * Description: This function hands the index of @storage's store over to
+ * @dst_dir, where the caller files the segments of the ending session.
+ * Segments of an older session already indexed in @dst_dir are deleted
+ * first, so a reused folder (last/) doesn't collect stale ones.
+ *
+ * @storage: (STORAGE_T) storage whose output path holds the store
+ * @dst_dir: (const char *) folder receiving the session's logs
+ *
+ * Return: None
+ *
+ * Notes: Worker thread only. The store starts over at sequence 1.
+ */
+void aplogd_segment_save(STORAGE_T storage, const char *dst_dir)
+{
+	char index_name[MAX_PATH_LEN];
+	char dst_name[MAX_PATH_LEN];
+
+	if (!g_output_path[storage])
+		return;
+	snprintf(index_name, MAX_PATH_LEN, "%s/%s", g_output_path[storage], APLOGD_SEGMENT_INDEX);
+	snprintf(dst_name, MAX_PATH_LEN, "%s/%s", dst_dir, APLOGD_SEGMENT_INDEX);
+	if (segment_read_index(dst_dir, segment_drop_one, (void *)dst_dir) == 0)
+		unlink(dst_name);
+	if (rename(index_name, dst_name) < 0 && errno != ENOENT)
+		EPRINT("Couldn't move %s; errno=%s\n", index_name, strerror(errno));
+	seg_stores[storage].loaded = 0;
+}
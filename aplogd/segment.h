@@ -0,0 +1,31 @@
+/********************************************************************
+ * File Name: segment.h
+ *
+ * General Description: Header file for the aplogd segment store, which
+ * keeps rotated log files of the current session as numbered segments.
+ *
+ * Each rotation adds one segment per stream, seg.<seq>.<log file>.gz,
+ * and appends a line per file to APLOGD_SEGMENT_INDEX in the same dir
+ * (only the last usr_cfg_segments of a stream are kept, see -g):
+ *
+ *   <seq> <log file> <first> <last> <raw bytes> <stored bytes> <segment>
+ *
+ * <first> and <last> are the UTC seconds the file was opened and last
+ * written, so logs can be located by time from the index alone. Lines
+ * starting with '#' are comments.
+ *
+ *********************************************************************/
+
+#ifndef _APLOGD_SEGMENT_H_
+#define _APLOGD_SEGMENT_H_
+
+#include <time.h>
+#include "aplogd.h"
+
+#define APLOGD_SEGMENT_INDEX		"segments.idx"
+#define APLOGD_SEGMENT_PREFIX		"seg"
+
+int aplogd_segment_add(STORAGE_T, const char *, time_t);
+void aplogd_segment_save(STORAGE_T, const char *);
+
+#endif /* Not defined _APLOGD_SEGMENT_H_ */
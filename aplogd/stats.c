@@ -0,0 +1,202 @@
+/********************************************************************
+ * File Name: stats.c
+ *
+ * General Description: This file keeps the aplogd runtime counters and
+ * serves them on the aplogd_stats socket. The listening socket sits in the
+ * main poll set; each connection gets one plain text snapshot and is
+ * closed, so "aplogd_stats" (or any local socket client) can dump it.
+ *
+ *********************************************************************/
+
+/* Includes */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <cutils/sockets.h>
+#include <log/logger.h>
+#include <log/logd.h>
+
+/* Aplogd includes */
+#include "aplogd.h"
+#include "log_io.h"
+#include "rotate.h"
+#include "filter.h"
+#include "stats.h"
+
+/* Macros */
+#define STATS_REPLY_MAX		4096
+
+/* Globals */
+struct aplogd_stream_stats aplogd_stream_stats[APLOGD_INPUT_LAST+1];
+unsigned int aplogd_poll_wakeups = 0;
+unsigned int aplogd_poll_timeouts = 0;
+
+/* Locals */
+static unsigned int flush_hist[APLOGD_FLUSH_HIST_BUCKETS];
+static unsigned int flush_count = 0;
+static unsigned long long flush_total_us = 0;
+static unsigned int flush_max_us = 0;
+static unsigned long long stats_start_us = 0;
+static const char *stream_names[APLOGD_INPUT_LAST+1] = {
+	"main", "radio", "events", "system", "kernel"
+};
+
+/* Functions */
+
+/* aplogd_stats_now_us()
+ *
+ * Return: (unsigned long long) CLOCK_MONOTONIC time in us
+ */
+unsigned long long aplogd_stats_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* aplogd_stats_flush_done()
+ *
+ * Description: This function accounts one aplogd_rambuf_outputall() run.
+ *
+ * @start_us: (unsigned long long) aplogd_stats_now_us() when it started
+ *
+ * Return: None
+ *
+ * Notes: None
+ */
+void aplogd_stats_flush_done(unsigned long long start_us)
+{
+	unsigned int us = aplogd_stats_now_us() - start_us;
+	unsigned int scaled = us >> 6;
+	int bucket = 0;
+
+	while (scaled && bucket < APLOGD_FLUSH_HIST_BUCKETS - 1) {
+		scaled >>= 1;
+		bucket++;
+	}
+	flush_hist[bucket]++;
+	flush_count++;
+	flush_total_us += us;
+	if (us > flush_max_us)
+		flush_max_us = us;
+}
+
+/* aplogd_stats_setup()
+ *
+ * Description: This function opens the listening stats socket.
+ *
+ * Return: (int) socket fd; -1 on failure
+ *
+ * Notes: None
+ */
+int aplogd_stats_setup(void)
+{
+	int fd;
+
+	if (!stats_start_us)
+		stats_start_us = aplogd_stats_now_us();
+	fd = socket_local_server(APLOGD_STATS_SOCKET,
+			ANDROID_SOCKET_NAMESPACE_ABSTRACT, SOCK_STREAM);
+	if (fd < 0) {
+		EPRINT("Couldn't open stats socket; errno=%d\n", errno);
+		return -1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+}
+
+/* aplogd_stats_format()
+ *
+ * Description: This function prints every counter into @buf, as sent on
+ * the stats socket.
+ *
+ * Return: (int) number of bytes used
+ */
+int aplogd_stats_format(char *buf, int size)
+{
+	struct aplogd_rotate_stats rotate;
+	struct aplogd_stream_stats *st;
+	struct aplogd_read_stats *rd;
+	int len = 0;
+	int i, j;
+
+#define STATS_PRINT(format, args...) do {					\
+		if (len < size)							\
+			len += snprintf(buf + len, size - len, format, ##args);	\
+	} while (0)
+
+	aplogd_rotate_get_stats(&rotate);
+	if (stats_start_us)
+		STATS_PRINT("uptime_s %llu\n", (aplogd_stats_now_us() - stats_start_us) / 1000000);
+	STATS_PRINT("poll wakeups %u timeouts %u\n", aplogd_poll_wakeups, aplogd_poll_timeouts);
+	STATS_PRINT("%-7s %10s %12s %12s %10s %10s %8s %8s %6s\n", "stream",
+			"entries", "bytes_in", "written", "dropped", "discarded",
+			"wakeups", "batches", "maxbat");
+	for (i = 0; i <= APLOGD_INPUT_LAST; i++) {
+		st = &aplogd_stream_stats[i];
+		rd = &aplogd_read_stats[i];
+		STATS_PRINT("%-7s %10llu %12llu %12llu %10llu %10llu %8u %8u %6u\n",
+				stream_names[i], st->entries_in, st->bytes_in,
+				st->bytes_written, st->bytes_dropped,
+				st->bytes_discarded, rd->wakeups, rd->batches,
+				rd->max_batch);
+	}
+	for (i = 0; i < APLOGD_INPUT_KERNEL_POLL_INDEX; i++) {
+		STATS_PRINT("batch_hist %-7s", stream_names[i]);
+		for (j = 0; j < APLOGD_READ_HIST_BUCKETS; j++)
+			STATS_PRINT(" %u", aplogd_read_stats[i].batch_hist[j]);
+		STATS_PRINT("\n");
+	}
+	STATS_PRINT("lost_bytes %u\n", aplogd_bytes_lost);
+	STATS_PRINT("filter filtered %u suppressed %u\n",
+			aplogd_entries_filtered, aplogd_entries_suppressed);
+	STATS_PRINT("flush count %u avg_us %llu max_us %u\n", flush_count,
+			flush_count ? flush_total_us / flush_count : 0, flush_max_us);
+	STATS_PRINT("flush_hist_us <64");
+	for (j = 1; j < APLOGD_FLUSH_HIST_BUCKETS; j++) {
+		if (j == APLOGD_FLUSH_HIST_BUCKETS - 1)
+			STATS_PRINT(" >=%u", 32u << j);
+		else
+			STATS_PRINT(" <%u", 64u << j);
+	}
+	STATS_PRINT("\nflush_hist");
+	for (j = 0; j < APLOGD_FLUSH_HIST_BUCKETS; j++)
+		STATS_PRINT(" %u", flush_hist[j]);
+	STATS_PRINT("\nrotate jobs %u queued %u peak %u total_ms %llu last_ms %u max_ms %u\n",
+			rotate.jobs_done, rotate.queue_depth, rotate.queue_peak,
+			rotate.compress_ms, rotate.last_ms, rotate.max_ms);
+#undef STATS_PRINT
+	return len < size ? len : size - 1;
+}
+
+/* aplogd_stats_serve()
+ *
+ * Description: This function accepts the pending connections on the stats
+ * socket and sends each one a snapshot of the counters.
+ *
+ * @listen_fd: (int) socket from aplogd_stats_setup()
+ *
+ * Return: None
+ *
+ * Notes: The reply fits in the socket buffer, so the poll loop never
+ *        waits on a slow reader.
+ */
+void aplogd_stats_serve(int listen_fd)
+{
+	char reply[STATS_REPLY_MAX];
+	int len;
+	int fd;
+
+	while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+		len = aplogd_stats_format(reply, sizeof(reply));
+		if (send(fd, reply, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len)
+			WPRINT("Short stats reply; errno=%d\n", errno);
+		close(fd);
+	}
+}
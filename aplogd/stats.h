@@ -0,0 +1,41 @@
+/********************************************************************
+ * File Name: stats.h
+ *
+ * General Description: Header file for the aplogd runtime counters and
+ * the stats socket that reports them.
+ *
+ *********************************************************************/
+
+#ifndef _APLOGD_STATS_H_
+#define _APLOGD_STATS_H_
+
+#include "aplogd.h"
+#include "log_io.h"
+
+/* Abstract namespace, so no init.rc socket entry is needed */
+#define APLOGD_STATS_SOCKET	"aplogd_stats"
+
+/* Flush latency histogram: bucket n > 0 counts flushes of 32*2^n up to
+ * 64*2^n us, bucket 0 everything faster and the last bucket everything
+ * slower (about 1s and up). */
+#define APLOGD_FLUSH_HIST_BUCKETS	16
+
+struct aplogd_stream_stats {
+	unsigned long long entries_in;		/* entries read from the device */
+	unsigned long long bytes_in;		/* raw bytes read from the device */
+	unsigned long long bytes_written;	/* bytes written to the log file */
+	unsigned long long bytes_dropped;	/* ring full; never buffered */
+	unsigned long long bytes_discarded;	/* buffered but no output file */
+};
+
+extern struct aplogd_stream_stats aplogd_stream_stats[APLOGD_INPUT_LAST+1];
+extern unsigned int aplogd_poll_wakeups;
+extern unsigned int aplogd_poll_timeouts;
+
+unsigned long long aplogd_stats_now_us(void);
+void aplogd_stats_flush_done(unsigned long long);
+int aplogd_stats_setup(void);
+int aplogd_stats_format(char *, int);
+void aplogd_stats_serve(int);
+
+#endif /* Not defined _APLOGD_STATS_H_ */
@@ -27,7 +27,8 @@ LOCAL_MODULE := audio.hdmi.$(TARGET_BOARD_PLATFORM)
 
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_SRC_FILES := hdmi_audio_hw.c \
-	hdmi_audio_utils.c
+	hdmi_audio_utils.c \
+	hdmi_audio_remap.c
 
 LOCAL_C_INCLUDES += \
 	external/tinyalsa/include \
@@ -48,6 +49,11 @@ ifeq ($(BOARD_USES_ICS_VOICE_BLOB), true)
 LOCAL_CFLAGS += -DICS_VOICE_BLOB
 endif
 
+# The legacy HAL has to take a second output stream next to the primary one
+ifeq ($(BOARD_USES_WRAPPER_DEEP_BUFFER), true)
+LOCAL_CFLAGS += -DWRAPPER_DEEP_BUFFER
+endif
+
 LOCAL_MODULE := audio.primary.$(TARGET_DEVICE)
 
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
@@ -61,3 +67,22 @@ LOCAL_SHARED_LIBRARIES := liblog libcutils libaudioutils libdl libtinyalsa
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+###
+### Audio policy configuration
+###
+
+# Only advertise the deep_buffer output when the wrapper opens it
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio_policy.conf
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_CLASS := ETC
+LOCAL_MODULE_PATH := $(TARGET_OUT_ETC)
+ifeq ($(BOARD_USES_WRAPPER_DEEP_BUFFER), true)
+LOCAL_SRC_FILES := ../prebuilt/etc/audio_policy_deep_buffer.conf
+else
+LOCAL_SRC_FILES := ../prebuilt/etc/audio_policy.conf
+endif
+
+include $(BUILD_PREBUILT)
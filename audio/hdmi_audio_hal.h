@@ -17,11 +17,47 @@
 #ifndef TI_HDMI_AUDIO_HAL
 #define TI_HDMI_AUDIO_HAL
 
+#include <stddef.h>
+#include <stdint.h>
+
+/* CEA-861-D Short Audio Descriptor */
+typedef struct _hdmi_audio_sad {
+    int format;         /* CEA_FORMAT_* */
+    int max_channels;
+    int rates;          /* CEA_RATE_* bits */
+    int extra;          /* LPCM: CEA_SIZE_* bits, else max bit rate in kHz */
+} hdmi_audio_sad_t;
+
+#define HDMI_MAX_SADS 16
+
 typedef struct _hdmi_audio_caps {
     int has_audio;
     int speaker_alloc;
+    int n_sads;
+    hdmi_audio_sad_t sads[HDMI_MAX_SADS];
+    /* Union of the LPCM descriptors, basic audio if there is none */
+    int lpcm_max_channels;
+    int lpcm_rates;
+    int lpcm_sizes;
 } hdmi_audio_caps_t;
 
+/* Audio format codes */
+#define CEA_FORMAT_LPCM 1
+
+/* Sample rate bits */
+#define CEA_RATE_32000  (1 << 0)
+#define CEA_RATE_44100  (1 << 1)
+#define CEA_RATE_48000  (1 << 2)
+#define CEA_RATE_88200  (1 << 3)
+#define CEA_RATE_96000  (1 << 4)
+#define CEA_RATE_176400 (1 << 5)
+#define CEA_RATE_192000 (1 << 6)
+
+/* LPCM sample size bits */
+#define CEA_SIZE_16     (1 << 0)
+#define CEA_SIZE_20     (1 << 1)
+#define CEA_SIZE_24     (1 << 2)
+
 /* Speaker allocation bits */
 #define CEA_SPKR_FLFR   (1 << 0)
 #define CEA_SPKR_LFE    (1 << 1)
@@ -31,7 +67,39 @@ typedef struct _hdmi_audio_caps {
 #define CEA_SPKR_FLCFRC (1 << 5)
 #define CEA_SPKR_RLCRRC (1 << 6)
 
+#define HDMI_MAX_CHANNELS 8
+
+/* Converts Android PCM to what goes on the wire: any sample format we
+ * take in to S16_LE or S24_LE, and any channel layout to the one the
+ * sink has speakers for.  Each input channel is mixed into the output
+ * through its column of the matrix.
+ */
+typedef struct _hdmi_remap {
+    int in_format;          /* HDMI_REMAP_IN_* */
+    int in_channels;
+    int out_bits;           /* 16 or 24 (in 32 bit containers) */
+    int out_channels;
+    float matrix[HDMI_MAX_CHANNELS][HDMI_MAX_CHANNELS]; /* [in][out] */
+} hdmi_remap_t;
+
+#define HDMI_REMAP_IN_S16       0
+#define HDMI_REMAP_IN_Q8_23     1
+#define HDMI_REMAP_IN_S24_3     2
+#define HDMI_REMAP_IN_S32       3
+#define HDMI_REMAP_IN_FLOAT     4
+
 /* Defined in file hdmi_audio_utils.c */
+int hdmi_parse_audio_caps(const unsigned char *edid, int size, hdmi_audio_caps_t *caps);
 int hdmi_query_audio_caps(const char* edid_path, hdmi_audio_caps_t *caps);
+unsigned int hdmi_caps_rate(int rate_bit);
+int hdmi_find_card(const char *name);
+
+/* Defined in file hdmi_audio_remap.c */
+int hdmi_remap_init(hdmi_remap_t *remap, uint32_t in_format, uint32_t in_mask,
+                    int out_bits, uint32_t out_mask);
+size_t hdmi_remap_in_frame_size(const hdmi_remap_t *remap);
+size_t hdmi_remap_out_frame_size(const hdmi_remap_t *remap);
+void hdmi_remap_process(const hdmi_remap_t *remap, const void *in, void *out,
+                        size_t frames);
 
 #endif /* TI_HDMI_AUDIO_HAL */
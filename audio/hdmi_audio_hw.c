@@ -32,11 +32,15 @@
 #include <pthread.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <cutils/log.h>
 #include <cutils/str_parms.h>
 #include <cutils/properties.h>
+#include <cutils/uevent.h>
 
 #include <hardware/hardware.h>
 #include <system/audio.h>
@@ -53,17 +57,20 @@
 
 #define UNUSED(x) (void)(x)
 
-/* XXX TODO: Dynamically detect the HDMI card
- * E.g. if a USB device is plugged in at boot time,
- * it sometimes takes the card #1 slot and puts us
- * on card #2.
+/* The HDMI card is looked up by name, since e.g. a USB device plugged
+ * in at boot time sometimes takes the card #1 slot and puts us on
+ * card #2.
  */
+#define HDMI_CARD_NAME "HDMI"
+#define HDMI_DEFAULT_CARD 1
 #define HDMI_PCM_DEV 0
 #define HDMI_SAMPLING_RATE 44100
 #define HDMI_PERIOD_SIZE 1920
 #define HDMI_PERIOD_COUNT 4
 
 #define HDMI_EDID_PATH "/sys/devices/omapdss/display1/edid"
+#define HDMI_UEVENT_SWITCH "SWITCH_NAME=hdmi"
+#define HDMI_UEVENT_MSG_LEN 1024
 
 typedef audio_hw_device_t hdmi_device_t;
 
@@ -74,6 +81,14 @@ typedef struct _hdmi_out {
     struct pcm *pcm;
     audio_config_t android_config;
     int up;
+    pthread_mutex_t lock;       /* pcm, up and the frame counts */
+    uint64_t written;           /* frames, since the stream was opened */
+    uint64_t standby_written;   /* written when leaving standby */
+    int realtime_tstamp;        /* no monotonic PCM timestamps */
+    unsigned int xruns;
+    int remapping;              /* android_config isn't what goes out */
+    hdmi_remap_t remap;
+    void *remap_buf;            /* one period, in the PCM format */
 } hdmi_out_t;
 
 #define S16_SIZE sizeof(int16_t)
@@ -83,6 +98,117 @@ typedef struct _hdmi_out {
  *****************************************************************
  */
 
+/* The sink's capabilities and our card, until the next hotplug */
+static pthread_mutex_t hdmi_caps_lock = PTHREAD_MUTEX_INITIALIZER;
+static hdmi_audio_caps_t hdmi_caps;
+static int hdmi_caps_valid = 0;
+static int hdmi_card = -1;
+static int hdmi_uevents = 0;
+static pthread_once_t hdmi_uevent_once = PTHREAD_ONCE_INIT;
+
+static int hdmi_get_audio_caps(hdmi_audio_caps_t *caps)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&hdmi_caps_lock);
+    if (!hdmi_caps_valid) {
+        ret = hdmi_query_audio_caps(HDMI_EDID_PATH, &hdmi_caps);
+        /* without hotplug events, there's no telling when it goes stale */
+        hdmi_caps_valid = !ret && hdmi_uevents;
+    }
+    if (!ret) {
+        *caps = hdmi_caps;
+    }
+    pthread_mutex_unlock(&hdmi_caps_lock);
+
+    return ret;
+}
+
+static void hdmi_invalidate_audio_caps(void)
+{
+    pthread_mutex_lock(&hdmi_caps_lock);
+    hdmi_caps_valid = 0;
+    pthread_mutex_unlock(&hdmi_caps_lock);
+}
+
+static void *hdmi_uevent_thread(void *arg)
+{
+    char msg[HDMI_UEVENT_MSG_LEN + 2];
+    int fd = (int)(intptr_t)arg;
+    char *s;
+    int n;
+
+    for (;;) {
+        n = uevent_kernel_multicast_recv(fd, msg, HDMI_UEVENT_MSG_LEN);
+        if (n < 0) {
+            if (errno == ENOBUFS) {
+                /* the socket overran, may have missed one */
+                hdmi_invalidate_audio_caps();
+                continue;
+            }
+            if (errno == EIO || errno == EINTR) {
+                /* EIO: not a kernel broadcast, e.g. any process unicasting
+                   to this port; dropped by uevent_kernel_multicast_recv() */
+                continue;
+            }
+            /* the socket itself is gone (EBADF, ENOTSOCK...) */
+            ALOGE("uevent socket failed (%s), the EDID will be read on every query",
+                  strerror(errno));
+            break;
+        }
+        if (n == 0) {
+            /* an empty datagram */
+            continue;
+        }
+        msg[n] = msg[n + 1] = '\0';
+        for (s = msg ; s < msg + n ; s += strlen(s) + 1) {
+            if (!strncmp(s, HDMI_UEVENT_SWITCH, strlen(HDMI_UEVENT_SWITCH))) {
+                ALOGV("HDMI hotplug, dropping the cached EDID");
+                hdmi_invalidate_audio_caps();
+                break;
+            }
+        }
+    }
+
+    /* Nothing tells when the caps go stale any more */
+    pthread_mutex_lock(&hdmi_caps_lock);
+    hdmi_uevents = 0;
+    hdmi_caps_valid = 0;
+    pthread_mutex_unlock(&hdmi_caps_lock);
+    close(fd);
+
+    return NULL;
+}
+
+static void hdmi_start_uevent_thread(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int fd;
+
+    fd = uevent_open_socket(64 * 1024, true);
+    if (fd < 0) {
+        ALOGE("Can't open the uevent socket, the EDID will be read on every query");
+        return;
+    }
+
+    /* Set before the thread runs, which clears it again if it gives up */
+    pthread_mutex_lock(&hdmi_caps_lock);
+    hdmi_uevents = 1;
+    pthread_mutex_unlock(&hdmi_caps_lock);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, hdmi_uevent_thread, (void *)(intptr_t)fd)) {
+        ALOGE("Can't start the uevent thread, the EDID will be read on every query");
+        pthread_mutex_lock(&hdmi_caps_lock);
+        hdmi_uevents = 0;
+        pthread_mutex_unlock(&hdmi_caps_lock);
+        close(fd);
+    }
+    pthread_attr_destroy(&attr);
+}
+
 /*****************************************************************
  * AUDIO STREAM OUT (hdmi_out_*) DEFINITION
  *****************************************************************
@@ -138,17 +264,25 @@ int hdmi_out_set_format(struct audio_stream *stream, audio_format_t format)
     return -EINVAL;
 }
 
-int hdmi_out_standby(struct audio_stream *stream)
+/* Caller holds out->lock */
+static void hdmi_out_close_pcm(hdmi_out_t *out)
 {
-    hdmi_out_t *out = (hdmi_out_t*)stream;
-
-    TRACEM("stream=%p", stream);
-
     if (out->up && out->pcm) {
         out->up = 0;
         pcm_close(out->pcm);
         out->pcm = 0;
     }
+}
+
+int hdmi_out_standby(struct audio_stream *stream)
+{
+    hdmi_out_t *out = (hdmi_out_t*)stream;
+
+    TRACEM("stream=%p", stream);
+
+    pthread_mutex_lock(&out->lock);
+    hdmi_out_close_pcm(out);
+    pthread_mutex_unlock(&out->lock);
 
     return 0;
 }
@@ -183,6 +317,98 @@ int hdmi_out_set_parameters(struct audio_stream *stream, const char *kv_pairs)
 #define MASK_CEA_5POINT1  ( CEA_SPKR_FLFR | CEA_SPKR_FC | CEA_SPKR_LFE | CEA_SPKR_RLRR )
 #define MASK_CEA_7POINT1  ( CEA_SPKR_FLFR | CEA_SPKR_FC | CEA_SPKR_LFE | CEA_SPKR_RLRR | CEA_SPKR_RLCRRC )
 #define SUPPORTS_ARR(spkalloc, profile) (((spkalloc) & (profile)) == (profile))
+#define SUPPORTS_CHANNELS(caps, profile, channels) \
+    (SUPPORTS_ARR((caps)->speaker_alloc, profile) && ((caps)->lpcm_max_channels >= (channels)))
+
+/* The widest layout, up to max_channels, the sink has speakers and
+ * LPCM channels for
+ */
+static audio_channel_mask_t hdmi_caps_channel_mask(const hdmi_audio_caps_t *caps,
+                                                   int max_channels)
+{
+    if ((max_channels >= 8) && SUPPORTS_CHANNELS(caps, MASK_CEA_7POINT1, 8)) {
+        return AUDIO_CHANNEL_OUT_7POINT1;
+    }
+    if ((max_channels >= 6) && SUPPORTS_CHANNELS(caps, MASK_CEA_5POINT1, 6)) {
+        return AUDIO_CHANNEL_OUT_5POINT1;
+    }
+    if ((max_channels >= 4) && SUPPORTS_CHANNELS(caps, MASK_CEA_QUAD, 4)) {
+        return AUDIO_CHANNEL_OUT_QUAD;
+    }
+    return AUDIO_CHANNEL_OUT_STEREO;
+}
+
+/* CEA speaker allocation of each (pair of) channel(s) */
+static const struct {
+    audio_channel_mask_t mask;
+    int spkr;
+} hdmi_spkr_map[] = {
+    { AUDIO_CHANNEL_OUT_FRONT_LEFT | AUDIO_CHANNEL_OUT_FRONT_RIGHT, CEA_SPKR_FLFR },
+    { AUDIO_CHANNEL_OUT_LOW_FREQUENCY, CEA_SPKR_LFE },
+    { AUDIO_CHANNEL_OUT_FRONT_CENTER, CEA_SPKR_FC },
+    { AUDIO_CHANNEL_OUT_BACK_LEFT | AUDIO_CHANNEL_OUT_BACK_RIGHT, CEA_SPKR_RLRR },
+    { AUDIO_CHANNEL_OUT_BACK_CENTER, CEA_SPKR_RC },
+    { AUDIO_CHANNEL_OUT_FRONT_LEFT_OF_CENTER | AUDIO_CHANNEL_OUT_FRONT_RIGHT_OF_CENTER,
+      CEA_SPKR_FLCFRC },
+    { AUDIO_CHANNEL_OUT_SIDE_LEFT | AUDIO_CHANNEL_OUT_SIDE_RIGHT, CEA_SPKR_RLCRRC },
+};
+
+/* Whether the sink can play every channel of the layout as it is */
+static bool hdmi_caps_supports_mask(const hdmi_audio_caps_t *caps,
+                                    audio_channel_mask_t mask)
+{
+    audio_channel_mask_t known = 0;
+    int spkrs = 0;
+    size_t i;
+
+    /* Basic audio, even without a speaker allocation block */
+    if (mask == AUDIO_CHANNEL_OUT_STEREO) {
+        return true;
+    }
+    /* Speakers come in pairs, so half a pair (mono included) goes through
+     * the remap; and there's no CEA allocation for the top ones */
+    for (i = 0; i < sizeof(hdmi_spkr_map) / sizeof(hdmi_spkr_map[0]); i++) {
+        audio_channel_mask_t bits = mask & hdmi_spkr_map[i].mask;
+
+        known |= hdmi_spkr_map[i].mask;
+        if (!bits) {
+            continue;
+        }
+        if (bits != hdmi_spkr_map[i].mask) {
+            return false;
+        }
+        spkrs |= hdmi_spkr_map[i].spkr;
+    }
+    if ((mask & ~known) || !(spkrs & CEA_SPKR_FLFR)) {
+        return false;
+    }
+
+    return SUPPORTS_CHANNELS(caps, spkrs, (int)audio_channel_count_from_out_mask(mask));
+}
+
+/* 24 bit samples for anything wider than 16 bit, if the sink takes them */
+static int hdmi_caps_sample_bits(const hdmi_audio_caps_t *caps, audio_format_t format)
+{
+    if (format == AUDIO_FORMAT_PCM_16_BIT) {
+        return 16;
+    }
+    return (caps->lpcm_sizes & (CEA_SIZE_20 | CEA_SIZE_24)) ? 24 : 16;
+}
+
+/* HDMI_SAMPLING_RATE if the sink takes it, else the closest one above */
+static uint32_t hdmi_caps_sample_rate(const hdmi_audio_caps_t *caps)
+{
+    unsigned int rate;
+    int bit;
+
+    for (bit = CEA_RATE_32000 ; bit <= CEA_RATE_192000 ; bit <<= 1) {
+        rate = hdmi_caps_rate(bit);
+        if ((caps->lpcm_rates & bit) && (rate >= HDMI_SAMPLING_RATE)) {
+            return rate;
+        }
+    }
+    return HDMI_SAMPLING_RATE;
+}
 
 char * hdmi_out_get_parameters(const struct audio_stream *stream,
 			 const char *keys)
@@ -192,11 +418,12 @@ char * hdmi_out_get_parameters(const struct audio_stream *stream,
     char value[256];
     struct str_parms *reply = str_parms_create();
     int status;
+    bool answered = false;
     hdmi_audio_caps_t caps;
 
     TRACEM("stream=%p keys='%s'", stream, keys);
 
-    if (hdmi_query_audio_caps(HDMI_EDID_PATH, &caps)) {
+    if (hdmi_get_audio_caps(&caps)) {
         ALOGE("Unable to get the HDMI audio capabilities");
         str = calloc(1, 1);
         goto end;
@@ -205,7 +432,6 @@ char * hdmi_out_get_parameters(const struct audio_stream *stream,
     status = str_parms_get_str(query, AUDIO_PARAMETER_STREAM_SUP_CHANNELS,
                                 value, sizeof(value));
     if (status >= 0) {
-        unsigned sa = caps.speaker_alloc;
         bool first = true;
 
         /* STEREO is intentionally skipped.  This code is only
@@ -213,28 +439,28 @@ char * hdmi_out_get_parameters(const struct audio_stream *stream,
          * want stereo on a DIRECT thread.
          */
         value[0] = '\0';
-        if (SUPPORTS_ARR(sa, MASK_CEA_QUAD)) {
+        if (SUPPORTS_CHANNELS(&caps, MASK_CEA_QUAD, 4)) {
             if (!first) {
                 strcat(value, "|");
             }
             first = false;
             strcat(value, "AUDIO_CHANNEL_OUT_QUAD");
         }
-        if (SUPPORTS_ARR(sa, MASK_CEA_SURROUND)) {
+        if (SUPPORTS_CHANNELS(&caps, MASK_CEA_SURROUND, 4)) {
             if (!first) {
                 strcat(value, "|");
             }
             first = false;
             strcat(value, "AUDIO_CHANNEL_OUT_SURROUND");
         }
-        if (SUPPORTS_ARR(sa, MASK_CEA_5POINT1)) {
+        if (SUPPORTS_CHANNELS(&caps, MASK_CEA_5POINT1, 6)) {
             if (!first) {
                 strcat(value, "|");
             }
             first = false;
             strcat(value, "AUDIO_CHANNEL_OUT_5POINT1");
         }
-        if (SUPPORTS_ARR(sa, MASK_CEA_7POINT1)) {
+        if (SUPPORTS_CHANNELS(&caps, MASK_CEA_7POINT1, 8)) {
             if (!first) {
                 strcat(value, "|");
             }
@@ -242,7 +468,29 @@ char * hdmi_out_get_parameters(const struct audio_stream *stream,
             strcat(value, "AUDIO_CHANNEL_OUT_7POINT1");
         }
         str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_CHANNELS, value);
-        str = strdup(str_parms_to_str(reply));
+        answered = true;
+    }
+
+    status = str_parms_get_str(query, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES,
+                                value, sizeof(value));
+    if (status >= 0) {
+        char rate[16];
+        int bit;
+
+        value[0] = '\0';
+        for (bit = CEA_RATE_32000 ; bit <= CEA_RATE_192000 ; bit <<= 1) {
+            if (caps.lpcm_rates & bit) {
+                snprintf(rate, sizeof(rate), "%s%u", value[0] ? "|" : "",
+                         hdmi_caps_rate(bit));
+                strcat(value, rate);
+            }
+        }
+        str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES, value);
+        answered = true;
+    }
+
+    if (answered) {
+        str = str_parms_to_str(reply);
     } else {
         str = strdup(keys);
     }
@@ -287,12 +535,27 @@ int hdmi_out_set_volume(struct audio_stream_out *stream, float left, float right
 
 static int hdmi_out_find_card(void)
 {
-    /* XXX TODO: Dynamically detect HDMI card
-     * If another audio device is present at boot time (e.g.
-     * USB Audio device) then it might take the card #1
-     * position, putting HDMI on card #2.
-     */
-    return 1;
+    int card;
+
+    pthread_mutex_lock(&hdmi_caps_lock);
+    if (hdmi_card < 0) {
+        hdmi_card = hdmi_find_card(HDMI_CARD_NAME);
+        if (hdmi_card < 0) {
+            ALOGW("No %s card found, trying card %d", HDMI_CARD_NAME, HDMI_DEFAULT_CARD);
+            hdmi_card = HDMI_DEFAULT_CARD;
+        }
+    }
+    card = hdmi_card;
+    pthread_mutex_unlock(&hdmi_caps_lock);
+
+    return card;
+}
+
+static void hdmi_out_forget_card(void)
+{
+    pthread_mutex_lock(&hdmi_caps_lock);
+    hdmi_card = -1;
+    pthread_mutex_unlock(&hdmi_caps_lock);
 }
 
 static int hdmi_out_open_pcm(hdmi_out_t *out)
@@ -310,14 +573,24 @@ static int hdmi_out_open_pcm(hdmi_out_t *out)
         return 0;
     }
 
-    out->pcm = pcm_open(card, dev, PCM_OUT, &out->config);
+    out->pcm = pcm_open(card, dev, PCM_OUT | PCM_MONOTONIC, &out->config);
+    out->realtime_tstamp = 0;
+    if (out->pcm && !pcm_is_ready(out->pcm)) {
+        /* older kernels only have CLOCK_REALTIME timestamps */
+        pcm_close(out->pcm);
+        out->pcm = pcm_open(card, dev, PCM_OUT, &out->config);
+        out->realtime_tstamp = 1;
+    }
 
     if(out->pcm && pcm_is_ready(out->pcm)) {
         out->up = 1;
+        out->standby_written = out->written;
         ret = 0;
     } else {
         ALOGE("cannot open HDMI pcm card %d dev %d error: %s",
               card, dev, pcm_get_error(out->pcm));
+        /* the cards may have moved, look again next time */
+        hdmi_out_forget_card();
         pcm_close(out->pcm);
         out->pcm = 0;
         out->up = 0;
@@ -327,6 +600,25 @@ static int hdmi_out_open_pcm(hdmi_out_t *out)
     return ret;
 }
 
+/* Caller holds out->lock */
+static int hdmi_out_pcm_write(hdmi_out_t *out, const void *buffer, size_t bytes)
+{
+    int ret;
+
+    ret = pcm_write(out->pcm, buffer, bytes);
+    if (ret) {
+        /* an xrun only needs the PCM prepared again, not reopened */
+        out->xruns++;
+        ALOGW("Error writing to HDMI pcm (%u so far): %s, recovering",
+              out->xruns, pcm_get_error(out->pcm));
+        if (!pcm_prepare(out->pcm)) {
+            ret = pcm_write(out->pcm, buffer, bytes);
+        }
+    }
+
+    return ret;
+}
+
 ssize_t hdmi_out_write(struct audio_stream_out *stream, const void* buffer,
 		 size_t bytes)
 {
@@ -335,39 +627,141 @@ ssize_t hdmi_out_write(struct audio_stream_out *stream, const void* buffer,
 
     TRACEM("stream=%p buffer=%p bytes=%d", stream, buffer, bytes);
 
+    pthread_mutex_lock(&out->lock);
     if (!out->up) {
         if(hdmi_out_open_pcm(out)) {
+            pthread_mutex_unlock(&out->lock);
             return -ENOSYS;
         }
     }
 
-    ret = pcm_write(out->pcm, buffer, bytes);
+    if (out->remapping) {
+        size_t in_frame_size = hdmi_remap_in_frame_size(&out->remap);
+        size_t out_frame_size = hdmi_remap_out_frame_size(&out->remap);
+        size_t frames = bytes / in_frame_size;
+        const uint8_t *src = buffer;
+        size_t n;
+
+        ret = 0;
+        while (frames && !ret) {
+            n = (frames < out->config.period_size) ? frames : out->config.period_size;
+            hdmi_remap_process(&out->remap, src, out->remap_buf, n);
+            ret = hdmi_out_pcm_write(out, out->remap_buf, n * out_frame_size);
+            src += n * in_frame_size;
+            frames -= n;
+        }
+    } else {
+        ret = hdmi_out_pcm_write(out, buffer, bytes);
+    }
     if (ret) {
         ALOGE("Error writing to HDMI pcm: %s", pcm_get_error(out->pcm));
         ret = (ret < 0) ? ret : -ret;
-        hdmi_out_standby((struct audio_stream*)stream);
+        hdmi_out_close_pcm(out);
     } else {
+        out->written += bytes / audio_stream_frame_size(&stream->common);
         ret = bytes;
     }
+    pthread_mutex_unlock(&out->lock);
 
     return ret;
 }
 
+/*
+ * Caller holds out->lock. Returns the frames handed to the driver that
+ * are not played yet, and the CLOCK_MONOTONIC time that was true at.
+ */
+static int hdmi_out_get_queued(hdmi_out_t *out, uint64_t *queued,
+                               struct timespec *tstamp)
+{
+    unsigned int avail, size;
+
+    if (!out->up || pcm_get_htimestamp(out->pcm, &avail, tstamp)) {
+        return -ENODATA;
+    }
+
+    size = pcm_get_buffer_size(out->pcm);
+    *queued = (avail < size) ? size - avail : 0;
+    if (*queued > out->written - out->standby_written) {
+        *queued = out->written - out->standby_written;
+    }
+
+    if (out->realtime_tstamp) {
+        struct timespec mono, real;
+        int64_t ns;
+
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        clock_gettime(CLOCK_REALTIME, &real);
+        ns = (int64_t)tstamp->tv_sec * 1000000000LL + tstamp->tv_nsec
+            + ((int64_t)mono.tv_sec - real.tv_sec) * 1000000000LL
+            + (mono.tv_nsec - real.tv_nsec);
+        tstamp->tv_sec = ns / 1000000000LL;
+        tstamp->tv_nsec = ns % 1000000000LL;
+    }
+
+    return 0;
+}
+
+/* Frames played since the last exit from standby */
 int hdmi_out_get_render_position(const struct audio_stream_out *stream,
 			   uint32_t *dsp_frames)
 {
+    hdmi_out_t *out = (hdmi_out_t*)stream;
+    struct timespec tstamp;
+    uint64_t queued;
+    int ret;
+
     TRACE();
-    return -EINVAL;
+
+    pthread_mutex_lock(&out->lock);
+    ret = hdmi_out_get_queued(out, &queued, &tstamp);
+    if (!ret) {
+        *dsp_frames = out->written - out->standby_written - queued;
+    }
+    pthread_mutex_unlock(&out->lock);
+
+    return ret;
 }
 
+/* When the next write() starts playing, in CLOCK_MONOTONIC microseconds */
 int hdmi_out_get_next_write_timestamp(const struct audio_stream_out *stream,
 				int64_t *timestamp)
 {
+    hdmi_out_t *out = (hdmi_out_t*)stream;
+    struct timespec tstamp;
+    uint64_t queued;
+    int ret;
+
     TRACE();
-    return -EINVAL;
+
+    pthread_mutex_lock(&out->lock);
+    ret = hdmi_out_get_queued(out, &queued, &tstamp);
+    if (!ret) {
+        *timestamp = (int64_t)tstamp.tv_sec * 1000000 + tstamp.tv_nsec / 1000
+            + (int64_t)queued * 1000000 / out->config.rate;
+    }
+    pthread_mutex_unlock(&out->lock);
+
+    return ret;
 }
 
+int hdmi_out_get_presentation_position(const struct audio_stream_out *stream,
+                                       uint64_t *frames, struct timespec *timestamp)
+{
+    hdmi_out_t *out = (hdmi_out_t*)stream;
+    uint64_t queued;
+    int ret;
+
+    TRACE();
 
+    pthread_mutex_lock(&out->lock);
+    ret = hdmi_out_get_queued(out, &queued, timestamp);
+    if (!ret) {
+        *frames = out->written - queued;
+    }
+    pthread_mutex_unlock(&out->lock);
+
+    return ret;
+}
 
 audio_stream_out_t hdmi_stream_out_descriptor = {
     .common = {
@@ -391,6 +785,7 @@ audio_stream_out_t hdmi_stream_out_descriptor = {
     .write = hdmi_out_write,
     .get_render_position = hdmi_out_get_render_position,
     .get_next_write_timestamp = hdmi_out_get_next_write_timestamp,
+    .get_presentation_position = hdmi_out_get_presentation_position,
 };
 
 /*****************************************************************
@@ -491,6 +886,9 @@ static int hdmi_adev_open_output_stream(audio_hw_device_t *dev,
     hdmi_out_t *out = 0;
     struct pcm_config *pcm_config = 0;
     struct audio_config *a_config = 0;
+    hdmi_audio_caps_t caps;
+    audio_channel_mask_t out_mask;
+    int out_bits;
 
     TRACE();
 
@@ -522,11 +920,19 @@ static int hdmi_adev_open_output_stream(audio_hw_device_t *dev,
     pcm_config->period_size = HDMI_PERIOD_SIZE;
     pcm_config->period_count = HDMI_PERIOD_COUNT;
 
+    if (hdmi_get_audio_caps(&caps) || !caps.has_audio) {
+        ALOGW("No HDMI audio capabilities, assuming basic audio");
+        memset(&caps, 0, sizeof(caps));
+        caps.lpcm_max_channels = 2;
+        caps.lpcm_rates = CEA_RATE_32000 | CEA_RATE_44100 | CEA_RATE_48000;
+        caps.lpcm_sizes = CEA_SIZE_16;
+    }
+
     if (a_config->sample_rate) {
         pcm_config->rate = config->sample_rate;
     } else {
-        pcm_config->rate = HDMI_SAMPLING_RATE;
-        a_config->sample_rate = HDMI_SAMPLING_RATE;
+        pcm_config->rate = hdmi_caps_sample_rate(&caps);
+        a_config->sample_rate = pcm_config->rate;
     }
 
     switch (a_config->format) {
@@ -534,41 +940,65 @@ static int hdmi_adev_open_output_stream(audio_hw_device_t *dev,
         a_config->format = AUDIO_FORMAT_PCM_16_BIT;
         /* fall through */
     case AUDIO_FORMAT_PCM_16_BIT:
-        pcm_config->format = PCM_FORMAT_S16_LE;
+    case AUDIO_FORMAT_PCM_8_24_BIT:
+    case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+    case AUDIO_FORMAT_PCM_32_BIT:
+    case AUDIO_FORMAT_PCM_FLOAT:
         break;
     default:
         ALOGE("HDMI rejecting format %x", config->format);
         goto fail;
     }
+    out_bits = hdmi_caps_sample_bits(&caps, a_config->format);
+    pcm_config->format = (out_bits == 24) ? PCM_FORMAT_S24_LE : PCM_FORMAT_S16_LE;
 
     a_config->channel_mask = config->channel_mask;
-    switch (config->channel_mask) {
-    case AUDIO_CHANNEL_OUT_STEREO:
-        pcm_config->channels = 2;
-        break;
-    case AUDIO_CHANNEL_OUT_QUAD:
-    case HDMI_AUDIO_CHANNEL_OUT_SURROUND:
-        pcm_config->channels = 4;
-        break;
-    case AUDIO_CHANNEL_OUT_5POINT1:
-        pcm_config->channels = 6;
-        break;
-    case AUDIO_CHANNEL_OUT_7POINT1:
-        pcm_config->channels = 8;
-        break;
-    default:
-        ALOGE("HDMI setting a default channel_mask %x -> 8", config->channel_mask);
-        config->channel_mask = AUDIO_CHANNEL_OUT_7POINT1;
-        a_config->channel_mask = AUDIO_CHANNEL_OUT_7POINT1;
-        pcm_config->channels = 8;
+    if (!audio_is_output_channel(config->channel_mask)
+            || (audio_channel_count_from_out_mask(config->channel_mask) > HDMI_MAX_CHANNELS)) {
+        a_config->channel_mask = hdmi_caps_channel_mask(&caps, HDMI_MAX_CHANNELS);
+        ALOGE("HDMI setting a default channel_mask %x -> %x", config->channel_mask,
+              a_config->channel_mask);
+        config->channel_mask = a_config->channel_mask;
+    }
+
+    /* Anything the sink has no speakers for is folded into the layout
+     * it does have, never wider than what we're given.
+     */
+    if (hdmi_caps_supports_mask(&caps, a_config->channel_mask)) {
+        out_mask = a_config->channel_mask;
+    } else {
+        out_mask = hdmi_caps_channel_mask(&caps,
+                       audio_channel_count_from_out_mask(a_config->channel_mask));
+    }
+    pcm_config->channels = audio_channel_count_from_out_mask(out_mask);
+
+    if ((out_mask != a_config->channel_mask)
+            || (a_config->format != AUDIO_FORMAT_PCM_16_BIT)) {
+        if (hdmi_remap_init(&out->remap, a_config->format, a_config->channel_mask,
+                            out_bits, out_mask)) {
+            ALOGE("HDMI can't remap format %x channel_mask %x", a_config->format,
+                  a_config->channel_mask);
+            goto fail;
+        }
+        out->remap_buf = malloc(pcm_config->period_size
+                                * hdmi_remap_out_frame_size(&out->remap));
+        if (!out->remap_buf) {
+            goto fail;
+        }
+        out->remapping = 1;
+        ALOGV("HDMI remapping channel_mask %x -> %x, %d bit samples",
+              a_config->channel_mask, out_mask, out_bits);
     }
 
+    pthread_mutex_init(&out->lock, NULL);
+
     ALOGV("stream = %p", out);
     *stream_out = &out->stream_out;
 
     return 0;
 
 fail:
+    free(out->remap_buf);
     free(out);
     return -ENOSYS;
 }
@@ -578,6 +1008,8 @@ static void hdmi_adev_close_output_stream(__attribute__((unused)) audio_hw_devic
 {
     TRACEM("dev=%p stream_out=%p", dev, stream_out);
     stream_out->common.standby((audio_stream_t*)stream_out);
+    pthread_mutex_destroy(&((hdmi_out_t*)stream_out)->lock);
+    free(((hdmi_out_t*)stream_out)->remap_buf);
     free(stream_out);
 }
 
@@ -640,6 +1072,8 @@ static int hdmi_adev_open(const hw_module_t* module,
     if (strcmp(name, AUDIO_HARDWARE_INTERFACE) != 0)
         return -EINVAL;
 
+    pthread_once(&hdmi_uevent_once, hdmi_start_uevent_thread);
+
     hdmi_adev_descriptor.common.module = (struct hw_module_t *) module;
     *device = &hdmi_adev_descriptor.common;
 
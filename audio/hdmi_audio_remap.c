@@ -0,0 +1,357 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+/*
+ * Copyright (C) 2012 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hdmi_audio_hw"
+/* #define LOG_NDEBUG 0 */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <system/audio.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "hdmi_audio_hal.h"
+
+/* Frames converted per pass, sized to keep both scratch buffers on the stack */
+#define REMAP_BLOCK_FRAMES 64
+
+#define M3DB 0.70710678f
+
+#define CH(x) AUDIO_CHANNEL_OUT_##x
+
+/* Where a channel the sink has no speaker for goes.  The targets are
+ * tried in order and the first one the output layout has all of wins.
+ */
+typedef struct _remap_fold {
+    uint32_t channel;
+    struct {
+        uint32_t mask;
+        float gain;
+    } targets[3];
+} remap_fold_t;
+
+static const remap_fold_t remap_folds[] = {
+    { CH(FRONT_CENTER),           { { CH(FRONT_LEFT) | CH(FRONT_RIGHT), M3DB } } },
+    { CH(LOW_FREQUENCY),          { { CH(FRONT_LEFT) | CH(FRONT_RIGHT), M3DB } } },
+    { CH(BACK_LEFT),              { { CH(SIDE_LEFT), 1.0f },
+                                    { CH(FRONT_LEFT), M3DB } } },
+    { CH(BACK_RIGHT),             { { CH(SIDE_RIGHT), 1.0f },
+                                    { CH(FRONT_RIGHT), M3DB } } },
+    { CH(FRONT_LEFT_OF_CENTER),   { { CH(FRONT_LEFT), 1.0f } } },
+    { CH(FRONT_RIGHT_OF_CENTER),  { { CH(FRONT_RIGHT), 1.0f } } },
+    { CH(BACK_CENTER),            { { CH(BACK_LEFT) | CH(BACK_RIGHT), M3DB },
+                                    { CH(SIDE_LEFT) | CH(SIDE_RIGHT), M3DB },
+                                    { CH(FRONT_LEFT) | CH(FRONT_RIGHT), 0.5f } } },
+    { CH(SIDE_LEFT),              { { CH(BACK_LEFT), 1.0f },
+                                    { CH(FRONT_LEFT), M3DB } } },
+    { CH(SIDE_RIGHT),             { { CH(BACK_RIGHT), 1.0f },
+                                    { CH(FRONT_RIGHT), M3DB } } },
+    { CH(TOP_CENTER),             { { CH(FRONT_LEFT) | CH(FRONT_RIGHT), 0.5f } } },
+    { CH(TOP_FRONT_LEFT),         { { CH(FRONT_LEFT), M3DB } } },
+    { CH(TOP_FRONT_CENTER),       { { CH(FRONT_CENTER), M3DB },
+                                    { CH(FRONT_LEFT) | CH(FRONT_RIGHT), 0.5f } } },
+    { CH(TOP_FRONT_RIGHT),        { { CH(FRONT_RIGHT), M3DB } } },
+    { CH(TOP_BACK_LEFT),          { { CH(BACK_LEFT), M3DB },
+                                    { CH(SIDE_LEFT), M3DB },
+                                    { CH(FRONT_LEFT), 0.5f } } },
+    { CH(TOP_BACK_CENTER),        { { CH(BACK_LEFT) | CH(BACK_RIGHT), 0.5f },
+                                    { CH(SIDE_LEFT) | CH(SIDE_RIGHT), 0.5f },
+                                    { CH(FRONT_LEFT) | CH(FRONT_RIGHT), 0.5f } } },
+    { CH(TOP_BACK_RIGHT),         { { CH(BACK_RIGHT), M3DB },
+                                    { CH(SIDE_RIGHT), M3DB },
+                                    { CH(FRONT_RIGHT), 0.5f } } },
+};
+
+/* Position of a channel in frames of the given layout */
+static int remap_index(uint32_t mask, uint32_t channel)
+{
+    return __builtin_popcount(mask & (channel - 1));
+}
+
+static void remap_fold(hdmi_remap_t *remap, int in, uint32_t channel, uint32_t out_mask)
+{
+    const remap_fold_t *fold = NULL;
+    uint32_t targets, bit;
+    unsigned int i;
+    int t;
+
+    for (i = 0 ; i < sizeof(remap_folds) / sizeof(remap_folds[0]) ; ++i) {
+        if (remap_folds[i].channel == channel) {
+            fold = &remap_folds[i];
+            break;
+        }
+    }
+    if (fold == NULL) {
+        ALOGW("No place for channel 0x%x, dropping it", channel);
+        return;
+    }
+
+    for (t = 0 ; t < 3 && fold->targets[t].mask ; ++t) {
+        targets = fold->targets[t].mask;
+        if ((out_mask & targets) != targets) {
+            continue;
+        }
+        for (bit = 1 ; bit && bit <= targets ; bit <<= 1) {
+            if (targets & bit) {
+                remap->matrix[in][remap_index(out_mask, bit)] = fold->targets[t].gain;
+            }
+        }
+        return;
+    }
+    ALOGW("No place for channel 0x%x, dropping it", channel);
+}
+
+int hdmi_remap_init(hdmi_remap_t *remap, uint32_t in_format, uint32_t in_mask,
+                    int out_bits, uint32_t out_mask)
+{
+    uint32_t bit;
+    int in;
+
+    memset(remap, 0, sizeof(*remap));
+
+    switch (in_format) {
+    case AUDIO_FORMAT_PCM_16_BIT:
+        remap->in_format = HDMI_REMAP_IN_S16;
+        break;
+    case AUDIO_FORMAT_PCM_8_24_BIT:
+        remap->in_format = HDMI_REMAP_IN_Q8_23;
+        break;
+    case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+        remap->in_format = HDMI_REMAP_IN_S24_3;
+        break;
+    case AUDIO_FORMAT_PCM_32_BIT:
+        remap->in_format = HDMI_REMAP_IN_S32;
+        break;
+    case AUDIO_FORMAT_PCM_FLOAT:
+        remap->in_format = HDMI_REMAP_IN_FLOAT;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    if ((out_bits != 16) && (out_bits != 24)) {
+        return -EINVAL;
+    }
+    remap->out_bits = out_bits;
+
+    remap->in_channels = __builtin_popcount(in_mask);
+    remap->out_channels = __builtin_popcount(out_mask);
+    if (!remap->in_channels || (remap->in_channels > HDMI_MAX_CHANNELS)
+            || !remap->out_channels || (remap->out_channels > HDMI_MAX_CHANNELS)) {
+        return -EINVAL;
+    }
+
+    for (bit = 1, in = 0 ; in < remap->in_channels ; bit <<= 1) {
+        if (!(in_mask & bit)) {
+            continue;
+        }
+        if (out_mask & bit) {
+            remap->matrix[in][remap_index(out_mask, bit)] = 1.0f;
+        } else {
+            remap_fold(remap, in, bit, out_mask);
+        }
+        ++in;
+    }
+
+    /* Mono goes to both front speakers */
+    if ((in_mask == AUDIO_CHANNEL_OUT_MONO) && (out_mask & AUDIO_CHANNEL_OUT_FRONT_RIGHT)) {
+        remap->matrix[0][remap_index(out_mask, AUDIO_CHANNEL_OUT_FRONT_RIGHT)] = 1.0f;
+    }
+
+    ALOGV("remap: format %d %d channels (0x%x) to %d bit %d channels (0x%x)",
+          remap->in_format, remap->in_channels, in_mask,
+          remap->out_bits, remap->out_channels, out_mask);
+
+    return 0;
+}
+
+size_t hdmi_remap_in_frame_size(const hdmi_remap_t *remap)
+{
+    switch (remap->in_format) {
+    case HDMI_REMAP_IN_S16:
+        return remap->in_channels * sizeof(int16_t);
+    case HDMI_REMAP_IN_S24_3:
+        return remap->in_channels * 3;
+    default:
+        return remap->in_channels * sizeof(int32_t);
+    }
+}
+
+size_t hdmi_remap_out_frame_size(const hdmi_remap_t *remap)
+{
+    if (remap->out_bits == 16) {
+        return remap->out_channels * sizeof(int16_t);
+    }
+    return remap->out_channels * sizeof(int32_t);
+}
+
+/* Samples to floats in [-1, 1) */
+static void remap_load(const hdmi_remap_t *remap, const void *in, float *dst, size_t samples)
+{
+    size_t i = 0;
+
+    switch (remap->in_format) {
+    case HDMI_REMAP_IN_S16: {
+        const int16_t *src = in;
+#if defined(__ARM_NEON__)
+        for ( ; i + 8 <= samples ; i += 8) {
+            int16x8_t s = vld1q_s16(src + i);
+            vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(s))),
+                                           1.0f / 32768));
+            vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(s))),
+                                               1.0f / 32768));
+        }
+#endif
+        for ( ; i < samples ; ++i) {
+            dst[i] = src[i] * (1.0f / 32768);
+        }
+        break;
+    }
+    case HDMI_REMAP_IN_Q8_23: {
+        const int32_t *src = in;
+        for ( ; i < samples ; ++i) {
+            dst[i] = src[i] * (1.0f / (1 << 23));
+        }
+        break;
+    }
+    case HDMI_REMAP_IN_S24_3: {
+        const uint8_t *src = in;
+        int32_t s;
+        for ( ; i < samples ; ++i, src += 3) {
+            s = (int32_t)(((uint32_t)src[0] << 8) | ((uint32_t)src[1] << 16)
+                          | ((uint32_t)src[2] << 24));
+            dst[i] = s * (1.0f / 2147483648.0f);
+        }
+        break;
+    }
+    case HDMI_REMAP_IN_S32: {
+        const int32_t *src = in;
+        for ( ; i < samples ; ++i) {
+            dst[i] = src[i] * (1.0f / 2147483648.0f);
+        }
+        break;
+    }
+    case HDMI_REMAP_IN_FLOAT:
+        memcpy(dst, in, samples * sizeof(float));
+        break;
+    }
+}
+
+/* dst has room for HDMI_MAX_CHANNELS floats past the last frame */
+static void remap_mix(const hdmi_remap_t *remap, const float *src, float *dst, size_t frames)
+{
+    const int in_channels = remap->in_channels;
+    const int out_channels = remap->out_channels;
+    size_t n;
+    int i;
+
+#if defined(__ARM_NEON__)
+    for (n = 0 ; n < frames ; ++n, src += in_channels, dst += out_channels) {
+        float32x4_t lo = vdupq_n_f32(0.0f);
+        float32x4_t hi = vdupq_n_f32(0.0f);
+
+        for (i = 0 ; i < in_channels ; ++i) {
+            lo = vmlaq_n_f32(lo, vld1q_f32(&remap->matrix[i][0]), src[i]);
+            hi = vmlaq_n_f32(hi, vld1q_f32(&remap->matrix[i][4]), src[i]);
+        }
+        vst1q_f32(dst, lo);
+        vst1q_f32(dst + 4, hi);
+    }
+#else
+    float acc[HDMI_MAX_CHANNELS];
+    int o;
+
+    for (n = 0 ; n < frames ; ++n, src += in_channels, dst += out_channels) {
+        for (o = 0 ; o < HDMI_MAX_CHANNELS ; ++o) {
+            acc[o] = 0.0f;
+        }
+        for (i = 0 ; i < in_channels ; ++i) {
+            for (o = 0 ; o < HDMI_MAX_CHANNELS ; ++o) {
+                acc[o] += remap->matrix[i][o] * src[i];
+            }
+        }
+        for (o = 0 ; o < out_channels ; ++o) {
+            dst[o] = acc[o];
+        }
+    }
+#endif
+}
+
+/* Floats to S16_LE or S24_LE, saturating */
+static void remap_store(const hdmi_remap_t *remap, const float *src, void *out, size_t samples)
+{
+    size_t i = 0;
+    float s;
+
+    if (remap->out_bits == 16) {
+        int16_t *dst = out;
+#if defined(__ARM_NEON__)
+        /* vcvt and vqmovn both saturate */
+        for ( ; i + 4 <= samples ; i += 4) {
+            int32x4_t v = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), 32768.0f));
+            vst1_s16(dst + i, vqmovn_s32(v));
+        }
+#endif
+        for ( ; i < samples ; ++i) {
+            s = src[i] * 32768.0f;
+            s = s > 32767.0f ? 32767.0f : (s < -32768.0f ? -32768.0f : s);
+            dst[i] = (int16_t)s;
+        }
+    } else {
+        int32_t *dst = out;
+#if defined(__ARM_NEON__)
+        const float32x4_t max = vdupq_n_f32(8388607.0f);
+        const float32x4_t min = vdupq_n_f32(-8388608.0f);
+        for ( ; i + 4 <= samples ; i += 4) {
+            float32x4_t v = vmulq_n_f32(vld1q_f32(src + i), 8388608.0f);
+            vst1q_s32(dst + i, vcvtq_s32_f32(vmaxq_f32(vminq_f32(v, max), min)));
+        }
+#endif
+        for ( ; i < samples ; ++i) {
+            s = src[i] * 8388608.0f;
+            s = s > 8388607.0f ? 8388607.0f : (s < -8388608.0f ? -8388608.0f : s);
+            dst[i] = (int32_t)s;
+        }
+    }
+}
+
+void hdmi_remap_process(const hdmi_remap_t *remap, const void *in, void *out,
+                        size_t frames)
+{
+    float in_buf[REMAP_BLOCK_FRAMES * HDMI_MAX_CHANNELS];
+    float out_buf[(REMAP_BLOCK_FRAMES + 1) * HDMI_MAX_CHANNELS];
+    const size_t in_frame_size = hdmi_remap_in_frame_size(remap);
+    const size_t out_frame_size = hdmi_remap_out_frame_size(remap);
+    const uint8_t *src = in;
+    uint8_t *dst = out;
+    size_t n;
+
+    while (frames) {
+        n = frames < REMAP_BLOCK_FRAMES ? frames : REMAP_BLOCK_FRAMES;
+        remap_load(remap, src, in_buf, n * remap->in_channels);
+        remap_mix(remap, in_buf, out_buf, n);
+        remap_store(remap, out_buf, dst, n * remap->out_channels);
+        src += n * in_frame_size;
+        dst += n * out_frame_size;
+        frames -= n;
+    }
+}
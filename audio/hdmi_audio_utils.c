@@ -21,7 +21,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
 
 #include "hdmi_audio_hal.h"
@@ -89,12 +91,35 @@
 #define CEA_TAG_SPKRS (4 << 5)
 #define CEA_BIT_AUDIO (1 << 6)
 
-static void hdmi_dump_short_audio_descriptor_block(unsigned char *mem)
+#define SAD_SIZE 3
+
+#define ASOUND_CARDS "/proc/asound/cards"
+
+static const unsigned int cea_rates[] = {
+    32000, 44100, 48000, 88200, 96000, 176400, 192000,
+};
+
+unsigned int hdmi_caps_rate(int rate_bit)
+{
+    unsigned int i;
+
+    for (i = 0 ; i < sizeof(cea_rates) / sizeof(cea_rates[0]) ; ++i) {
+        if (rate_bit == (1 << i)) {
+            return cea_rates[i];
+        }
+    }
+    return 0;
+}
+
+static void hdmi_parse_short_audio_descriptor_block(const unsigned char *mem,
+                                                    hdmi_audio_caps_t *caps)
 {
     const unsigned char FORMAT_MASK = 0x78;
     const unsigned char MAX_CH_MASK = 0x07;
-    int n, size;
-    unsigned char *p, *end, byte, format, chs;
+    int size;
+    const unsigned char *p, *end;
+    unsigned char byte, format, chs;
+    hdmi_audio_sad_t *sad;
     const char* formats[] = {
         "Reserved (0)",
         "LPCM",
@@ -117,7 +142,7 @@ static void hdmi_dump_short_audio_descriptor_block(unsigned char *mem)
     size = *mem & CEA_SIZE_MASK;
     end = mem + 1 + size;
 
-    for (p = mem + 1 ; p < end ; p += 3) {
+    for (p = mem + 1 ; p + SAD_SIZE <= end ; p += SAD_SIZE) {
         byte = p[0];
         format = (byte & FORMAT_MASK) >> 3;
         chs = byte & MAX_CH_MASK;
@@ -140,47 +165,46 @@ static void hdmi_dump_short_audio_descriptor_block(unsigned char *mem)
         if ((format >= 2) && (format <= 8)) {
             ALOGV("  max bit rate: %d kHz", ((int)byte) * 8);
         }
+
+        if (caps->n_sads == HDMI_MAX_SADS) {
+            ALOGW("Too many Short Audio Descriptors, ignoring the rest");
+            continue;
+        }
+        sad = &caps->sads[caps->n_sads++];
+        sad->format = format;
+        sad->max_channels = chs + 1;
+        sad->rates = p[1] & 0x7F;
+        if (format == CEA_FORMAT_LPCM) {
+            sad->extra = p[2] & 0x07;
+        } else if ((format >= 2) && (format <= 8)) {
+            sad->extra = ((int)p[2]) * 8;
+        } else {
+            sad->extra = p[2];
+        }
     }
 }
 
-int hdmi_query_audio_caps(const char* edid_path, hdmi_audio_caps_t *caps)
+int hdmi_parse_audio_caps(const unsigned char *edid, int edid_len, hdmi_audio_caps_t *caps)
 {
-    int fd;
-    unsigned char edid[HDMI_MAX_EDID];
-    int status;
-    int index, n;
+    int index, n, i;
     int nblocks;
     int edid_size;
 
-    int has_audio = 0;
-    int speaker_alloc = 0;
-    int done = 0;
-
-    memset(edid, 0, sizeof(edid));
+    memset(caps, 0, sizeof(*caps));
 
-    fd = open(edid_path, O_RDONLY);
-    if (fd == -1) {
-        return -errno;
-    }
-
-    status = read(fd, edid, sizeof(edid));
-    close(fd);
-    if (status == -1) {
-        ALOGV("Error reading EDID");
-        return -errno;
-    } else {
-        ALOGV("read %d bytes from edid file", status);
+    if (edid_len < EDID_BLOCK_SIZE) {
+        return -EINVAL;
     }
 
     nblocks = edid[0x7E];
-    if (edid[EDID_BLOCK_SIZE] == EDID_BLOCK_MAP_ID) {
+    if ((edid_len > EDID_BLOCK_SIZE) && (edid[EDID_BLOCK_SIZE] == EDID_BLOCK_MAP_ID)) {
         /* The block map is just an index... don't need it. */
         ++nblocks;
     }
     ALOGV("EDID contians %d additional extension block(s)", nblocks);
     edid_size = EDID_BLOCK_SIZE * (nblocks + 1);
-    if (edid_size > HDMI_MAX_EDID) {
-        edid_size = HDMI_MAX_EDID;
+    if (edid_size > edid_len) {
+        edid_size = edid_len - edid_len % EDID_BLOCK_SIZE;
     }
 
     for (index = EDID_BLOCK_SIZE ; index < edid_size ; index += EDID_BLOCK_SIZE) {
@@ -192,8 +216,11 @@ int hdmi_query_audio_caps(const char* edid_path, hdmi_audio_caps_t *caps)
 
             /* Parse CEA header for size and audio presence */
             d = edid[index + 2];
+            if (d > EDID_BLOCK_SIZE) {
+                d = EDID_BLOCK_SIZE;
+            }
             if (edid[index + 3] & CEA_BIT_AUDIO) {
-                has_audio = 1;
+                caps->has_audio = 1;
             } else {
                 break;
             }
@@ -205,16 +232,20 @@ int hdmi_query_audio_caps(const char* edid_path, hdmi_audio_caps_t *caps)
                 size = byte & CEA_SIZE_MASK;
                 ++n;
 
+                if (n + size > d) {
+                    ALOGE("CEA data block overruns the data block collection");
+                    break;
+                }
+
                 switch (tag) {
                 case CEA_TAG_AUDIO:
-                    /* ignore for now, needed for bitstream. */
-                    hdmi_dump_short_audio_descriptor_block(&edid[index + n - 1]);
+                    hdmi_parse_short_audio_descriptor_block(&edid[index + n - 1], caps);
                     break;
                 case CEA_TAG_SPKRS: /* I think this fails... not sure why */
                     ALOGE_IF(size != 3, "CEA Speaker Allocation Block is wrong size "
                              "(got %d, expected 3)", size);
                     byte = edid[index + n];
-                    speaker_alloc = byte;
+                    caps->speaker_alloc = byte;
                     break;
                 }
 
@@ -226,18 +257,85 @@ int hdmi_query_audio_caps(const char* edid_path, hdmi_audio_caps_t *caps)
         }
     }
 
-    caps->has_audio = has_audio;
-    caps->speaker_alloc = speaker_alloc;
+    for (i = 0 ; i < caps->n_sads ; ++i) {
+        if (caps->sads[i].format != CEA_FORMAT_LPCM) {
+            continue;
+        }
+        if (caps->sads[i].max_channels > caps->lpcm_max_channels) {
+            caps->lpcm_max_channels = caps->sads[i].max_channels;
+        }
+        caps->lpcm_rates |= caps->sads[i].rates;
+        caps->lpcm_sizes |= caps->sads[i].extra;
+    }
+    if (caps->has_audio && !caps->lpcm_max_channels) {
+        /* Basic audio is mandatory for HDMI sinks with audio */
+        caps->lpcm_max_channels = 2;
+        caps->lpcm_rates = CEA_RATE_32000 | CEA_RATE_44100 | CEA_RATE_48000;
+        caps->lpcm_sizes = CEA_SIZE_16;
+    }
 
     return 0;
 }
 
+int hdmi_query_audio_caps(const char* edid_path, hdmi_audio_caps_t *caps)
+{
+    int fd;
+    unsigned char edid[HDMI_MAX_EDID];
+    int status;
+
+    memset(edid, 0, sizeof(edid));
+
+    fd = open(edid_path, O_RDONLY);
+    if (fd == -1) {
+        return -errno;
+    }
+
+    status = read(fd, edid, sizeof(edid));
+    close(fd);
+    if (status == -1) {
+        ALOGV("Error reading EDID");
+        return -errno;
+    } else {
+        ALOGV("read %d bytes from edid file", status);
+    }
+
+    return hdmi_parse_audio_caps(edid, status, caps);
+}
+
+/*
+ * Returns the index of the first ALSA card whose id or name contains
+ * @name, from lines like " 1 [OMAP4HDMI      ]: OMAP4HDMI - OMAP4HDMI".
+ */
+int hdmi_find_card(const char *name)
+{
+    FILE *f;
+    char line[256];
+    int card;
+    int ret = -ENODEV;
+
+    f = fopen(ASOUND_CARDS, "r");
+    if (!f) {
+        return -errno;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        if ((sscanf(line, " %d [", &card) == 1) && strstr(line, name)) {
+            ret = card;
+            break;
+        }
+    }
+    fclose(f);
+
+    return ret;
+}
+
 
 #ifdef HDMI_CAPS_STANDALONE
 int main(int argc, char* argv[])
 {
     const char prog_name[] = "hdmi_audio_caps";
     const char *edid_path;
+    int i;
     hdmi_audio_caps_t caps = {
         .has_audio = 0,
     };
@@ -259,6 +357,15 @@ int main(int argc, char* argv[])
     printf("caps = {\n");
     printf("  .has_audio = %d\n", caps.has_audio);
     printf("  .speaker_alloc = 0x%02x\n", caps.speaker_alloc);
+    printf("  .n_sads = %d\n", caps.n_sads);
+    for (i = 0 ; i < caps.n_sads ; ++i) {
+        printf("  .sads[%d] = { .format = %d, .max_channels = %d, .rates = 0x%02x, .extra = %d }\n",
+               i, caps.sads[i].format, caps.sads[i].max_channels,
+               caps.sads[i].rates, caps.sads[i].extra);
+    }
+    printf("  .lpcm_max_channels = %d\n", caps.lpcm_max_channels);
+    printf("  .lpcm_rates = 0x%02x\n", caps.lpcm_rates);
+    printf("  .lpcm_sizes = 0x%02x\n", caps.lpcm_sizes);
     printf("}\n");
 
     return 0;
@@ -18,15 +18,26 @@
 /* #define LOG_NDEBUG 0 */
 
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <dlfcn.h>
 #include <pthread.h>
 #include <fcntl.h>
-
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <cutils/atomic.h>
 #include <cutils/log.h>
+#include <cutils/str_parms.h>
 
 #include <hardware/hardware.h>
 #include <system/audio.h>
+#include <system/thread_defs.h>
 #include <hardware/audio.h>
 
 #include <tinyalsa/asoundlib.h>
@@ -38,30 +49,108 @@
 #define MUTE_CTL	"Analog Right Capture Route"
 #define MUTE_VALUE	"Off"
 
+/*
+ * The bookkeeping of a wrapped stream is allocated together with the
+ * stream handed to AudioFlinger, which is its first member, so the
+ * wrapper is found from the stream pointer without any lookup.
+ *
+ * users counts the read()/write() calls in progress. Other stream calls
+ * and close run exclusively: they set STREAM_EXCLUSIVE, wait for users
+ * to drain and hold new readers/writers off until they are done. Those
+ * are serialized by the in/out_streams_mutex, which read()/write() never
+ * take.
+ */
+#define WRAPPER_STREAM_MAGIC	0x77726170	/* "wrap" */
+#define STREAM_EXCLUSIVE	0x40000000
+/* capture periods the driver holds, each get_buffer_size() long */
+#define IN_BUFFER_PERIODS	2
+
+/* get_parameters() key for the wrapper_stream_stats below */
+#define WRAPPER_STATS_KEY	"wrapper_stats"
+#define STATS_HIST_BUCKETS	10	/* call time <512us, <1ms, ... <128ms, >=128ms */
+#define STATS_REPLY_MAX		512
+
+/*
+ * read()/write() counters. Only the thread doing the I/O updates them (the
+ * deep buffer thread for resampled and short_calls), dump() and
+ * get_parameters() read them as they are.
+ */
+struct wrapper_stream_stats {
+    unsigned int calls;
+    unsigned long long bytes;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned int hist[STATS_HIST_BUCKETS];
+    unsigned int short_calls;   /* fewer bytes than asked for */
+    unsigned int resampled;     /* wrapper_hal_is_resampling() fired */
+    unsigned int blocked;       /* waited for an exclusive call */
+    unsigned long long blocked_ns;
+};
+
 /* Input */
 struct wrapper_in_stream {
-    struct audio_stream_in *stream_in;
+    struct audio_stream_in stream_in;
     struct jb_audio_stream_in *jb_stream_in;
-    int in_use;
-    pthread_mutex_t in_use_mutex;
-    pthread_cond_t in_use_cond;
+    uint32_t magic;
+    volatile int32_t users;
+
+    /* overrun detection, see wrapper_read() */
+    uint32_t sample_rate;
+    int64_t buffer_ns;
+    int64_t read_end_ns;
+    volatile int32_t frames_lost;
+
+    struct wrapper_stream_stats stats;
 };
 
-static struct wrapper_in_stream *in_streams = NULL;
-static int n_in_streams = 0;
 static pthread_mutex_t in_streams_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* Output */
+#define DEEP_BUFFER_CHUNK_MS	80	/* forwarded to the legacy HAL at once */
+#define DEEP_BUFFER_CHUNKS	4
+
+struct deep_buffer {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t data_cond;   /* ring got data, or exit */
+    pthread_cond_t space_cond;  /* ring got room, or exit */
+    uint8_t *ring;
+    size_t size;
+    size_t chunk;
+    size_t rd, wr;              /* free running byte counts */
+    int64_t chunk_ns;
+    uint32_t latency_ms;
+    int exit;
+};
+
 struct wrapper_out_stream {
-    struct audio_stream_out *stream_out;
+    struct audio_stream_out stream_out;
     struct jb_audio_stream_out *jb_stream_out;
-    int in_use;
-    pthread_mutex_t in_use_mutex;
-    pthread_cond_t in_use_cond;
+    uint32_t magic;
+    volatile int32_t users;
+
+    uint32_t sample_rate;
+    size_t frame_size;
+    uint32_t latency_frames;
+
+    /* written by write() only, read under position_seq (odd while updating) */
+    volatile int32_t position_seq;
+    uint64_t frames_written;
+    int64_t write_ns;
+    uint64_t render_base;       /* frames_written when leaving standby */
+    int standby;
+
+    /* get_presentation_position() state */
+    pthread_mutex_t position_lock;
+    uint64_t frames_presented;  /* last reported */
+    int64_t drift_frames;       /* render position minus estimate, smoothed */
+
+    struct wrapper_stream_stats stats;
+
+    /* AUDIO_OUTPUT_FLAG_DEEP_BUFFER streams only */
+    struct deep_buffer *deep;
 };
 
-static struct wrapper_out_stream *out_streams = NULL;
-static int n_out_streams = 0;
 static pthread_mutex_t out_streams_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* HAL */
@@ -73,6 +162,11 @@ static int hal_audio_mode = AUDIO_MODE_NORMAL;
 static pthread_mutex_t in_use_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t in_use_cond = PTHREAD_COND_INITIALIZER;
 
+/* time spent in WAIT_FOR_FREE, updated under in_use_mutex */
+static unsigned int hal_waits = 0;
+static unsigned long long hal_wait_ns = 0;
+static unsigned long long hal_wait_max_ns = 0;
+
 static int alsa_set_mic_mute(bool state);
 
 /* ICS Voice blob */
@@ -81,23 +175,201 @@ static struct audio_hw_device *ics_hw_dev = NULL;
 static void *ics_dso_handle = NULL;
 #endif
 
-#define INCREMENT_IN_USE(in_use) do { pthread_mutex_lock(&(in_use ## _mutex)); \
-                                in_use++; \
-                                pthread_mutex_unlock(&(in_use ## _mutex)); } while(0)
+static inline int64_t wrapper_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Caller holds in_use_mutex */
+static inline void hal_wait_done(int64_t start_ns)
+{
+    unsigned long long ns = wrapper_now_ns() - start_ns;
 
-#define DECREMENT_IN_USE(in_use) do { pthread_mutex_lock(&(in_use ## _mutex)); \
-                                in_use--; \
-                                pthread_cond_signal(&(in_use ## _cond)); \
-                                pthread_mutex_unlock(&(in_use ## _mutex)); } while(0)
+    hal_waits++;
+    hal_wait_ns += ns;
+    if (ns > hal_wait_max_ns)
+        hal_wait_max_ns = ns;
+}
 
-#define WAIT_FOR_FREE(in_use) do { pthread_mutex_lock(&(in_use ## _mutex)); \
+#define WAIT_FOR_FREE(in_use) do { int64_t wait_start = wrapper_now_ns(); \
+                             pthread_mutex_lock(&(in_use ## _mutex)); \
                              while (in_use) { \
                                  pthread_cond_wait(&(in_use ## _cond), &(in_use ## _mutex)); \
-                             } } while(0)
+                             } \
+                             hal_wait_done(wait_start); } while(0)
 
 #define UNLOCK_FREE(in_use) do { pthread_cond_signal(&(in_use ## _cond)); \
                            pthread_mutex_unlock(&(in_use ## _mutex)); } while (0)
 
+static inline void stream_futex_wait(volatile int32_t *addr, int32_t value)
+{
+    syscall(__NR_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static inline void stream_futex_wake(volatile int32_t *addr)
+{
+    syscall(__NR_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* End of a read()/write() */
+static inline void stream_put(volatile int32_t *users)
+{
+    /* the last one out lets a waiting exclusive call in */
+    if (android_atomic_dec(users) == (STREAM_EXCLUSIVE | 1))
+        stream_futex_wake(users);
+}
+
+/*
+ * Start of a read()/write(): one atomic increment unless an exclusive call
+ * runs. Returns how long it waited for that, in ns.
+ */
+static inline int64_t stream_get(volatile int32_t *users)
+{
+    int64_t start_ns = 0;
+    int32_t value;
+
+    while (android_atomic_inc(users) & STREAM_EXCLUSIVE) {
+        stream_put(users);
+        if (!start_ns)
+            start_ns = wrapper_now_ns();
+        while ((value = android_atomic_acquire_load(users)) & STREAM_EXCLUSIVE)
+            stream_futex_wait(users, value);
+    }
+
+    return start_ns ? wrapper_now_ns() - start_ns : 0;
+}
+
+/* Caller holds the in/out_streams_mutex */
+static void stream_lock_exclusive(volatile int32_t *users)
+{
+    int32_t value;
+
+    android_atomic_or(STREAM_EXCLUSIVE, users);
+    while ((value = android_atomic_acquire_load(users)) != STREAM_EXCLUSIVE)
+        stream_futex_wait(users, value);
+}
+
+static void stream_unlock_exclusive(volatile int32_t *users)
+{
+    android_atomic_and(~STREAM_EXCLUSIVE, users);
+    stream_futex_wake(users);
+}
+
+static inline struct wrapper_in_stream *wrapped_in_stream(const void *stream)
+{
+    struct wrapper_in_stream *wrapper_stream = (struct wrapper_in_stream *)stream;
+
+    if (!wrapper_stream || wrapper_stream->magic != WRAPPER_STREAM_MAGIC)
+        return NULL;
+    return wrapper_stream;
+}
+
+static inline struct wrapper_out_stream *wrapped_out_stream(const void *stream)
+{
+    struct wrapper_out_stream *wrapper_stream = (struct wrapper_out_stream *)stream;
+
+    if (!wrapper_stream || wrapper_stream->magic != WRAPPER_STREAM_MAGIC)
+        return NULL;
+    return wrapper_stream;
+}
+
+static void stats_account(struct wrapper_stream_stats *stats, int64_t start_ns,
+                          int64_t end_ns, int64_t blocked_ns, ssize_t bytes)
+{
+    unsigned long long ns = end_ns - start_ns;
+    unsigned long long scaled = ns >> 19;
+    int bucket = 0;
+
+    while (scaled && bucket < STATS_HIST_BUCKETS - 1) {
+        scaled >>= 1;
+        bucket++;
+    }
+    stats->hist[bucket]++;
+    stats->calls++;
+    stats->total_ns += ns;
+    if (ns > stats->max_ns)
+        stats->max_ns = ns;
+    if (bytes > 0)
+        stats->bytes += bytes;
+    if (blocked_ns) {
+        stats->blocked++;
+        stats->blocked_ns += blocked_ns;
+    }
+}
+
+/* One line of "name:value" pairs, usable as a str_parms value */
+static int stats_format(const struct wrapper_stream_stats *stats, char *buf, int size)
+{
+    int len = 0;
+    int i;
+
+#define STATS_PRINT(format, args...) do { \
+        if (len < size) \
+            len += snprintf(buf + len, size - len, format, ##args); \
+    } while (0)
+
+    STATS_PRINT("calls:%u bytes:%llu bytes_per_call:%llu avg_us:%llu max_us:%llu",
+                stats->calls, stats->bytes,
+                stats->calls ? stats->bytes / stats->calls : 0,
+                stats->calls ? stats->total_ns / stats->calls / 1000 : 0,
+                stats->max_ns / 1000);
+    STATS_PRINT(" short:%u resampled:%u blocked:%u blocked_us:%llu",
+                stats->short_calls, stats->resampled, stats->blocked,
+                stats->blocked_ns / 1000);
+    pthread_mutex_lock(&in_use_mutex);
+    STATS_PRINT(" hal_waits:%u hal_wait_us:%llu hal_wait_max_us:%llu",
+                hal_waits, hal_wait_ns / 1000, hal_wait_max_ns / 1000);
+    pthread_mutex_unlock(&in_use_mutex);
+    STATS_PRINT(" hist:");
+    for (i = 0; i < STATS_HIST_BUCKETS; i++)
+        STATS_PRINT("%s%u", i ? "/" : "", stats->hist[i]);
+#undef STATS_PRINT
+
+    return len < size ? len : size - 1;
+}
+
+static void stats_dump(const struct wrapper_stream_stats *stats, const char *direction, int fd)
+{
+    char buf[STATS_REPLY_MAX];
+
+    stats_format(stats, buf, sizeof(buf));
+    dprintf(fd, "      wrapper %s: %s\n", direction, buf);
+}
+
+/* Adds WRAPPER_STATS_KEY to the legacy HAL's reply when it is asked for */
+static char *stats_parameters(const struct wrapper_stream_stats *stats, const char *keys,
+                              char *reply)
+{
+    struct str_parms *query = str_parms_create_str(keys);
+    struct str_parms *parms;
+    char buf[STATS_REPLY_MAX];
+    char *str;
+
+    if (!query)
+        return reply;
+    if (!str_parms_has_key(query, WRAPPER_STATS_KEY)) {
+        str_parms_destroy(query);
+        return reply;
+    }
+    str_parms_destroy(query);
+
+    parms = str_parms_create_str(reply ? reply : "");
+    if (!parms)
+        return reply;
+    stats_format(stats, buf, sizeof(buf));
+    str_parms_add_str(parms, WRAPPER_STATS_KEY, buf);
+    str = str_parms_to_str(parms);
+    str_parms_destroy(parms);
+    if (!str)
+        return reply;
+    free(reply);
+
+    return str;
+}
+
 /* Generic wrappers for streams */
 #define _WRAP_STREAM_LOCKED(name, function, direction, rettype, err, prototype, parameters, log, pre_fn, post_fn) \
     static rettype wrapper_ ## direction ## _ ## name  prototype \
@@ -105,22 +377,20 @@ static void *ics_dso_handle = NULL;
         rettype ret = err; \
         struct jb_audio_stream *jbstream; \
         struct jb_audio_stream_ ## direction *jbstream_ ## direction; \
-        int i; \
+        struct wrapper_ ## direction ## _stream *wrapper_stream; \
     \
         if (log) ALOGI log; \
+        wrapper_stream = wrapped_ ## direction ## _stream(stream); \
+        if (!wrapper_stream) \
+            return ret; \
         pthread_mutex_lock(& direction ## _streams_mutex); \
-        for (i = 0; i < n_ ## direction ## _streams; i++) { \
-            if (direction ## _streams[i].stream_ ## direction == (struct audio_stream_ ## direction*)stream) { \
-                WAIT_FOR_FREE(direction ## _streams[i].in_use); \
-                jbstream = (struct jb_audio_stream *)direction ## _streams[i].jb_stream_ ## direction; \
-                jbstream_ ## direction = direction ## _streams[i].jb_stream_ ## direction; \
-                pre_fn; \
-                ret = jbstream_ ## direction ->function parameters; \
-                post_fn; \
-                UNLOCK_FREE(direction ## _streams[i].in_use); \
-                break; \
-            } \
-        } \
+        stream_lock_exclusive(&wrapper_stream->users); \
+        jbstream = (struct jb_audio_stream *)wrapper_stream->jb_stream_ ## direction; \
+        jbstream_ ## direction = wrapper_stream->jb_stream_ ## direction; \
+        pre_fn; \
+        ret = jbstream_ ## direction ->function parameters; \
+        post_fn; \
+        stream_unlock_exclusive(&wrapper_stream->users); \
         pthread_mutex_unlock(& direction ## _streams_mutex); \
     \
         return ret; \
@@ -203,21 +473,26 @@ static ssize_t wrapper_read(struct audio_stream_in *stream, void* buffer,
                             size_t bytes)
 {
     ssize_t ret = -ENODEV;
-    int i;
-    struct wrapper_in_stream *wrapper_stream = NULL;
-
-    pthread_mutex_lock(&in_streams_mutex);
-    for (i = 0; i < n_in_streams; i++) {
-        if (in_streams[i].stream_in == stream) {
-            wrapper_stream = &(in_streams[i]);
-            INCREMENT_IN_USE(wrapper_stream->in_use);
-            break;
-        }
-    }
-    pthread_mutex_unlock(&in_streams_mutex);
+    struct wrapper_in_stream *wrapper_stream = wrapped_in_stream(stream);
 
     if (wrapper_stream) {
+        int64_t now = wrapper_now_ns();
+        int64_t blocked_ns, gap;
+
+        blocked_ns = stream_get(&wrapper_stream->users);
+        now += blocked_ns;
+        /*
+         * The driver holds buffer_ns of audio; whatever arrived beyond that
+         * since the previous read ended was overwritten.
+         */
+        if (wrapper_stream->read_end_ns) {
+            gap = now - wrapper_stream->read_end_ns - wrapper_stream->buffer_ns;
+            if (gap > 0)
+                android_atomic_add((int32_t)(gap * wrapper_stream->sample_rate / 1000000000LL),
+                                   &wrapper_stream->frames_lost);
+        }
         ret = wrapper_stream->jb_stream_in->read(wrapper_stream->jb_stream_in, buffer, bytes);
+        wrapper_stream->read_end_ns = wrapper_now_ns();
 #if 0
         if ((ret > 0) && (ret != (ssize_t)bytes)) {
             if (wrapper_hal_is_resampling(bytes, ret))
@@ -225,9 +500,12 @@ static ssize_t wrapper_read(struct audio_stream_in *stream, void* buffer,
         }
 #endif
         if (ret != (ssize_t)bytes) {
+            wrapper_stream->stats.short_calls++;
             ALOGE("read %u bytes instead of %u", (unsigned int)ret, (unsigned int)bytes);
         }
-        DECREMENT_IN_USE(wrapper_stream->in_use);
+        stats_account(&wrapper_stream->stats, now, wrapper_stream->read_end_ns,
+                      blocked_ns, ret);
+        stream_put(&wrapper_stream->users);
     } else {
             ALOGE("read on non-wrapped stream!");
     }
@@ -238,8 +516,8 @@ static ssize_t wrapper_read(struct audio_stream_in *stream, void* buffer,
 WRAP_STREAM_LOCKED(set_gain, in, int, -ENODEV, (struct audio_stream_in *stream, float gain),
             (jbstream_in, gain), ("in_set_gain: %f", gain))
 
-WRAP_STREAM_LOCKED_COMMON(standby, in, int, -ENODEV, (struct audio_stream *stream),
-            (jbstream), ("in_standby"))
+WRAP_STREAM_LOCKED_COMMON_FN(standby, in, int, -ENODEV, (struct audio_stream *stream),
+            (jbstream), ("in_standby"), do{}while(0), do{wrapper_stream->read_end_ns = 0;}while(0))
 
 WRAP_STREAM_LOCKED_COMMON_FN(set_parameters, in, int, -ENODEV, (struct audio_stream *stream, const char *kv_pairs),
             (jbstream, kv_pairs), ("in_set_parameters: %s", kv_pairs), do{}while(0), do{if (ret) {ALOGI("ret: %d", ret);}}while(0))
@@ -262,8 +540,8 @@ WRAP_STREAM_LOCKED_COMMON(get_format, in, audio_format_t, 0, (const struct audio
 WRAP_STREAM_LOCKED_COMMON(set_format, in, int, -ENODEV, (struct audio_stream *stream, audio_format_t format),
             (jbstream, format), ("in_set_format: %u", format))
 
-WRAP_STREAM_LOCKED_COMMON(dump, in, int, -ENODEV, (const struct audio_stream *stream, int fd),
-            (jbstream, fd), ("in_dump: %d", fd))
+WRAP_STREAM_LOCKED_COMMON_FN(dump, in, int, -ENODEV, (const struct audio_stream *stream, int fd),
+            (jbstream, fd), ("in_dump: %d", fd), do{}while(0), stats_dump(&wrapper_stream->stats, "in", fd))
 
 WRAP_STREAM_LOCKED_COMMON(get_device, in, audio_devices_t, 0, (const struct audio_stream *stream),
             (jbstream), ("in_get_device"))
@@ -271,8 +549,9 @@ WRAP_STREAM_LOCKED_COMMON(get_device, in, audio_devices_t, 0, (const struct audi
 WRAP_STREAM_LOCKED_COMMON(set_device, in, int, -ENODEV, (struct audio_stream *stream, audio_devices_t device),
             (jbstream, device), ("in_set_device: %d", device))
 
-WRAP_STREAM_LOCKED_COMMON(get_parameters, in, char*, NULL, (const struct audio_stream *stream, const char *keys),
-            (jbstream, keys), ("in_get_parameters: %s", keys))
+WRAP_STREAM_LOCKED_COMMON_FN(get_parameters, in, char*, NULL, (const struct audio_stream *stream, const char *keys),
+            (jbstream, keys), ("in_get_parameters: %s", keys), do{}while(0),
+            ret = stats_parameters(&wrapper_stream->stats, keys, ret))
 
 WRAP_STREAM_LOCKED_COMMON(add_audio_effect, in, int, -ENODEV, (const struct audio_stream *stream, effect_handle_t effect),
             (jbstream, effect), ("in_add_audio_effect"))
@@ -283,27 +562,16 @@ WRAP_STREAM_LOCKED_COMMON(remove_audio_effect, in, int, -ENODEV, (const struct a
 static void wrapper_close_input_stream(unused_audio_hw_device *dev,
                                        struct audio_stream_in *stream_in)
 {
+    struct wrapper_in_stream *wrapper_stream = wrapped_in_stream(stream_in);
     struct jb_audio_stream_in *jb_stream_in = NULL;
-    int i;
 
     pthread_mutex_lock(&in_streams_mutex);
-    for (i = 0; i < n_in_streams; i++) {
-        if (in_streams[i].stream_in == stream_in) {
-            WAIT_FOR_FREE(in_streams[i].in_use);
-            UNLOCK_FREE(in_streams[i].in_use);
-            jb_stream_in = in_streams[i].jb_stream_in;
-            free(in_streams[i].stream_in);
-            pthread_mutex_destroy(&(in_streams[i].in_use_mutex));
-            pthread_cond_destroy(&(in_streams[i].in_use_cond));
-            n_in_streams--;
-            memmove(in_streams + i,
-                    in_streams + i + 1,
-                    sizeof(struct wrapper_in_stream) * (n_in_streams - i));
-            in_streams = realloc(in_streams,
-                                  sizeof(struct wrapper_in_stream) * n_in_streams);
-            ALOGI("Closed wrapped input stream");
-            break;
-        }
+    if (wrapper_stream) {
+        stream_lock_exclusive(&wrapper_stream->users);
+        jb_stream_in = wrapper_stream->jb_stream_in;
+        wrapper_stream->magic = 0;
+        free(wrapper_stream);
+        ALOGI("Closed wrapped input stream");
     }
     if (jb_stream_in) {
         WAIT_FOR_FREE(in_use);
@@ -314,9 +582,28 @@ static void wrapper_close_input_stream(unused_audio_hw_device *dev,
     pthread_mutex_unlock(&in_streams_mutex);
 }
 
-uint32_t wrapper_get_input_frames_lost(__attribute__((unused))struct audio_stream_in *stream)
+/*
+ * Frames the legacy HAL reports as lost, or else what wrapper_read() saw
+ * go by between two reads. Both counters restart on every call.
+ */
+static uint32_t wrapper_get_input_frames_lost(struct audio_stream_in *stream)
 {
+    struct wrapper_in_stream *wrapper_stream = wrapped_in_stream(stream);
+    struct jb_audio_stream_in *jb_stream_in;
+    uint32_t lost = 0;
+    uint32_t estimated;
+
+    if (!wrapper_stream)
         return 0;
+
+    stream_get(&wrapper_stream->users);
+    jb_stream_in = wrapper_stream->jb_stream_in;
+    if (jb_stream_in->get_input_frames_lost)
+        lost = jb_stream_in->get_input_frames_lost(jb_stream_in);
+    estimated = android_atomic_and(0, &wrapper_stream->frames_lost);
+    stream_put(&wrapper_stream->users);
+
+    return lost ? lost : estimated;
 }
 
 static int wrapper_open_input_stream(unused_audio_hw_device *dev,
@@ -349,27 +636,20 @@ static int wrapper_open_input_stream(unused_audio_hw_device *dev,
     UNLOCK_FREE(in_use);
 
     if (ret == 0) {
-        struct wrapper_in_stream *new_in_streams;
+        struct wrapper_in_stream *wrapper_stream;
+        size_t frame_size;
 
-        new_in_streams = realloc(in_streams,
-                              sizeof(struct wrapper_in_stream) * (n_in_streams + 1));
-        if (!new_in_streams) {
-            ALOGE("Can't allocate memory for wrapped stream, not touching original!");
-            pthread_mutex_unlock(&in_streams_mutex);
-            return -ENOMEM;
-        }
-        in_streams = new_in_streams;
-        memset(&in_streams[n_in_streams], 0, sizeof(struct wrapper_in_stream));
-
-        in_streams[n_in_streams].jb_stream_in = jb_stream_in;
-        in_streams[n_in_streams].stream_in = malloc(sizeof(struct audio_stream_in));
-        if (!in_streams[n_in_streams].stream_in) {
+        wrapper_stream = calloc(1, sizeof(struct wrapper_in_stream));
+        if (!wrapper_stream) {
             ALOGE("Can't allocate memory for stream_in!");
+            WAIT_FOR_FREE(in_use);
+            jb_hw_dev->close_input_stream(jb_hw_dev, jb_stream_in);
+            UNLOCK_FREE(in_use);
             pthread_mutex_unlock(&in_streams_mutex);
             return -ENOMEM;
         }
-        memset(in_streams[n_in_streams].stream_in, 0, sizeof(struct audio_stream_in));
-        *stream_in = in_streams[n_in_streams].stream_in;
+        wrapper_stream->jb_stream_in = jb_stream_in;
+        *stream_in = &wrapper_stream->stream_in;
 
         (*stream_in)->common.get_sample_rate = wrapper_in_get_sample_rate;
         (*stream_in)->common.set_sample_rate = wrapper_in_set_sample_rate;
@@ -390,14 +670,19 @@ static int wrapper_open_input_stream(unused_audio_hw_device *dev,
         (*stream_in)->read = wrapper_read;
         (*stream_in)->get_input_frames_lost = wrapper_get_input_frames_lost;
 
-        in_streams[n_in_streams].in_use = 0;
-        pthread_mutex_init(&(in_streams[n_in_streams].in_use_mutex), NULL);
-        pthread_cond_init(&(in_streams[n_in_streams].in_use_cond), NULL);
+        frame_size = audio_bytes_per_sample(config->format) *
+                     audio_channel_count_from_in_mask(config->channel_mask);
+        wrapper_stream->sample_rate = config->sample_rate;
+        if (frame_size && config->sample_rate)
+            wrapper_stream->buffer_ns = (int64_t)jb_stream_in->common.get_buffer_size(
+                    (struct jb_audio_stream *)jb_stream_in) / frame_size *
+                    IN_BUFFER_PERIODS * 1000000000LL / config->sample_rate;
+
+        wrapper_stream->users = 0;
+        wrapper_stream->magic = WRAPPER_STREAM_MAGIC;
 
         ALOGI("Wrapped an input stream: rate %d, channel_mask: %x, format: %d, addr: %p/%p",
               config->sample_rate, config->channel_mask, config->format, *stream_in, jb_stream_in);
-
-        n_in_streams++;
     }
     pthread_mutex_unlock(&in_streams_mutex);
 
@@ -406,32 +691,241 @@ static int wrapper_open_input_stream(unused_audio_hw_device *dev,
 
 /* Output stream */
 
-static int wrapper_write(struct audio_stream_out *stream, const void* buffer,
-                         size_t bytes)
+/* Hands audio to the legacy HAL, the caller holds a users reference */
+static ssize_t out_write(struct wrapper_out_stream *wrapper_stream, const void *buffer,
+                         size_t bytes, int64_t *end_ns)
 {
-    int ret = -ENODEV;
-    int i;
-    struct wrapper_out_stream *wrapper_stream = NULL;
     size_t written;
+    ssize_t ret;
+
+    written = wrapper_stream->jb_stream_out->write(wrapper_stream->jb_stream_out, buffer, bytes);
+    *end_ns = wrapper_now_ns();
+    ret = written;
+    if ((ret > 0) && (written != bytes)) {
+        if (wrapper_hal_is_resampling(bytes, written)) {
+            wrapper_stream->stats.resampled++;
+            ret = bytes;
+        } else {
+            wrapper_stream->stats.short_calls++;
+        }
+    }
+    if (ret > 0 && wrapper_stream->frame_size) {
+        /* only writer of these, so a sequence count is enough */
+        android_atomic_inc(&wrapper_stream->position_seq);
+        if (wrapper_stream->standby) {
+            wrapper_stream->render_base = wrapper_stream->frames_written;
+            wrapper_stream->standby = 0;
+        }
+        wrapper_stream->frames_written += ret / wrapper_stream->frame_size;
+        wrapper_stream->write_ns = *end_ns;
+        android_atomic_inc(&wrapper_stream->position_seq);
+    }
 
-    pthread_mutex_lock(&out_streams_mutex);
-    for (i = 0; i < n_out_streams; i++) {
-        if (out_streams[i].stream_out == stream) {
-            wrapper_stream = &(out_streams[i]);
-            INCREMENT_IN_USE(wrapper_stream->in_use);
-            break;
+    return ret;
+}
+
+/*
+ * Deep buffer outputs: write() only fills a ring of DEEP_BUFFER_CHUNKS
+ * chunks, and a thread forwards it to the legacy HAL one chunk of
+ * DEEP_BUFFER_CHUNK_MS at a time. AudioFlinger mixes a whole chunk per
+ * write and the CPU sleeps in between.
+ */
+
+/* Caller holds deep->lock */
+static int deep_buffer_wait(struct deep_buffer *deep, int64_t timeout_ns)
+{
+    struct timespec ts;
+    int64_t deadline = wrapper_now_ns() + timeout_ns;
+
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+    return pthread_cond_timedwait(&deep->data_cond, &deep->lock, &ts);
+}
+
+static void *deep_buffer_thread(void *arg)
+{
+    struct wrapper_out_stream *wrapper_stream = arg;
+    struct deep_buffer *deep = wrapper_stream->deep;
+    size_t avail, offset, bytes;
+    int64_t end_ns;
+    ssize_t ret;
+
+    setpriority(PRIO_PROCESS, 0, ANDROID_PRIORITY_AUDIO);
+    prctl(PR_SET_NAME, (unsigned long)"wrapper_deep", 0, 0, 0);
+
+    pthread_mutex_lock(&deep->lock);
+    while (!deep->exit) {
+        avail = deep->wr - deep->rd;
+        if (!avail) {
+            pthread_cond_wait(&deep->data_cond, &deep->lock);
+            continue;
         }
+        /* a short tail goes out once write() has been quiet for a chunk */
+        if (avail < deep->chunk && deep_buffer_wait(deep, deep->chunk_ns) != ETIMEDOUT)
+            continue;
+        pthread_mutex_unlock(&deep->lock);
+
+        /* not under deep->lock, standby flushes the ring with users locked */
+        stream_get(&wrapper_stream->users);
+        pthread_mutex_lock(&deep->lock);
+        offset = deep->rd % deep->size;
+        bytes = deep->wr - deep->rd;
+        if (bytes > deep->chunk)
+            bytes = deep->chunk;
+        if (bytes > deep->size - offset)
+            bytes = deep->size - offset;
+        pthread_mutex_unlock(&deep->lock);
+
+        ret = bytes ? out_write(wrapper_stream, deep->ring + offset, bytes, &end_ns) : 0;
+        if (ret > 0 && (size_t)ret < bytes)
+            bytes = ret;
+
+        /*
+         * Still holding users: once they are dropped, standby may flush
+         * the ring, and rd must not move past wr after that.
+         */
+        pthread_mutex_lock(&deep->lock);
+        deep->rd += bytes;
+        pthread_cond_signal(&deep->space_cond);
+        pthread_mutex_unlock(&deep->lock);
+        stream_put(&wrapper_stream->users);
+
+        if (ret < 0) {
+            /* drop it, at the pace it would have played */
+            ALOGE("deep buffer write failed: %d", (int)ret);
+            usleep(deep->chunk_ns / 1000);
+        }
+
+        pthread_mutex_lock(&deep->lock);
     }
-    pthread_mutex_unlock(&out_streams_mutex);
+    pthread_mutex_unlock(&deep->lock);
+
+    return NULL;
+}
+
+static ssize_t deep_buffer_write(struct deep_buffer *deep, const void *buffer, size_t bytes)
+{
+    const uint8_t *src = buffer;
+    size_t done = 0;
+    size_t offset, count;
+
+    pthread_mutex_lock(&deep->lock);
+    while (done < bytes && !deep->exit) {
+        count = deep->size - (deep->wr - deep->rd);
+        if (!count) {
+            pthread_cond_wait(&deep->space_cond, &deep->lock);
+            continue;
+        }
+        offset = deep->wr % deep->size;
+        if (count > deep->size - offset)
+            count = deep->size - offset;
+        if (count > bytes - done)
+            count = bytes - done;
+        /* the thread never reads past wr */
+        pthread_mutex_unlock(&deep->lock);
+        memcpy(deep->ring + offset, src + done, count);
+        pthread_mutex_lock(&deep->lock);
+        deep->wr += count;
+        done += count;
+        pthread_cond_signal(&deep->data_cond);
+    }
+    pthread_mutex_unlock(&deep->lock);
+
+    return done ? (ssize_t)done : -ENODEV;
+}
+
+/* Drops what was not forwarded yet, with users locked */
+static void deep_buffer_flush(struct deep_buffer *deep)
+{
+    if (!deep)
+        return;
+    pthread_mutex_lock(&deep->lock);
+    deep->rd = deep->wr;
+    pthread_cond_signal(&deep->space_cond);
+    pthread_mutex_unlock(&deep->lock);
+}
+
+static int deep_buffer_start(struct wrapper_out_stream *wrapper_stream)
+{
+    struct deep_buffer *deep;
+    pthread_condattr_t attr;
+    size_t chunk_frames = wrapper_stream->sample_rate * DEEP_BUFFER_CHUNK_MS / 1000;
+
+    deep = calloc(1, sizeof(struct deep_buffer));
+    if (!deep)
+        return -ENOMEM;
+    deep->chunk = chunk_frames * wrapper_stream->frame_size;
+    deep->size = deep->chunk * DEEP_BUFFER_CHUNKS;
+    deep->chunk_ns = (int64_t)chunk_frames * 1000000000LL / wrapper_stream->sample_rate;
+    deep->latency_ms = DEEP_BUFFER_CHUNK_MS * DEEP_BUFFER_CHUNKS;
+    deep->ring = malloc(deep->size);
+    if (!deep->ring) {
+        free(deep);
+        return -ENOMEM;
+    }
+    pthread_mutex_init(&deep->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&deep->data_cond, &attr);
+    pthread_cond_init(&deep->space_cond, NULL);
+    pthread_condattr_destroy(&attr);
+
+    wrapper_stream->deep = deep;
+    if (pthread_create(&deep->thread, NULL, deep_buffer_thread, wrapper_stream)) {
+        ALOGE("Can't start the deep buffer thread");
+        wrapper_stream->deep = NULL;
+        pthread_cond_destroy(&deep->space_cond);
+        pthread_cond_destroy(&deep->data_cond);
+        pthread_mutex_destroy(&deep->lock);
+        free(deep->ring);
+        free(deep);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/* Not with users locked, the thread may be waiting for a reference */
+static void deep_buffer_stop(struct wrapper_out_stream *wrapper_stream)
+{
+    struct deep_buffer *deep = wrapper_stream->deep;
+
+    if (!deep)
+        return;
+    pthread_mutex_lock(&deep->lock);
+    deep->exit = 1;
+    pthread_cond_signal(&deep->data_cond);
+    pthread_cond_signal(&deep->space_cond);
+    pthread_mutex_unlock(&deep->lock);
+    pthread_join(deep->thread, NULL);
+
+    wrapper_stream->deep = NULL;
+    pthread_cond_destroy(&deep->space_cond);
+    pthread_cond_destroy(&deep->data_cond);
+    pthread_mutex_destroy(&deep->lock);
+    free(deep->ring);
+    free(deep);
+}
+
+static ssize_t wrapper_write(struct audio_stream_out *stream, const void* buffer,
+                             size_t bytes)
+{
+    ssize_t ret = -ENODEV;
+    struct wrapper_out_stream *wrapper_stream = wrapped_out_stream(stream);
+    int64_t start_ns, end_ns, blocked_ns = 0;
 
     if (wrapper_stream) {
-        written = wrapper_stream->jb_stream_out->write(wrapper_stream->jb_stream_out, buffer, bytes);
-        ret = written;
-        if ((ret > 0) && (written != bytes)) {
-            if (wrapper_hal_is_resampling(bytes, written))
-                ret = bytes;
+        start_ns = wrapper_now_ns();
+        if (wrapper_stream->deep) {
+            /* only the ring, the thread takes the reference for the HAL */
+            ret = deep_buffer_write(wrapper_stream->deep, buffer, bytes);
+            end_ns = wrapper_now_ns();
+        } else {
+            blocked_ns = stream_get(&wrapper_stream->users);
+            ret = out_write(wrapper_stream, buffer, bytes, &end_ns);
+            stream_put(&wrapper_stream->users);
         }
-        DECREMENT_IN_USE(wrapper_stream->in_use);
+        stats_account(&wrapper_stream->stats, start_ns + blocked_ns, end_ns, blocked_ns, ret);
     } else {
             ALOGE("write on non-wrapped stream!");
     }
@@ -442,8 +936,10 @@ static int wrapper_write(struct audio_stream_out *stream, const void* buffer,
 WRAP_STREAM_LOCKED(set_volume, out, int, -ENODEV, (struct audio_stream_out *stream, float left, float right),
             (jbstream_out, left, right), ("set_out_volume: %f/%f", left, right))
 
-WRAP_STREAM_LOCKED_COMMON(standby, out, int, -ENODEV, (struct audio_stream *stream),
-            (jbstream), ("out_standby"))
+/* the legacy render position restarts from 0 after standby */
+WRAP_STREAM_LOCKED_COMMON_FN(standby, out, int, -ENODEV, (struct audio_stream *stream),
+            (jbstream), ("out_standby"), deep_buffer_flush(wrapper_stream->deep),
+            do{wrapper_stream->standby = 1;}while(0))
 
 static void restore_mute(void)
 {
@@ -462,8 +958,9 @@ WRAP_STREAM_LOCKED_COMMON(get_sample_rate, out, uint32_t, 0, (const struct audio
 WRAP_STREAM_LOCKED_COMMON(set_sample_rate, out, int, -ENODEV, (struct audio_stream *stream, uint32_t rate),
             (jbstream, rate), ("out_set_sample_rate: %u", rate))
 
-WRAP_STREAM_LOCKED_COMMON(get_buffer_size, out, size_t, 0, (const struct audio_stream *stream),
-            (jbstream), ("out_get_buffer_size"))
+WRAP_STREAM_LOCKED_COMMON_FN(get_buffer_size, out, size_t, 0, (const struct audio_stream *stream),
+            (jbstream), ("out_get_buffer_size"), do{}while(0),
+            do{if (wrapper_stream->deep) {ret = wrapper_stream->deep->chunk;}}while(0))
 
 WRAP_STREAM_LOCKED_COMMON(get_channels, out, audio_channel_mask_t, 0, (const struct audio_stream *stream),
             (jbstream), ("out_get_channels"))
@@ -474,8 +971,8 @@ WRAP_STREAM_LOCKED_COMMON(get_format, out, audio_format_t, 0, (const struct audi
 WRAP_STREAM_LOCKED_COMMON(set_format, out, int, -ENODEV, (struct audio_stream *stream, audio_format_t format),
             (jbstream, format), ("out_set_format: %u", format))
 
-WRAP_STREAM_LOCKED_COMMON(dump, out, int, -ENODEV, (const struct audio_stream *stream, int fd),
-            (jbstream, fd), ("out_dump: %d", fd))
+WRAP_STREAM_LOCKED_COMMON_FN(dump, out, int, -ENODEV, (const struct audio_stream *stream, int fd),
+            (jbstream, fd), ("out_dump: %d", fd), do{}while(0), stats_dump(&wrapper_stream->stats, "out", fd))
 
 WRAP_STREAM_LOCKED_COMMON(get_device, out, audio_devices_t, 0, (const struct audio_stream *stream),
             (jbstream), ("out_get_device"))
@@ -483,8 +980,9 @@ WRAP_STREAM_LOCKED_COMMON(get_device, out, audio_devices_t, 0, (const struct aud
 WRAP_STREAM_LOCKED_COMMON(set_device, out, int, -ENODEV, (struct audio_stream *stream, audio_devices_t device),
             (jbstream, device), ("out_set_device: %d", device))
 
-WRAP_STREAM_LOCKED_COMMON(get_parameters, out, char*, NULL, (const struct audio_stream *stream, const char *keys),
-            (jbstream, keys), ("out_get_parameters: %s", keys))
+WRAP_STREAM_LOCKED_COMMON_FN(get_parameters, out, char*, NULL, (const struct audio_stream *stream, const char *keys),
+            (jbstream, keys), ("out_get_parameters: %s", keys), do{}while(0),
+            ret = stats_parameters(&wrapper_stream->stats, keys, ret))
 
 WRAP_STREAM_LOCKED_COMMON(add_audio_effect, out, int, -ENODEV, (const struct audio_stream *stream, effect_handle_t effect),
             (jbstream, effect), ("out_add_audio_effect"))
@@ -492,8 +990,9 @@ WRAP_STREAM_LOCKED_COMMON(add_audio_effect, out, int, -ENODEV, (const struct aud
 WRAP_STREAM_LOCKED_COMMON(remove_audio_effect, out, int, -ENODEV, (const struct audio_stream *stream, effect_handle_t effect),
             (jbstream, effect), ("out_remove_audio_effect"))
 
-WRAP_STREAM_LOCKED(get_latency, out, uint32_t, 0, (const struct audio_stream_out *stream),
-            (jbstream_out), ("out_get_latency"))
+WRAP_STREAM_LOCKED_FN(get_latency, out, uint32_t, 0, (const struct audio_stream_out *stream),
+            (jbstream_out), ("out_get_latency"), do{}while(0),
+            do{if (wrapper_stream->deep) {ret += wrapper_stream->deep->latency_ms;}}while(0))
 
 WRAP_STREAM_LOCKED(get_render_position, out, int, -ENODEV, (const struct audio_stream_out *stream, uint32_t *dsp_frames),
             (jbstream_out, dsp_frames), ("out_get_render_position"))
@@ -501,36 +1000,85 @@ WRAP_STREAM_LOCKED(get_render_position, out, int, -ENODEV, (const struct audio_s
 WRAP_STREAM_LOCKED(get_next_write_timestamp, out, int, -ENODEV, (const struct audio_stream_out *stream, int64_t *timestamp),
             (jbstream_out, timestamp), NULL)
 
-int wrapper_get_presentation_position(__attribute__((unused)) const struct audio_stream_out *stream,
-                __attribute__((unused)) uint64_t *frames, __attribute__((unused)) struct timespec *timestamp)
+/*
+ * The legacy HAL has no presentation position, so it is estimated from what
+ * write() recorded: the last written frame leaves the speaker latency_frames
+ * after the write returned, and playback moves on at sample_rate from there.
+ * When the legacy HAL reports a render position, the difference to that
+ * estimate is smoothed in as drift. The result never goes backwards and
+ * never gets ahead of what was written.
+ */
+static int wrapper_get_presentation_position(const struct audio_stream_out *stream,
+                uint64_t *frames, struct timespec *timestamp)
 {
-        return -1;
+    struct wrapper_out_stream *wrapper_stream = wrapped_out_stream(stream);
+    struct jb_audio_stream_out *jb_stream_out;
+    uint64_t written, render_base, presented;
+    int64_t write_ns, now_ns, estimate;
+    uint32_t dsp_frames;
+    int32_t seq;
+
+    if (!wrapper_stream || !wrapper_stream->sample_rate)
+        return -ENODEV;
+
+    do {
+        seq = android_atomic_acquire_load(&wrapper_stream->position_seq);
+        written = wrapper_stream->frames_written;
+        write_ns = wrapper_stream->write_ns;
+        render_base = wrapper_stream->render_base;
+    } while ((seq & 1) || android_atomic_release_load(&wrapper_stream->position_seq) != seq);
+
+    if (!written)
+        return -ENODATA;
+
+    now_ns = wrapper_now_ns();
+    estimate = (int64_t)written - wrapper_stream->latency_frames +
+               (now_ns - write_ns) * wrapper_stream->sample_rate / 1000000000LL;
+
+    pthread_mutex_lock(&wrapper_stream->position_lock);
+    stream_get(&wrapper_stream->users);
+    jb_stream_out = wrapper_stream->jb_stream_out;
+    if (jb_stream_out->get_render_position &&
+        jb_stream_out->get_render_position(jb_stream_out, &dsp_frames) == 0) {
+        int64_t error = (int64_t)(render_base + dsp_frames) - estimate;
+
+        wrapper_stream->drift_frames += (error - wrapper_stream->drift_frames) / 8;
+        estimate += wrapper_stream->drift_frames;
+    }
+    stream_put(&wrapper_stream->users);
+
+    presented = estimate > 0 ? (uint64_t)estimate : 0;
+    if (presented > written)
+        presented = written;
+    if (presented < wrapper_stream->frames_presented)
+        presented = wrapper_stream->frames_presented;
+    wrapper_stream->frames_presented = presented;
+    pthread_mutex_unlock(&wrapper_stream->position_lock);
+
+    *frames = presented;
+    timestamp->tv_sec = now_ns / 1000000000LL;
+    timestamp->tv_nsec = now_ns % 1000000000LL;
+
+    return 0;
 }
 
 static void wrapper_close_output_stream(unused_audio_hw_device *dev,
                             struct audio_stream_out* stream_out)
 {
+    struct wrapper_out_stream *wrapper_stream = wrapped_out_stream(stream_out);
     struct jb_audio_stream_out *jb_stream_out = NULL;
-    int i;
+
+    if (wrapper_stream)
+        deep_buffer_stop(wrapper_stream);
 
     pthread_mutex_lock(&out_streams_mutex);
-    for (i = 0; i < n_out_streams; i++) {
-        if (out_streams[i].stream_out == stream_out) {
-            WAIT_FOR_FREE(out_streams[i].in_use);
-            UNLOCK_FREE(out_streams[i].in_use);
-            jb_stream_out = out_streams[i].jb_stream_out;
-            free(out_streams[i].stream_out);
-            pthread_mutex_destroy(&(out_streams[i].in_use_mutex));
-            pthread_cond_destroy(&(out_streams[i].in_use_cond));
-            n_out_streams--;
-            memmove(out_streams + i,
-                    out_streams + i + 1,
-                    sizeof(struct wrapper_out_stream) * (n_out_streams - i));
-            out_streams = realloc(out_streams,
-                                  sizeof(struct wrapper_out_stream) * n_out_streams);
-            ALOGI("Closed wrapped output stream");
-            break;
-        }
+    if (wrapper_stream) {
+        stream_lock_exclusive(&wrapper_stream->users);
+        jb_stream_out = wrapper_stream->jb_stream_out;
+        wrapper_stream->magic = 0;
+        pthread_mutex_destroy(&wrapper_stream->position_lock);
+        free(wrapper_stream);
+        ALOGI("Closed wrapped output stream");
     }
 
     if (jb_stream_out) {
@@ -553,35 +1101,40 @@ static int wrapper_open_output_stream(unused_audio_hw_device *dev,
     struct jb_audio_stream_out *jb_stream_out;
     int ret;
 
+#ifndef WRAPPER_DEEP_BUFFER
+    /*
+     * A deep buffer output is a second legacy output open next to the
+     * primary one, which not every legacy HAL copes with. Such builds
+     * install the audio_policy.conf without the deep_buffer profile; a
+     * conf that still lists it gets the primary output instead.
+     */
+    if (flags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER)
+        return -ENOSYS;
+#endif
+
     pthread_mutex_lock(&out_streams_mutex);
 
+    /* the legacy HAL sees a normal output, the batching happens here */
     WAIT_FOR_FREE(in_use);
     ret = jb_hw_dev->open_output_stream(jb_hw_dev, handle, devices,
-                                          flags, config, &jb_stream_out);
+                                          flags & ~AUDIO_OUTPUT_FLAG_DEEP_BUFFER,
+                                          config, &jb_stream_out);
     UNLOCK_FREE(in_use);
 
     if (ret == 0) {
-        struct wrapper_out_stream *new_out_streams;
-
-        new_out_streams = realloc(out_streams,
-                              sizeof(struct wrapper_out_stream) * (n_out_streams + 1));
-        if (!new_out_streams) {
-            ALOGE("Can't allocate memory for wrapped stream, not touching original!");
-            pthread_mutex_unlock(&out_streams_mutex);
-            return -ENOMEM;
-        }
-        out_streams = new_out_streams;
-        memset(&out_streams[n_out_streams], 0, sizeof(struct wrapper_out_stream));
+        struct wrapper_out_stream *wrapper_stream;
 
-        out_streams[n_out_streams].jb_stream_out = jb_stream_out;
-        out_streams[n_out_streams].stream_out = malloc(sizeof(struct audio_stream_out));
-        if (!out_streams[n_out_streams].stream_out) {
+        wrapper_stream = calloc(1, sizeof(struct wrapper_out_stream));
+        if (!wrapper_stream) {
             ALOGE("Can't allocate memory for stream_out!");
+            WAIT_FOR_FREE(in_use);
+            jb_hw_dev->close_output_stream(jb_hw_dev, jb_stream_out);
+            UNLOCK_FREE(in_use);
             pthread_mutex_unlock(&out_streams_mutex);
             return -ENOMEM;
         }
-        memset(out_streams[n_out_streams].stream_out, 0, sizeof(struct audio_stream_out));
-        *stream_out = out_streams[n_out_streams].stream_out;
+        wrapper_stream->jb_stream_out = jb_stream_out;
+        *stream_out = &wrapper_stream->stream_out;
 
         (*stream_out)->common.get_sample_rate = wrapper_out_get_sample_rate;
         (*stream_out)->common.set_sample_rate = wrapper_out_set_sample_rate;
@@ -610,14 +1163,22 @@ static int wrapper_open_output_stream(unused_audio_hw_device *dev,
         (*stream_out)->flush = NULL;
         (*stream_out)->get_presentation_position = wrapper_get_presentation_position;
 
-        out_streams[n_out_streams].in_use = 0;
-        pthread_mutex_init(&(out_streams[n_out_streams].in_use_mutex), NULL);
-        pthread_cond_init(&(out_streams[n_out_streams].in_use_cond), NULL);
+        wrapper_stream->sample_rate = config->sample_rate;
+        wrapper_stream->frame_size = audio_bytes_per_sample(config->format) *
+                                     audio_channel_count_from_out_mask(config->channel_mask);
+        wrapper_stream->latency_frames = (uint64_t)jb_stream_out->get_latency(jb_stream_out) *
+                                         config->sample_rate / 1000;
+        pthread_mutex_init(&wrapper_stream->position_lock, NULL);
 
-        ALOGI("Wrapped an output stream: rate %d, channel_mask: %x, format: %d, addr: %p/%p",
-              config->sample_rate, config->channel_mask, config->format, *stream_out, jb_stream_out);
+        wrapper_stream->users = 0;
+        wrapper_stream->magic = WRAPPER_STREAM_MAGIC;
 
-        n_out_streams++;
+        if ((flags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER) && wrapper_stream->frame_size &&
+            wrapper_stream->sample_rate && deep_buffer_start(wrapper_stream))
+            ALOGE("No deep buffer, writing through");
+
+        ALOGI("Wrapped an output stream: rate %d, channel_mask: %x, format: %d, flags: %x, addr: %p/%p",
+              config->sample_rate, config->channel_mask, config->format, flags, *stream_out, jb_stream_out);
     }
     pthread_mutex_unlock(&out_streams_mutex);
 
@@ -796,18 +1357,6 @@ static int wrapper_close(hw_device_t *device)
     free(jb_hw_dev);
     jb_hw_dev = NULL;
 
-    if (out_streams) {
-        free(out_streams);
-        out_streams = NULL;
-        n_out_streams = 0;
-    }
-
-    if (in_streams) {
-        free(in_streams);
-        in_streams = NULL;
-        n_in_streams = 0;
-    }
-
 #ifdef ICS_VOICE_BLOB
     ics_hw_dev->common.close((hw_device_t*)ics_hw_dev);
     ics_hw_dev = NULL;
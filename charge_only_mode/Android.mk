@@ -36,3 +36,26 @@ LOCAL_MODULE:= charge_only_mode
 LOCAL_FORCE_STATIC_EXECUTABLE:= true
 
 include $(BUILD_EXECUTABLE)
+
+#########################
+
+# Check of the blend and flip_32 against the original routines; see draw_check.c.
+# Built for the host, and for the target where the NEON paths exist.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := draw_check.c screen.c
+LOCAL_C_INCLUDES := external/zlib $(LOCAL_PATH)/assets
+LOCAL_STATIC_LIBRARIES := libz libcutils liblog
+LOCAL_MODULE := charge_only_mode_draw_check
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := draw_check.c screen.c
+LOCAL_C_INCLUDES := external/zlib $(LOCAL_PATH)/assets
+LOCAL_STATIC_LIBRARIES := libz libcutils libc liblog
+LOCAL_MODULE := charge_only_mode_draw_check
+LOCAL_MODULE_TAGS := optional
+LOCAL_FORCE_STATIC_EXECUTABLE := true
+include $(BUILD_EXECUTABLE)
@@ -26,6 +26,9 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <zlib.h>
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 #define LOG_TAG "CHARGE_ONLY_MODE"
 #include <cutils/log.h>
 
@@ -35,6 +38,16 @@ struct asset {
 	const unsigned char *gz;
 	int gzlen;
 	unsigned short *bits;
+	unsigned short *premul;
+	unsigned short *delta;
+};
+
+/* An animation keeps its first frame and, for the others, only the
+   pixels they change. bits holds frames[current] once composed. */
+struct anim {
+	struct asset **frames;
+	unsigned short *bits;
+	int current;
 };
 
 #include "battery_charge_background.h"
@@ -92,12 +105,64 @@ static struct asset *battery_numbers_i[] = {
 
 #include "draw.h"
 
-#define load_asset(a) __load_asset((a),(a)->h,0)
-static int __load_asset(struct asset *a, int canvas_h, int y0)
+static struct anim battery_green_anim = { battery_green_ani, NULL, -1 };
+static struct anim battery_orange_anim = { battery_orange_ani, NULL, -1 };
+static struct anim battery_red_anim = { battery_red_ani, NULL, -1 };
+
+/* Everything draw() may decode, so it can all be dropped again */
+static struct asset *all_assets[] = {
+	&battery_charge_background,
+	&battery_green_img,
+	&battery_orange_img,
+	&battery_red_img,
+	&ic_pane_battery_charge_a,
+	&ic_pane_battery_charge_i,
+	&ic_pane_battery_complete_a,
+	&ic_pane_battery_complete_i,
+	&ic_pane_battery_error_a,
+	&ic_pane_battery_error_i,
+	&battery_numbers_0_a,
+	&battery_numbers_0_i,
+	&battery_numbers_1_a,
+	&battery_numbers_1_i,
+	&battery_numbers_2_a,
+	&battery_numbers_2_i,
+	&battery_numbers_3_a,
+	&battery_numbers_3_i,
+	&battery_numbers_4_a,
+	&battery_numbers_4_i,
+	&battery_numbers_5_a,
+	&battery_numbers_5_i,
+	&battery_numbers_6_a,
+	&battery_numbers_6_i,
+	&battery_numbers_7_a,
+	&battery_numbers_7_i,
+	&battery_numbers_8_a,
+	&battery_numbers_8_i,
+	&battery_numbers_9_a,
+	&battery_numbers_9_i,
+	&battery_numbers_percentage_a,
+	&battery_numbers_percentage_i,
+	NULL
+};
+
+static struct anim *all_anims[] = {
+	&battery_green_anim,
+	&battery_orange_anim,
+	&battery_red_anim,
+	NULL
+};
+
+/* Assets are decoded on first use and kept until draw_evict() */
+#define load_asset(a) __load_asset((a),(a)->h,0,(a)->h)
+static int __load_asset(struct asset *a, int canvas_h, int y0, int rows)
 {
 	z_stream stream;
 	unsigned char *b;
 
+	if (a->bits)
+		return 0;
+
 	b = malloc(a->w * canvas_h * 2);
 	if (!b) {
 		ALOGD("Out of memory\n");
@@ -105,14 +170,14 @@ static int __load_asset(struct asset *a, int canvas_h, int y0)
 	}
 
 	/* Hack for transparent GIFs */
-	if (canvas_h != a->h)
+	if (canvas_h != rows)
 		memset(b, 0xff, a->w * canvas_h * 2);
 
 	memset(&stream, 0, sizeof(stream));
 	stream.next_in = (unsigned char *)a->gz;
 	stream.avail_in = a->gzlen;
 	stream.next_out = b + y0*a->w*2;
-	stream.avail_out = a->w * a->h * 2;
+	stream.avail_out = a->w * rows * 2;
 
 	if (	inflateInit2(&stream, 31) ||
 			inflate(&stream, 1) ||
@@ -126,193 +191,353 @@ static int __load_asset(struct asset *a, int canvas_h, int y0)
 	return 0;
 }
 
-static int load_anim_asset(struct asset **_a)
+/* The fill images are only ever used for their first row */
+#define load_asset_row(a) __load_asset((a),1,0,1)
+
+/* Encodes the pixels of s that aren't transparent as runs of
+   [skip, count, count pixels] into d, if not NULL. Returns the length
+   in shorts. */
+static int encode_delta(const unsigned short *s, int n, unsigned short *d)
+{
+	int i = 0, len = 0, skip, count;
+
+	while (i < n) {
+		for (skip=0;i<n && s[i]==0xffff && skip<0xffff;i++)
+			skip++;
+		for (count=0;i+count<n && s[i+count]!=0xffff && count<0xffff;)
+			count++;
+		if (d) {
+			d[len] = skip;
+			d[len+1] = count;
+			memcpy(d + len + 2, s + i, count * 2);
+		}
+		len += 2 + count;
+		i += count;
+	}
+	return len;
+}
+
+static void apply_delta(unsigned short *t, const unsigned short *d, int n)
 {
-	struct asset **a = _a, *a0 = *_a;
-	if (load_asset(*a) < 0)
-		return -1;
-	while (*(++a)) {
-		int i;
-		/* Frames in transparent GIFs are optimized for size and may be
-		   shorter than the first. Force them to the same height.
-		   load_asset will prefill the buffer with 0xff, which will be
-		   filled in by the transparency code below. */
-		if (__load_asset(*a, a0->h, 1) < 0)
-			return -1;
-		a[0]->h = a[-1]->h;
-		/* Patch transparent values in succession */
-		for (i=0;i<a[0]->w*a[0]->h;i++)
-			if (a[0]->bits[i] == 0xffff)
-				a[0]->bits[i] = a[-1]->bits[i];
+	int i = 0;
+
+	while (i < n) {
+		i += d[0];
+		memcpy(t + i, d + 2, d[1] * 2);
+		i += d[1];
+		d += 2 + d[1];
 	}
-	return 0;
 }
 
 static void unload_asset(struct asset *a)
 {
 	if (a->bits) free(a->bits);
 	a->bits = NULL;
+	if (a->premul) free(a->premul);
+	a->premul = NULL;
+	if (a->delta) free(a->delta);
+	a->delta = NULL;
 }
 
-static void unload_anim_asset(struct asset **a)
+static void unload_anim(struct anim *an)
 {
+	struct asset **a = an->frames;
+
 	while (*a) {
 		unload_asset(*a);
 		a++;
 	}
+	if (an->bits) free(an->bits);
+	an->bits = NULL;
+	an->current = -1;
+}
+
+static int load_anim(struct anim *an)
+{
+	struct asset **a = an->frames, *a0 = an->frames[0];
+	int n = a0->w * a0->h, len;
+
+	/* the first frame goes last, it tells the rest are there */
+	if (a0->bits)
+		return 0;
+
+	while (*(++a)) {
+		if ((*a)->delta)
+			continue;
+		/* Frames in transparent GIFs are optimized for size and may be
+		   shorter than the first. Decode them to the same height;
+		   __load_asset will prefill the buffer with 0xff, which is
+		   what leaves the previous frame's pixels alone. */
+		if (__load_asset(*a, a0->h, 1, (*a)->h) < 0)
+			goto error;
+		len = encode_delta((*a)->bits, n, NULL);
+		(*a)->delta = malloc(len * 2);
+		if (!(*a)->delta) {
+			ALOGD("Out of memory\n");
+			goto error;
+		}
+		encode_delta((*a)->bits, n, (*a)->delta);
+		free((*a)->bits);
+		(*a)->bits = NULL;
+	}
+	if (load_asset(a0) < 0)
+		goto error;
+	return 0;
+
+error:
+	unload_anim(an);
+	return -1;
+}
+
+/* Frame k of the animation, composed from the first one and the
+   deltas up to k. Playing in order costs one delta per frame. */
+static unsigned short *anim_frame(struct anim *an, int k)
+{
+	struct asset *a0 = an->frames[0];
+	int n = a0->w * a0->h;
+	int i;
+
+	if (load_anim(an) < 0)
+		return NULL;
+	if (k == 0)
+		return a0->bits;
+
+	if (!an->bits) {
+		an->bits = malloc(n * 2);
+		if (!an->bits) {
+			ALOGD("Out of memory\n");
+			return NULL;
+		}
+		an->current = -1;
+	}
+	if (an->current < 0 || an->current > k) {
+		memcpy(an->bits, a0->bits, n * 2);
+		an->current = 0;
+	}
+	for (i=an->current+1;i<=k;i++)
+		apply_delta(an->bits, an->frames[i]->delta, n);
+	an->current = k;
+	return an->bits;
 }
 
-static void blit(unsigned short *buffer, struct asset *a, int x, int y)
+/* An alpha+intensity pair is blended into RGB565 as
+   (src * a + dst * (255 - a)) / 255 for each channel. Keep src * a
+   (red and blue share it) and 255 - a instead of the raw bytes, three
+   shorts per pixel on the intensity asset, so ai_blit has no branches. */
+static void ai_premul(unsigned short *p, const unsigned char *a,
+		const unsigned char *i, int n)
 {
-	unsigned short *t = buffer + fb_width*y + x;
-	unsigned short *s = a->bits;
+	int k;
+
+	for (k=0;k<n;k++) {
+		*p++ = (i[k] >> 3) * a[k];
+		*p++ = (i[k] >> 2) * a[k];
+		*p++ = 255 - a[k];
+	}
+}
+
+static int load_ai_asset(struct asset *_a, struct asset *_i)
+{
+	unsigned short *p;
+
+	if (_i->premul)
+		return 0;
+
+	if (load_asset(_a) < 0 || load_asset(_i) < 0)
+		goto out;
+
+	p = malloc(_i->w * _i->h * 3 * sizeof(*p));
+	if (!p) {
+		ALOGD("Out of memory\n");
+		goto out;
+	}
+	_i->premul = p;
+
+	ai_premul(p, (void *)_a->bits, (void *)_i->bits, _i->w * _i->h);
+
+	/* the raw bytes aren't needed any more, or are decoded again */
+out:
+	free(_a->bits);
+	_a->bits = NULL;
+	free(_i->bits);
+	_i->bits = NULL;
+	return _i->premul ? 0 : -1;
+}
+
+/* Clips the w x h rectangle at x,y to c, returns 0 if nothing is left */
+static int clip_rect(struct rect *r, int x, int y, int w, int h,
+		const struct rect *c)
+{
+	int x1 = x + w, y1 = y + h;
+
+	if (x < c->x) x = c->x;
+	if (y < c->y) y = c->y;
+	if (x1 > c->x + c->w) x1 = c->x + c->w;
+	if (y1 > c->y + c->h) y1 = c->y + c->h;
+	r->x = x;
+	r->y = y;
+	r->w = x1 - x;
+	r->h = y1 - y;
+	return r->w > 0 && r->h > 0;
+}
+
+/* Copies the part of a w x h image at x,y that is inside clip. With a
+   stride of 0 the first row is repeated. */
+static void copy_rect(unsigned short *buffer, const unsigned short *s,
+		int stride, int x, int y, int w, int h, const struct rect *clip)
+{
+	struct rect r;
+	unsigned short *t;
 	int i;
-	for (i=0;i<a->h;i++) {
-		memcpy(t, s, a->w * 2);
-		s += a->w;
+
+	if (!clip_rect(&r, x, y, w, h, clip))
+		return;
+	s += stride * (r.y - y) + (r.x - x);
+	t = buffer + fb_width*r.y + r.x;
+	for (i=0;i<r.h;i++) {
+		memcpy(t, s, r.w * 2);
+		s += stride;
 		t += fb_width;
 	}
 }
 
+static void blit(unsigned short *buffer, struct asset *a, int x, int y,
+		const struct rect *clip)
+{
+	if (load_asset(a) < 0)
+		return;
+	copy_rect(buffer, a->bits, a->w, x, y, a->w, a->h, clip);
+}
+
+/* x / 255 for x <= 63 * 255, which is all a blend can reach */
+#define DIV255(x) (((x) + 1 + ((x) >> 8)) >> 8)
+
+static void ai_blit_row(unsigned short *t, const unsigned short *p, int w)
+{
+	int x = 0;
+
+#if defined(__ARM_NEON__)
+	const uint16x8_t mask5 = vdupq_n_u16(0x1f);
+	const uint16x8_t mask6 = vdupq_n_u16(0x3f);
+	const uint16x8_t one = vdupq_n_u16(1);
+
+	for (;x+8<=w;x+=8) {
+		uint16x8x3_t s = vld3q_u16(p);
+		uint16x8_t d = vld1q_u16(t);
+		uint16x8_t r, g, b;
+
+		r = vmlaq_u16(s.val[0], vshrq_n_u16(d, 11), s.val[2]);
+		g = vmlaq_u16(s.val[1], vandq_u16(vshrq_n_u16(d, 5), mask6), s.val[2]);
+		b = vmlaq_u16(s.val[0], vandq_u16(d, mask5), s.val[2]);
+		r = vshrq_n_u16(vsraq_n_u16(vaddq_u16(r, one), r, 8), 8);
+		g = vshrq_n_u16(vsraq_n_u16(vaddq_u16(g, one), g, 8), 8);
+		b = vshrq_n_u16(vsraq_n_u16(vaddq_u16(b, one), b, 8), 8);
+		vst1q_u16(t, vorrq_u16(vshlq_n_u16(r, 11),
+				vorrq_u16(vshlq_n_u16(g, 5), b)));
+		p += 24;
+		t += 8;
+	}
+#endif
+	for (;x<w;x++) {
+		unsigned int r, g, b;
+		r = p[0] + (*t >> 11) * p[2];
+		g = p[1] + ((*t >> 5) & 0x3f) * p[2];
+		b = p[0] + (*t & 0x1f) * p[2];
+		*t = (DIV255(r) << 11) | (DIV255(g) << 5) | DIV255(b);
+		p += 3;
+		t++;
+	}
+}
+
 static void ai_blit(unsigned short *buffer, struct asset *_a, struct asset *_i,
-		int x, int y)
+		int x, int y, const struct rect *clip)
 {
-	unsigned char *a = (void *)_a->bits;
-	unsigned char *i = (void *)_i->bits;
-	unsigned short *t = buffer + fb_width* y + x;
-
-	for (y=0;y<_i->h;y++) {
-		for (x=0;x<_i->w;x++) {
-			if (*a == 0)
-				;
-			else if (*a == 255)
-				*t = ((*i >> 3) << 11) | ((*i >> 2) << 5) | (*i >> 3);
-			else {
-				int r, g, b;
-				r = *t >> 11;
-				g = (*t >> 5) & 0x3f;
-				b = *t & 0x1f;
-				r = ((*i >> 3) * *a + r * (255 - *a)) / 255;
-				g = ((*i >> 2) * *a + g * (255 - *a)) / 255;
-				b = ((*i >> 3) * *a + b * (255 - *a)) / 255;
-				*t = (r << 11) | (g << 5) | b;
-			}
-			a++; i++; t++;
-		}
-		t += fb_width - _i->w;
+	struct rect r;
+	unsigned short *p, *t;
+
+	if (!clip_rect(&r, x, y, _i->w, _i->h, clip))
+		return;
+	if (load_ai_asset(_a, _i) < 0)
+		return;
+	p = _i->premul + (_i->w * (r.y - y) + (r.x - x)) * 3;
+	t = buffer + fb_width* r.y + r.x;
+
+	for (y=0;y<r.h;y++) {
+		ai_blit_row(t, p, r.w);
+		p += _i->w * 3;
+		t += fb_width;
 	}
 }
 
 static char				draw_initialized = 0;
+static int				last_percent = -1, last_error = -1;
 
+/* Nothing is decoded until draw() needs it */
 int draw_init(int width, int height, int size)
 {
 	fb_width = width;
 	fb_height = height;
 	fb_size  = size;
 	assert(!draw_initialized);
-	if (!  (load_asset(&battery_charge_background) == 0 &&
-			load_asset(&battery_green_img) == 0 &&
-			load_anim_asset(battery_green_ani) == 0 &&
-			load_asset(&battery_orange_img) == 0 &&
-			load_anim_asset(battery_orange_ani) == 0 &&
-			load_asset(&battery_red_img) == 0 &&
-			load_anim_asset(battery_red_ani) == 0 &&
-			load_asset(&ic_pane_battery_charge_a) == 0 &&
-			load_asset(&ic_pane_battery_charge_i) == 0 &&
-			load_asset(&ic_pane_battery_complete_a) == 0 &&
-			load_asset(&ic_pane_battery_complete_i) == 0 &&
-			load_asset(&ic_pane_battery_error_a) == 0 &&
-			load_asset(&ic_pane_battery_error_i) == 0 &&
-			load_asset(&battery_numbers_0_a) == 0 &&
-			load_asset(&battery_numbers_0_i) == 0 &&
-			load_asset(&battery_numbers_1_a) == 0 &&
-			load_asset(&battery_numbers_1_i) == 0 &&
-			load_asset(&battery_numbers_2_a) == 0 &&
-			load_asset(&battery_numbers_2_i) == 0 &&
-			load_asset(&battery_numbers_3_a) == 0 &&
-			load_asset(&battery_numbers_3_i) == 0 &&
-			load_asset(&battery_numbers_4_a) == 0 &&
-			load_asset(&battery_numbers_4_i) == 0 &&
-			load_asset(&battery_numbers_5_a) == 0 &&
-			load_asset(&battery_numbers_5_i) == 0 &&
-			load_asset(&battery_numbers_6_a) == 0 &&
-			load_asset(&battery_numbers_6_i) == 0 &&
-			load_asset(&battery_numbers_7_a) == 0 &&
-			load_asset(&battery_numbers_7_i) == 0 &&
-			load_asset(&battery_numbers_8_a) == 0 &&
-			load_asset(&battery_numbers_8_i) == 0 &&
-			load_asset(&battery_numbers_9_a) == 0 &&
-			load_asset(&battery_numbers_9_i) == 0 &&
-			load_asset(&battery_numbers_percentage_a) == 0 &&
-			load_asset(&battery_numbers_percentage_i) == 0))
-		goto error;
-
 	draw_initialized = 1;
 	return 0;
+}
 
-error:
-	draw_uninit();
-	return -1;
+/* Drops every decoded asset, they come back on the next draw() */
+void draw_evict(void)
+{
+	int i;
+
+	for (i=0;all_assets[i];i++)
+		unload_asset(all_assets[i]);
+	for (i=0;all_anims[i];i++)
+		unload_anim(all_anims[i]);
 }
 
-void draw_uninit(void)
+/* Makes the next draw() redraw the whole screen */
+void draw_invalidate(void)
 {
-	unload_asset(&battery_charge_background);
-	unload_asset(&battery_green_img);
-	unload_anim_asset(battery_green_ani);
-	unload_asset(&battery_orange_img);
-	unload_anim_asset(battery_orange_ani);
-	unload_asset(&battery_red_img);
-	unload_anim_asset(battery_red_ani);
-	unload_asset(&ic_pane_battery_charge_a);
-	unload_asset(&ic_pane_battery_charge_i);
-	unload_asset(&ic_pane_battery_complete_a);
-	unload_asset(&ic_pane_battery_complete_i);
-	unload_asset(&ic_pane_battery_error_a);
-	unload_asset(&ic_pane_battery_error_i);
-	unload_asset(&battery_numbers_0_a);
-	unload_asset(&battery_numbers_0_i);
-	unload_asset(&battery_numbers_1_a);
-	unload_asset(&battery_numbers_1_i);
-	unload_asset(&battery_numbers_2_a);
-	unload_asset(&battery_numbers_2_i);
-	unload_asset(&battery_numbers_3_a);
-	unload_asset(&battery_numbers_3_i);
-	unload_asset(&battery_numbers_4_a);
-	unload_asset(&battery_numbers_4_i);
-	unload_asset(&battery_numbers_5_a);
-	unload_asset(&battery_numbers_5_i);
-	unload_asset(&battery_numbers_6_a);
-	unload_asset(&battery_numbers_6_i);
-	unload_asset(&battery_numbers_7_a);
-	unload_asset(&battery_numbers_7_i);
-	unload_asset(&battery_numbers_8_a);
-	unload_asset(&battery_numbers_8_i);
-	unload_asset(&battery_numbers_9_a);
-	unload_asset(&battery_numbers_9_i);
-	unload_asset(&battery_numbers_percentage_a);
-	unload_asset(&battery_numbers_percentage_i);
+	last_percent = -1;
+	last_error = -1;
+}
 
+void draw_uninit(void)
+{
+	draw_evict();
 	draw_initialized = 0;
 }
 
-void draw(int w, int h, unsigned short *color_channel, int percent, int error)
+/* Only the animation strip changes from one frame to the next, unless
+   the level or the error state does. The returned damage is what was
+   redrawn, empty if nothing was. */
+void draw(int w, int h, unsigned short *color_channel, int percent, int error,
+		struct rect *damage)
 {
 	struct asset *desired_ic_pane_a, *desired_ic_pane_i;
 	static int frame = 0;
-	struct asset *battery_img, *battery_ani;
+	struct asset *battery_img;
+	struct anim *battery_anim;
+	unsigned short *ani_bits;
+	int top = PNG_TOP + (fb_height-battery_charge_background.h) / 2;
+	int bottom = PNG_BOTTOM + (fb_height - battery_charge_background.h) / 2;
+	int left = PNG_LEFT + (fb_width - battery_charge_background.w) / 2;
+	int fill_height_pixels = percent * (bottom - top) / 100;
+	int ani_y, ani_w, ani_h;
+	int y;
 
 	if (percent <= 10) {
 		battery_img = &battery_red_img;
-		battery_ani = battery_red_ani[frame % 4];
+		battery_anim = &battery_red_anim;
 	} else if (percent < 30) {
 		battery_img = &battery_orange_img;
-		battery_ani = battery_orange_ani[frame % 4];
+		battery_anim = &battery_orange_anim;
 	} else {
 		battery_img = &battery_green_img;
-		battery_ani = battery_green_ani[frame % 4];
+		battery_anim = &battery_green_anim;
 	}
+	/* all frames are shown at the size of the first */
+	ani_w = battery_anim->frames[0]->w;
+	ani_h = battery_anim->frames[0]->h;
 
 	if (error) {
 		desired_ic_pane_a = &ic_pane_battery_error_a;
@@ -325,44 +550,51 @@ void draw(int w, int h, unsigned short *color_channel, int percent, int error)
 		desired_ic_pane_i = &ic_pane_battery_complete_i;
 	}
 
-	memset(color_channel, 0, fb_size);
+	ani_y = bottom - fill_height_pixels - ani_h;
+	if (ani_y < top)
+		ani_y = top;
+
+	if (percent != last_percent || error != last_error) {
+		damage->x = 0;
+		damage->y = 0;
+		damage->w = fb_width;
+		damage->h = fb_height;
+		last_percent = percent;
+		last_error = error;
+	} else if (!error && percent < 100) {
+		damage->x = left;
+		damage->y = ani_y;
+		damage->w = ani_w;
+		damage->h = ani_h;
+	} else {
+		damage->x = damage->y = 0;
+		damage->w = damage->h = 0;
+		frame++;
+		return;
+	}
+
+	for (y=damage->y;y<damage->y+damage->h;y++)
+		memset(color_channel + fb_width * y + damage->x, 0, damage->w * 2);
 	blit(color_channel, &battery_charge_background,
 				(fb_width - battery_charge_background.w) / 2,
-				(fb_height- battery_charge_background.h) / 2);
+				(fb_height- battery_charge_background.h) / 2, damage);
 
 	/* Fill it up! */
 	if (!error) {
-		int top = PNG_TOP + (fb_height-battery_charge_background.h) / 2;
-		int bottom = PNG_BOTTOM + (fb_height - battery_charge_background.h) / 2;
-		int left = PNG_LEFT + (fb_width - battery_charge_background.w) / 2;
-		int fill_height_pixels = percent * (bottom - top) / 100;
-		unsigned short *s, *t;
-		int y;
-
-		y = bottom - fill_height_pixels;
-		t = color_channel + fb_width * y + left;
-		for (;y<bottom;y++) {
-			memcpy(t, battery_img->bits, battery_img->w * 2);
-			t += fb_width;
-		}
-
-		y = bottom - fill_height_pixels - battery_ani->h;
-		if (y < top)
-			y = top;
-		bottom = y + battery_ani->h;
-		t = color_channel + fb_width * y + left;
-		s = (void *)battery_ani->bits;
-		if (percent < 100)
-			for (;y<bottom;y++) {
-				memcpy(t, s, battery_ani->w * 2);
-				s += battery_ani->w;
-				t += fb_width;
-			}
+		if (load_asset_row(battery_img) == 0)
+			copy_rect(color_channel, battery_img->bits, 0,
+					left, bottom - fill_height_pixels,
+					battery_img->w, fill_height_pixels, damage);
+		ani_bits = percent < 100 ? anim_frame(battery_anim, frame % 4) : NULL;
+		if (ani_bits)
+			copy_rect(color_channel, ani_bits, ani_w,
+					left, ani_y, ani_w, ani_h, damage);
 	}
 
 	/* Compose battery indicator */
 	ai_blit(color_channel, desired_ic_pane_a, desired_ic_pane_i,
-			(fb_width - desired_ic_pane_i->w) / 2, (fb_height - desired_ic_pane_i->h) / 2);
+			(fb_width - desired_ic_pane_i->w) / 2, (fb_height - desired_ic_pane_i->h) / 2,
+			damage);
 
 	/* Draw percentage */
 	if (!error) {
@@ -377,9 +609,9 @@ void draw(int w, int h, unsigned short *color_channel, int percent, int error)
 		y = (fb_height + battery_charge_background.h) / 2 - 10;
 		for (i=0;i<digits;i++)
 			ai_blit(color_channel, battery_numbers_a[s[i]],
-					battery_numbers_i[s[i]], x + i*w, y);
+					battery_numbers_i[s[i]], x + i*w, y, damage);
 		ai_blit(color_channel, &battery_numbers_percentage_a,
-				&battery_numbers_percentage_i, x + i*w, y);
+				&battery_numbers_percentage_i, x + i*w, y, damage);
 	}
 
 	frame++;
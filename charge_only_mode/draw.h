@@ -25,8 +25,18 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef _MOT_CHARGE_ONLY_MODE_DRAW_H
 #define _MOT_CHARGE_ONLY_MODE_DRAW_H
 
+struct rect {
+	int x;
+	int y;
+	int w;
+	int h;
+};
+
 int draw_init(int width, int height, int size);
 void draw_uninit(void);
-void draw(int w, int h, unsigned short *fb, int percentage, int error);
+void draw_evict(void);
+void draw_invalidate(void);
+void draw(int w, int h, unsigned short *fb, int percentage, int error,
+		struct rect *damage);
 
 #endif
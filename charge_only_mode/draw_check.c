@@ -0,0 +1,289 @@
+/*
+ * Check of the charge_only_mode pixel paths against the routines they
+ * replaced. Builds for the host, where only the C paths exist, and for
+ * the target, where the NEON paths are compiled in as well.
+ *
+ * Usage: charge_only_mode_draw_check
+ *
+ * ai blend: every (alpha, intensity) pair over all 65536 RGB565
+ * destination pixels, as one long row (NEON with a C tail) and in rows
+ * too short for NEON (C path), against the original per-pixel divide by
+ * 255. That is 2^32 pixels twice, about a minute and a half on a desktop.
+ * Then every alpha+intensity asset pair is blitted onto a random screen,
+ * whole and clipped to a damage rectangle, against the original ai_blit.
+ *
+ * flip_32: all 65536 RGB565 values to ARGB8888, as one long row, from an
+ * odd offset and in rows too short for NEON, against the original
+ * per-pixel conversion.
+ *
+ * Prints the first mismatches; exits 1 if there were any.
+ */
+
+#include <string.h>
+#include <time.h>
+
+/* the routines under test are static */
+#include "draw.c"
+
+#include <cutils/memory.h>
+#include "screen.h"
+
+#define CHECK_W		480
+#define CHECK_H		854
+#define MAX_REPORTS	10
+#define TAIL_W		7	/* row width that never reaches NEON */
+
+static int check_failures = 0;
+
+static void report_blend(const char *what, int a, int i, unsigned dst,
+		unsigned expected, unsigned got)
+{
+	if (check_failures++ < MAX_REPORTS)
+		printf("%s: alpha %d intensity %d dst 0x%04x: expected 0x%04x got 0x%04x\n",
+				what, a, i, dst, expected, got);
+}
+
+static void report_asset(const char *what, int k, int n,
+		unsigned expected, unsigned got)
+{
+	if (check_failures++ < MAX_REPORTS)
+		printf("%s %d: pixel %d,%d: expected 0x%04x got 0x%04x\n",
+				what, k, n % fb_width, n / fb_width, expected, got);
+}
+
+static void report_flip(const char *what, unsigned d, unsigned expected,
+		unsigned got)
+{
+	if (check_failures++ < MAX_REPORTS)
+		printf("%s: 0x%04x: expected 0x%08x got 0x%08x\n",
+				what, d, expected, got);
+}
+
+/* ai_blit() as it was before the blend was pre-multiplied */
+static unsigned short old_blend(int a, int i, unsigned short t)
+{
+	int r, g, b;
+
+	if (a == 0)
+		return t;
+	if (a == 255)
+		return ((i >> 3) << 11) | ((i >> 2) << 5) | (i >> 3);
+	r = t >> 11;
+	g = (t >> 5) & 0x3f;
+	b = t & 0x1f;
+	r = ((i >> 3) * a + r * (255 - a)) / 255;
+	g = ((i >> 2) * a + g * (255 - a)) / 255;
+	b = ((i >> 3) * a + b * (255 - a)) / 255;
+	return (r << 11) | (g << 5) | b;
+}
+
+static void old_ai_blit(unsigned short *buffer, const unsigned char *a,
+		const unsigned char *i, int w, int h, int x, int y)
+{
+	unsigned short *t = buffer + fb_width * y + x;
+
+	for (y=0;y<h;y++) {
+		for (x=0;x<w;x++) {
+			*t = old_blend(*a, *i, *t);
+			a++; i++; t++;
+		}
+		t += fb_width - w;
+	}
+}
+
+static void check_blend(void)
+{
+	unsigned char a[65536], i[65536];
+	unsigned short *p, *row, *one;
+	unsigned short expected;
+	int av, iv;
+	unsigned d;
+
+	p = malloc(65536 * 3 * sizeof(*p));
+	row = malloc(65536 * sizeof(*row));
+	one = malloc(65536 * sizeof(*one));
+	if (!p || !row || !one) {
+		printf("Out of memory\n");
+		exit(2);
+	}
+	for (av=0;av<256;av++) {
+		memset(a, av, sizeof(a));
+		for (iv=0;iv<256;iv++) {
+			memset(i, iv, sizeof(i));
+			ai_premul(p, a, i, 65536);
+			for (d=0;d<65536;d++)
+				row[d] = one[d] = d;
+			ai_blit_row(row, p, 65536);
+			/* too short for NEON, all C */
+			for (d=0;d<65536;d+=TAIL_W)
+				ai_blit_row(one + d, p + d * 3,
+						d + TAIL_W <= 65536 ? TAIL_W : 65536 - d);
+			for (d=0;d<65536;d++) {
+				expected = old_blend(av, iv, d);
+				if (row[d] != expected)
+					report_blend("blend row", av, iv, d, expected, row[d]);
+				if (one[d] != expected)
+					report_blend("blend tail", av, iv, d, expected, one[d]);
+			}
+		}
+	}
+	free(p);
+	free(row);
+	free(one);
+}
+
+/* flip_32() as it was before the bulk conversion */
+static void old_flip_32(unsigned *bits, unsigned short *ptr, unsigned count)
+{
+	unsigned i=0;
+	while (i<count) {
+		uint32_t rgb32, red, green, blue, alpha;
+		/* convert 16 bits to 32 bits */
+		rgb32 = ((ptr[i] >> 11) & 0x1F);
+		red = (rgb32 << 3) | (rgb32 >> 2);
+		rgb32 = ((ptr[i] >> 5) & 0x3F);
+		green = (rgb32 << 2) | (rgb32 >> 4);
+		rgb32 = ((ptr[i]) & 0x1F);
+		blue = (rgb32 << 3) | (rgb32 >> 2);
+		alpha = 0xff;
+		rgb32 = (alpha << 24) | (red << 16) | (green << 8) | (blue);
+		android_memset32((uint32_t *)bits, rgb32, 4);
+		i++;
+		bits++;
+	}
+}
+
+static void check_flip_32(void)
+{
+	static unsigned short pixels[65536 + 1];
+	static unsigned expected[65536], got[65536 + 1];
+	unsigned d;
+
+	for (d=0;d<65536;d++)
+		pixels[d] = d;
+	old_flip_32(expected, pixels, 65536);
+
+	memset(got, 0, sizeof(got));
+	flip_32(got, pixels, 65536);
+	for (d=0;d<65536;d++)
+		if (got[d] != expected[d])
+			report_flip("flip_32 row", d, expected[d], got[d]);
+
+	/* neither source nor destination 16 byte aligned */
+	for (d=0;d<65536;d++)
+		pixels[d + 1] = d;
+	memset(got, 0, sizeof(got));
+	flip_32(got + 1, pixels + 1, 65536);
+	for (d=0;d<65536;d++)
+		if (got[d + 1] != expected[d])
+			report_flip("flip_32 unaligned", d, expected[d], got[d + 1]);
+
+	/* too short for NEON, all C */
+	for (d=0;d<65536;d++)
+		pixels[d] = d;
+	memset(got, 0, sizeof(got));
+	for (d=0;d<65536;d+=TAIL_W)
+		flip_32(got + d, pixels + d, d + TAIL_W <= 65536 ? TAIL_W : 65536 - d);
+	for (d=0;d<65536;d++)
+		if (got[d] != expected[d])
+			report_flip("flip_32 tail", d, expected[d], got[d]);
+}
+
+static struct asset *ai_pairs[][2] = {
+	{ &ic_pane_battery_charge_a, &ic_pane_battery_charge_i },
+	{ &ic_pane_battery_complete_a, &ic_pane_battery_complete_i },
+	{ &ic_pane_battery_error_a, &ic_pane_battery_error_i },
+	{ &battery_numbers_0_a, &battery_numbers_0_i },
+	{ &battery_numbers_1_a, &battery_numbers_1_i },
+	{ &battery_numbers_2_a, &battery_numbers_2_i },
+	{ &battery_numbers_3_a, &battery_numbers_3_i },
+	{ &battery_numbers_4_a, &battery_numbers_4_i },
+	{ &battery_numbers_5_a, &battery_numbers_5_i },
+	{ &battery_numbers_6_a, &battery_numbers_6_i },
+	{ &battery_numbers_7_a, &battery_numbers_7_i },
+	{ &battery_numbers_8_a, &battery_numbers_8_i },
+	{ &battery_numbers_9_a, &battery_numbers_9_i },
+	{ &battery_numbers_percentage_a, &battery_numbers_percentage_i }
+};
+
+static void check_assets(void)
+{
+	const struct rect full = { 0, 0, CHECK_W, CHECK_H };
+	unsigned short *screen, *expected, *got;
+	struct asset a, i;
+	struct rect clip;
+	int k, n, x, y;
+
+	screen = malloc(CHECK_W * CHECK_H * 2);
+	expected = malloc(CHECK_W * CHECK_H * 2);
+	got = malloc(CHECK_W * CHECK_H * 2);
+	if (!screen || !expected || !got) {
+		printf("Out of memory\n");
+		exit(2);
+	}
+	for (n=0;n<CHECK_W*CHECK_H;n++)
+		screen[n] = rand();
+
+	for (k=0;k<(int)(sizeof(ai_pairs)/sizeof(ai_pairs[0]));k++) {
+		/* raw copies for the old routine, load_ai_asset() frees its own */
+		a = *ai_pairs[k][0];
+		i = *ai_pairs[k][1];
+		a.bits = i.bits = NULL;
+		if (load_asset(&a) < 0 || load_asset(&i) < 0) {
+			printf("asset %d: decode failed\n", k);
+			check_failures++;
+			continue;
+		}
+		x = (CHECK_W - i.w) / 2 + 1;
+		y = (CHECK_H - i.h) / 2;
+		memcpy(expected, screen, CHECK_W * CHECK_H * 2);
+		old_ai_blit(expected, (void *)a.bits, (void *)i.bits, i.w, i.h, x, y);
+
+		memcpy(got, screen, CHECK_W * CHECK_H * 2);
+		ai_blit(got, ai_pairs[k][0], ai_pairs[k][1], x, y, &full);
+		for (n=0;n<CHECK_W*CHECK_H;n++)
+			if (got[n] != expected[n])
+				report_asset("asset", k, n, expected[n], got[n]);
+
+		/* a damage rectangle cutting through the asset */
+		clip.x = x + i.w / 3;
+		clip.y = y + i.h / 4;
+		clip.w = i.w;
+		clip.h = i.h / 2;
+		memcpy(got, screen, CHECK_W * CHECK_H * 2);
+		ai_blit(got, ai_pairs[k][0], ai_pairs[k][1], x, y, &clip);
+		for (n=0;n<CHECK_W*CHECK_H;n++) {
+			int px = n % CHECK_W, py = n / CHECK_W;
+			int inside = px >= clip.x && px < clip.x + clip.w &&
+					py >= clip.y && py < clip.y + clip.h;
+			unsigned short e = inside ? expected[n] : screen[n];
+			if (got[n] != e)
+				report_asset("clipped asset", k, n, e, got[n]);
+		}
+		free(a.bits);
+		free(i.bits);
+	}
+	free(screen);
+	free(expected);
+	free(got);
+}
+
+int main(void)
+{
+	fb_width = CHECK_W;
+	fb_height = CHECK_H;
+	fb_size = CHECK_W * CHECK_H * 2;
+	srand(time(NULL));
+
+	check_blend();
+	check_assets();
+	check_flip_32();
+	draw_evict();
+
+	if (check_failures) {
+		printf("%d mismatches\n", check_failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
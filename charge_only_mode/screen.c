@@ -33,7 +33,12 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <linux/fb.h>
 #include <linux/kd.h>
 
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include "draw.h"
+#include "screen.h"
 
 #define LOG_TAG "CHARGE_ONLY_MODE"
 #include <cutils/log.h>
@@ -129,44 +134,91 @@ err1:
 
 #define ASSERT(x) do { if (!(x)) *(int *)0=0; } while (0)
 
+/* RGB565 to ARGB8888, replicating the top bits of each channel into
+   the bottom ones so that white stays white */
 void flip_32(unsigned *bits, unsigned short *ptr, unsigned count)
 {
     unsigned i=0;
-    while (i<count) {
-        uint32_t rgb32, red, green, blue, alpha;
-        /* convert 16 bits to 32 bits */
+#if defined(__ARM_NEON__)
+    const uint8x8_t alpha = vdup_n_u8(0xff);
+    for (; i+8<=count; i+=8) {
+        uint16x8_t p = vld1q_u16(ptr + i);
+        uint8x8_t r = vshrn_n_u16(p, 8);            /* rrrrrggg */
+        uint8x8_t g = vshrn_n_u16(p, 3);            /* ggggggbb */
+        uint8x8_t b = vshl_n_u8(vmovn_u16(p), 3);   /* bbbbb000 */
+        uint8x8x4_t argb;
+
+        r = vand_u8(r, vdup_n_u8(0xf8));
+        g = vand_u8(g, vdup_n_u8(0xfc));
+        argb.val[0] = vsra_n_u8(b, b, 5);
+        argb.val[1] = vsra_n_u8(g, g, 6);
+        argb.val[2] = vsra_n_u8(r, r, 5);
+        argb.val[3] = alpha;
+        vst4_u8((uint8_t *)(bits + i), argb);
+    }
+#endif
+    for (; i<count; i++) {
+        uint32_t rgb32, red, green, blue;
         rgb32 = ((ptr[i] >> 11) & 0x1F);
         red = (rgb32 << 3) | (rgb32 >> 2);
         rgb32 = ((ptr[i] >> 5) & 0x3F);
         green = (rgb32 << 2) | (rgb32 >> 4);
         rgb32 = ((ptr[i]) & 0x1F);
         blue = (rgb32 << 3) | (rgb32 >> 2);
-        alpha = 0xff;
-        rgb32 = (alpha << 24) | (red << 16) | (green << 8) | (blue);
-        android_memset32((uint32_t *)bits, rgb32, 4);
-        i++;
-        bits++;
+        bits[i] = (0xffu << 24) | (red << 16) | (green << 8) | blue;
     }
 }
 
+/* The back page still holds the frame before last, so it needs what
+   changed in both */
+static void rect_union(struct rect *r, const struct rect *a)
+{
+	int x1, y1;
+
+	if (a->w <= 0 || a->h <= 0)
+		return;
+	if (r->w <= 0 || r->h <= 0) {
+		*r = *a;
+		return;
+	}
+	x1 = r->x + r->w > a->x + a->w ? r->x + r->w : a->x + a->w;
+	y1 = r->y + r->h > a->y + a->h ? r->y + r->h : a->y + a->h;
+	r->x = r->x < a->x ? r->x : a->x;
+	r->y = r->y < a->y ? r->y : a->y;
+	r->w = x1 - r->x;
+	r->h = y1 - r->y;
+}
+
 int screen_update(int percentage, int error)
 {
+	static struct rect last_damage;
+	struct rect damage, copy;
+	unsigned y;
+
+	/* Nothing to show; display_unblank() has everything redrawn */
+	if (blank)
+		return 0;
+
 	fb->vi.yres_virtual = fb->vi.yres * 2;
 	fb->vi.yoffset = fb->vi.yoffset ? 0 : fb->vi.yres;
 	draw(fb_width(fb), fb_height(fb), mem_surface,
-			percentage, error);
-
-	if( fb->vi.bits_per_pixel == 16) {
-		memcpy(fb->bits + fb->vi.yoffset * fb_width(fb), \
-		mem_surface, fb->fi.line_length * fb->vi.yres);
-	} else {
-		flip_32((unsigned *)fb->bits + fb->vi.yoffset * fb_width(fb), \
-		(unsigned short *)mem_surface, \
-		((fb->fi.line_length / (fb->vi.bits_per_pixel / 8)) * fb->vi.yres));
+			percentage, error, &damage);
+
+	copy = damage;
+	rect_union(&copy, &last_damage);
+	last_damage = damage;
+
+	for (y = copy.y; y < (unsigned)(copy.y + copy.h); y++) {
+		unsigned short *s = mem_surface + y * fb_width(fb) + copy.x;
+		unsigned offset = (fb->vi.yoffset + y) * fb_width(fb) + copy.x;
+
+		if( fb->vi.bits_per_pixel == 16)
+			memcpy(fb->bits + offset, s, copy.w * 2);
+		else
+			flip_32((unsigned *)fb->bits + offset, s, copy.w);
 	}
 
-	if(blank == 0)
-		ioctl(fb->fd, FBIOPUT_VSCREENINFO, &fb->vi);
+	ioctl(fb->fd, FBIOPUT_VSCREENINFO, &fb->vi);
 
 	return 0;
 }
@@ -239,6 +291,8 @@ void display_blank(void)
        if (ioctl(fb->fd, FBIOBLANK, VESA_POWERDOWN) < 0)
                ALOGD("display blank failed, fb.fd %d\n", fb->fd);
 	blank = 1;
+	/* nothing is drawn for a while, give the decoded assets back */
+	draw_evict();
 }
 
 void display_unblank(void)
@@ -246,4 +300,7 @@ void display_unblank(void)
        if (ioctl(fb->fd, FBIOBLANK, VESA_NO_BLANKING) < 0)
                ALOGD("display unblank failed, fb.fd %d\n", fb->fd);
 	blank = 0;
+	/* Both pages went stale while blank; a full damage is copied to
+	   this page and, as last damage, to the other one */
+	draw_invalidate();
 }
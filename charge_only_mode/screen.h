@@ -30,5 +30,6 @@ int screen_update(int percentage, int error);
 void screen_uninit();
 void display_blank(void);
 void display_unblank(void);
+void flip_32(unsigned *bits, unsigned short *ptr, unsigned count);
 
 #endif
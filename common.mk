@@ -192,8 +192,10 @@ PRODUCT_PACKAGES += \
 
 # system/etc Prebuilts
 PRODUCT_COPY_FILES += \
-    $(COMMON_FOLDER)/prebuilt/etc/media_codecs.xml:system/etc/media_codecs.xml \
-    $(COMMON_FOLDER)/prebuilt/etc/audio_policy.conf:system/etc/audio_policy.conf
+    $(COMMON_FOLDER)/prebuilt/etc/media_codecs.xml:system/etc/media_codecs.xml
+
+# Picked by BOARD_USES_WRAPPER_DEEP_BUFFER, see audio/Android.mk
+PRODUCT_PACKAGES += audio_policy.conf
 
 # Root files
 PRODUCT_PACKAGES += \
@@ -57,3 +57,25 @@ LOCAL_C_INCLUDES += \
 LOCAL_SHARED_LIBRARIES := libbacktrace libcutils libdl liblog
 
 include $(BUILD_SHARED_LIBRARY)
+
+# Host benchmark; see MotoVectorBench.cpp
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+        $(LOC_PATH)/MotoVectorBench.cpp \
+        $(LOC_PATH)/MotoVectorImpl.cpp \
+        $(LU_PATH)/SharedBuffer.cpp
+
+LOCAL_MODULE := motou_vector_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_C_INCLUDES += \
+	external/safe-iop/include \
+	system/core/libutils
+
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS := -lrt
+# allocation counts
+LOCAL_LDFLAGS := -Wl,--wrap=malloc -Wl,--wrap=realloc
+
+include $(BUILD_HOST_EXECUTABLE)
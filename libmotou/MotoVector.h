@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MOTO_VECTOR_H
+#define MOTO_VECTOR_H
+
+// must come first so Vector<> uses the libmotou VectorImpl
+#include "MotoVectorImpl.h"
+#include <utils/Vector.h>
+
+// ---------------------------------------------------------------------------
+
+namespace android {
+
+/*!
+ * A Vector<> keeping up to N items inside the object, the heap is only
+ * used once it holds more. Its storage is copied, never shared.
+ */
+
+template <class TYPE, size_t N>
+class InlineVector : public Vector<TYPE>
+{
+public:
+                            InlineVector();
+                            InlineVector(const Vector<TYPE>& rhs);
+                            InlineVector(const InlineVector<TYPE, N>& rhs);
+    virtual                 ~InlineVector();
+
+    InlineVector&           operator = (const Vector<TYPE>& rhs);
+    InlineVector&           operator = (const InlineVector<TYPE, N>& rhs);
+
+protected:
+    virtual void*           do_allocate(size_t& size);
+    virtual bool            do_deallocate(void* block);
+
+private:
+    union {
+        char                mInline[VectorImpl::STORAGE_HEADER_SIZE + N*sizeof(TYPE)];
+        double              mAlign;
+        void*               mAlignPtr;
+    };
+            bool            mInlineUsed;
+};
+
+/*!
+ * A Vector<> whose storage comes from a VectorArena while it has room,
+ * and from the heap after that. The arena must outlive the vector.
+ */
+
+template <class TYPE>
+class ArenaVector : public Vector<TYPE>
+{
+public:
+                            ArenaVector(VectorArena& arena);
+    virtual                 ~ArenaVector();
+
+    ArenaVector&            operator = (const Vector<TYPE>& rhs);
+
+protected:
+    virtual void*           do_allocate(size_t& size);
+    virtual bool            do_deallocate(void* block);
+
+private:
+                            ArenaVector(const ArenaVector<TYPE>& rhs);
+
+            VectorArena&    mArena;
+};
+
+// ---------------------------------------------------------------------------
+// No user serviceable parts from here...
+// ---------------------------------------------------------------------------
+
+template<class TYPE, size_t N> inline
+InlineVector<TYPE, N>::InlineVector()
+    : mInlineUsed(false)
+{
+    this->enable_storage_hooks();
+}
+
+template<class TYPE, size_t N> inline
+InlineVector<TYPE, N>::InlineVector(const Vector<TYPE>& rhs)
+    : mInlineUsed(false)
+{
+    this->enable_storage_hooks();
+    this->appendVector(rhs);
+}
+
+template<class TYPE, size_t N> inline
+InlineVector<TYPE, N>::InlineVector(const InlineVector<TYPE, N>& rhs)
+    : Vector<TYPE>(), mInlineUsed(false)
+{
+    this->enable_storage_hooks();
+    this->appendVector(rhs);
+}
+
+template<class TYPE, size_t N> inline
+InlineVector<TYPE, N>::~InlineVector()
+{
+    // our hooks are gone by the time ~Vector() runs
+    this->finish_vector();
+}
+
+template<class TYPE, size_t N> inline
+InlineVector<TYPE, N>& InlineVector<TYPE, N>::operator = (const Vector<TYPE>& rhs) {
+    Vector<TYPE>::operator = (rhs);
+    return *this;
+}
+
+template<class TYPE, size_t N> inline
+InlineVector<TYPE, N>& InlineVector<TYPE, N>::operator = (const InlineVector<TYPE, N>& rhs) {
+    Vector<TYPE>::operator = (rhs);
+    return *this;
+}
+
+template<class TYPE, size_t N>
+void* InlineVector<TYPE, N>::do_allocate(size_t& size) {
+    if (mInlineUsed || size > sizeof(mInline)) {
+        return 0;
+    }
+    mInlineUsed = true;
+    size = sizeof(mInline);
+    return mInline;
+}
+
+template<class TYPE, size_t N>
+bool InlineVector<TYPE, N>::do_deallocate(void* block) {
+    if (block != mInline) {
+        return false;
+    }
+    mInlineUsed = false;
+    return true;
+}
+
+template<class TYPE> inline
+ArenaVector<TYPE>::ArenaVector(VectorArena& arena)
+    : mArena(arena)
+{
+    this->enable_storage_hooks();
+}
+
+template<class TYPE> inline
+ArenaVector<TYPE>::~ArenaVector()
+{
+    this->finish_vector();
+}
+
+template<class TYPE> inline
+ArenaVector<TYPE>& ArenaVector<TYPE>::operator = (const Vector<TYPE>& rhs) {
+    Vector<TYPE>::operator = (rhs);
+    return *this;
+}
+
+template<class TYPE>
+void* ArenaVector<TYPE>::do_allocate(size_t& size) {
+    return mArena.allocate(size);
+}
+
+template<class TYPE>
+bool ArenaVector<TYPE>::do_deallocate(void* block) {
+    return mArena.deallocate(block);
+}
+
+}; // namespace android
+
+// ---------------------------------------------------------------------------
+
+#endif // MOTO_VECTOR_H
@@ -0,0 +1,655 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host benchmark for the libmotou VectorImpl.
+//
+// Usage: motou_vector_bench [-n max_items] [-f filter]
+//
+// Runs Vector / SortedVector operations on a trivial type (int) and one
+// with a constructor, copy and destructor, for sizes from 8 up to
+// max_items (1M by default). Reports ns/op and heap allocations per op;
+// allocations are counted by wrapping malloc/realloc at link time.
+// Operations that are quadratic by nature stop at kQuadraticMax items.
+// merge is also timed against adding the same items one by one, which is
+// what merge() used to do for anything but disjoint vectors.
+//
+// InlineVector and ArenaVector (MotoVector.h) are checked first, for both
+// types: spilling to the heap and shrinking back, copies and assignments
+// between hooked and plain vectors, sort, and an arena running out. Any
+// failed check exits with status 1.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+// must come first so the templates below use the libmotou layout
+#include "MotoVectorImpl.h"
+#include <utils/SortedVector.h>
+#include <utils/Vector.h>
+#include "MotoVector.h"
+
+using namespace android;
+
+// ---------------------------------------------------------------------------
+
+static size_t gAllocs = 0;
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    gAllocs++;
+    return __real_malloc(size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    gAllocs++;
+    return __real_realloc(ptr, size);
+}
+}
+
+// stays on the non-trivial VectorImpl paths
+class Counted {
+public:
+    Counted() : mKey(0), mSelf(this) { }
+    explicit Counted(int key) : mKey(key), mSelf(this) { }
+    Counted(const Counted& rhs) : mKey(rhs.mKey), mSelf(this) { }
+    ~Counted() { mSelf = 0; }
+    Counted& operator = (const Counted& rhs) { mKey = rhs.mKey; return *this; }
+    bool operator < (const Counted& rhs) const { return mKey < rhs.mKey; }
+    int key() const { return mKey; }
+private:
+    int mKey;
+    Counted* mSelf;
+};
+
+// Counted that knows if it was moved bitwise, destroyed twice or leaked
+class Tracked {
+public:
+    Tracked() : mKey(0), mSelf(this) { sLive++; }
+    explicit Tracked(int key) : mKey(key), mSelf(this) { sLive++; }
+    Tracked(const Tracked& rhs) : mKey(rhs.mKey), mSelf(this) { rhs.check(); sLive++; }
+    ~Tracked() { check(); mSelf = 0; sLive--; }
+    Tracked& operator = (const Tracked& rhs) { check(); rhs.check(); mKey = rhs.mKey; return *this; }
+    int key() const { check(); return mKey; }
+    static int live() { return sLive; }
+private:
+    void check() const;
+    int mKey;
+    const Tracked* mSelf;
+    static int sLive;
+};
+
+int Tracked::sLive = 0;
+
+void Tracked::check() const
+{
+    if (mSelf != this) {
+        fprintf(stderr, "Tracked %p: %s\n", this,
+                mSelf ? "moved without a copy" : "used after its destructor");
+        exit(1);
+    }
+}
+
+static inline int keyOf(int item) { return item; }
+static inline int keyOf(const Counted& item) { return item.key(); }
+static inline int keyOf(const Tracked& item) { return item.key(); }
+
+template<typename TYPE>
+static int compareItems(const TYPE* lhs, const TYPE* rhs)
+{
+    // a difference overflows for keys far apart with opposite signs
+    const int l = keyOf(*lhs), r = keyOf(*rhs);
+    return (l > r) - (l < r);
+}
+
+// Vector or SortedVector
+template<typename VECTOR>
+static void checkSorted(const VECTOR& v, const char* what)
+{
+    for (size_t i=1 ; i<v.size() ; i++) {
+        if (keyOf(v[i]) < keyOf(v[i-1])) {
+            fprintf(stderr, "%s: not sorted at %zu: %d after %d\n",
+                    what, i, keyOf(v[i]), keyOf(v[i-1]));
+            exit(1);
+        }
+    }
+}
+
+// insertAt/removeItemsAt at the front and SortedVector::add move every item
+const size_t kQuadraticMax = 1 << 16;
+
+static const char* gFilter = NULL;
+static const char* gType = "";
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec)*1000000000ull + ts.tv_nsec;
+}
+
+class Timer {
+public:
+    Timer() : mNs(0), mAllocs(0), mStart(0), mStartAllocs(0) { }
+    void start() { mStartAllocs = gAllocs; mStart = now_ns(); }
+    void stop() { mNs += now_ns() - mStart; mAllocs += gAllocs - mStartAllocs; }
+    void report(const char* name, size_t n, size_t ops) const;
+private:
+    uint64_t mNs;
+    size_t mAllocs;
+    uint64_t mStart;
+    size_t mStartAllocs;
+};
+
+void Timer::report(const char* name, size_t n, size_t ops) const
+{
+    printf("%-8s %-24s %8zu %12.1f ns/op %8.3f allocs/op\n", gType, name, n,
+            ops ? double(mNs)/ops : 0.0, ops ? double(mAllocs)/ops : 0.0);
+}
+
+static bool selected(const char* name)
+{
+    return !gFilter || strstr(name, gFilter);
+}
+
+static int* makeKeys(size_t n)
+{
+    int* keys = new int[n];
+    // the whole int range, negative keys included
+    for (size_t i=0 ; i<n ; i++) {
+        keys[i] = int((unsigned(rand()) << 16) ^ unsigned(rand()));
+    }
+    return keys;
+}
+
+// ---------------------------------------------------------------------------
+
+static void fail(const char* what, const char* why)
+{
+    fprintf(stderr, "%s: %s\n", what, why);
+    exit(1);
+}
+
+// v holds keys[0, n)
+template<typename TYPE>
+static void checkKeys(const Vector<TYPE>& v, const int* keys, size_t n, const char* what)
+{
+    if (v.size() != n) {
+        fprintf(stderr, "%s: %zu items, not %zu\n", what, v.size(), n);
+        exit(1);
+    }
+    for (size_t i=0 ; i<n ; i++) {
+        if (keyOf(v[i]) != keys[i]) {
+            fprintf(stderr, "%s: item %zu is %d, not %d\n", what, i, keyOf(v[i]), keys[i]);
+            exit(1);
+        }
+    }
+}
+
+// the storage of v is inside the object itself
+template<typename VECTOR>
+static bool isInline(const VECTOR& v)
+{
+    const char* p = reinterpret_cast<const char*>(v.array());
+    const char* self = reinterpret_cast<const char*>(&v);
+    return p >= self && p < self + sizeof(v);
+}
+
+const size_t kInlineItems = 8;
+
+template<typename TYPE>
+static void check_inline(const int* keys)
+{
+    typedef InlineVector<TYPE, kInlineItems> Inline;
+    const size_t kSpill = 10*kInlineItems;
+
+    {
+        Inline v;
+        const size_t allocs = gAllocs;
+        for (size_t i=0 ; i<kInlineItems ; i++) {
+            v.push(TYPE(keys[i]));
+        }
+        if (!isInline(v) || gAllocs != allocs) {
+            fail("inline push", "storage left the object");
+        }
+        checkKeys(v, keys, kInlineItems, "inline push");
+
+        // around the inline capacity, over and over
+        for (int r=0 ; r<4 ; r++) {
+            v.push(TYPE(keys[kInlineItems]));
+            checkKeys(v, keys, kInlineItems+1, "inline push past N");
+            v.pop();
+            v.pop();
+            checkKeys(v, keys, kInlineItems-1, "inline pop below N");
+            v.push(TYPE(keys[kInlineItems-1]));
+        }
+
+        for (size_t i=v.size() ; i<kSpill ; i++) {
+            v.push(TYPE(keys[i]));
+        }
+        if (isInline(v)) {
+            fail("inline spill", "storage still inline");
+        }
+        checkKeys(v, keys, kSpill, "inline spill");
+
+        while (v.size() > 1) {
+            v.pop();
+            checkKeys(v, keys, v.size(), "inline shrink");
+        }
+        if (!isInline(v)) {
+            fail("inline shrink", "storage didn't come back inline");
+        }
+
+        v.clear();
+        for (size_t i=0 ; i<kInlineItems ; i++) {
+            v.push(TYPE(keys[i]));
+        }
+        v.sort(compareItems<TYPE>);
+        checkSorted(v, "inline sort");
+        for (size_t i=v.size() ; i<kSpill ; i++) {
+            v.push(TYPE(keys[i]));
+        }
+        v.sort(compareItems<TYPE>);
+        checkSorted(v, "inline sort spilled");
+        if (v.size() != kSpill) {
+            fail("inline sort spilled", "lost items");
+        }
+    }
+
+    {
+        Vector<TYPE> small, large;
+        for (size_t i=0 ; i<kSpill ; i++) {
+            if (i < kInlineItems/2) {
+                small.push(TYPE(keys[i]));
+            }
+            large.push(TYPE(keys[i]));
+        }
+
+        // plain to hooked
+        Inline a(small);
+        if (!isInline(a)) {
+            fail("inline from vector", "small copy not inline");
+        }
+        checkKeys(a, keys, small.size(), "inline from vector");
+        Inline b(large);
+        if (isInline(b)) {
+            fail("inline from vector", "large copy inline");
+        }
+        checkKeys(b, keys, kSpill, "inline from large vector");
+
+        // an assignment may share a plain vector's storage until written
+        Inline c;
+        c = small;
+        c.editItemAt(0) = TYPE(keys[kSpill]);
+        if (!isInline(c) || keyOf(small[0]) != keys[0]) {
+            fail("inline assign", "write went to the shared storage");
+        }
+
+        // hooked to plain, never shared
+        Vector<TYPE> d(a);
+        a.editItemAt(0) = TYPE(keys[kSpill]);
+        checkKeys(d, keys, small.size(), "vector from inline");
+        d = b;
+        checkKeys(d, keys, kSpill, "vector assigned large inline");
+        if (d.array() == b.array()) {
+            fail("vector assigned large inline", "storage shared");
+        }
+
+        // hooked to hooked, inline and heap both ways
+        Inline e(a);
+        if (!isInline(e) || e.array() == a.array()) {
+            fail("inline copy", "storage not its own");
+        }
+        e = b;
+        checkKeys(e, keys, kSpill, "inline assigned large inline");
+        while (e.size() > 1) {
+            e.pop();
+        }
+        if (!isInline(e)) {
+            fail("inline assigned large inline", "storage didn't come back inline");
+        }
+        b = e;
+        checkKeys(b, keys, 1, "large inline assigned inline");
+        const Inline& self = b;
+        b = self;
+        checkKeys(b, keys, 1, "inline self assign");
+    }
+}
+
+template<typename TYPE>
+static void check_arena(const int* keys)
+{
+    // room for a few small blocks only
+    double buffer[64];
+    VectorArena arena(buffer, sizeof(buffer));
+    const size_t kSpill = 4*sizeof(buffer)/sizeof(TYPE);
+
+    {
+        ArenaVector<TYPE> v(arena);
+        bool spilled = false;
+        for (size_t i=0 ; i<kSpill ; i++) {
+            v.push(TYPE(keys[i]));
+            if (!arena.owns(v.array())) {
+                spilled = true;
+            } else if (spilled) {
+                fail("arena push", "back in the arena after spilling");
+            }
+            if (arena.used() > sizeof(buffer)) {
+                fail("arena push", "arena overrun");
+            }
+        }
+        if (!spilled) {
+            fail("arena push", "never left the arena");
+        }
+        checkKeys(v, keys, kSpill, "arena push");
+
+        // the arena is used up, this one only gets the heap
+        ArenaVector<TYPE> w(arena);
+        for (size_t i=0 ; i<kSpill ; i++) {
+            w.push(TYPE(keys[i]));
+        }
+        checkKeys(w, keys, kSpill, "exhausted arena");
+        if (arena.owns(w.array())) {
+            fail("exhausted arena", "storage in the arena");
+        }
+
+        w.sort(compareItems<TYPE>);
+        checkSorted(w, "arena sort");
+        while (v.size() > 1) {
+            v.pop();
+        }
+        checkKeys(v, keys, 1, "arena shrink");
+    }
+    arena.reset();
+    if (arena.used()) {
+        fail("arena reset", "still in use");
+    }
+
+    {
+        Vector<TYPE> src;
+        for (size_t i=0 ; i<4 ; i++) {
+            src.push(TYPE(keys[i]));
+        }
+        ArenaVector<TYPE> v(arena);
+        v = src;
+        v.editItemAt(0) = TYPE(keys[kSpill]);
+        if (!arena.owns(v.array()) || keyOf(src[0]) != keys[0]) {
+            fail("arena assign", "write went to the shared storage");
+        }
+        Vector<TYPE> copy(v);
+        if (arena.owns(copy.array())) {
+            fail("vector from arena", "storage in the arena");
+        }
+        for (size_t i=0 ; i<v.size() ; i++) {
+            if (keyOf(copy[i]) != keyOf(v[i])) {
+                fail("vector from arena", "items differ");
+            }
+        }
+    }
+}
+// ---------------------------------------------------------------------------
+
+template<typename TYPE>
+static void bench_vector(size_t n, int rounds)
+{
+    int* keys = makeKeys(n);
+    Timer add, insert, remove, pop, sort_random, sort_sorted;
+
+    for (int r=0 ; r<rounds ; r++) {
+        Vector<TYPE> v;
+        add.start();
+        for (size_t i=0 ; i<n ; i++) {
+            v.add(TYPE(keys[i]));
+        }
+        add.stop();
+
+        Vector<TYPE> s(v);
+        sort_random.start();
+        s.sort(compareItems<TYPE>);
+        sort_random.stop();
+        checkSorted(s, "sort random");
+        if (s.size() != v.size()) {
+            fprintf(stderr, "sort random: %zu items, not %zu\n", s.size(), v.size());
+            exit(1);
+        }
+        sort_sorted.start();
+        s.sort(compareItems<TYPE>);
+        sort_sorted.stop();
+        checkSorted(s, "sort sorted");
+
+        pop.start();
+        while (!v.isEmpty()) {
+            v.pop();
+        }
+        pop.stop();
+
+        if (n > kQuadraticMax) {
+            continue;
+        }
+        insert.start();
+        for (size_t i=0 ; i<n ; i++) {
+            v.insertAt(TYPE(keys[i]), 0);
+        }
+        insert.stop();
+        remove.start();
+        while (!v.isEmpty()) {
+            v.removeItemsAt(0);
+        }
+        remove.stop();
+    }
+
+    const size_t ops = n*rounds;
+    if (selected("add")) add.report("add", n, ops);
+    if (selected("pop")) pop.report("pop", n, ops);
+    if (selected("sort")) sort_random.report("sort random", n, ops);
+    if (selected("sort")) sort_sorted.report("sort sorted", n, ops);
+    if (n <= kQuadraticMax) {
+        if (selected("insertAt")) insert.report("insertAt front", n, ops);
+        if (selected("removeItemsAt")) remove.report("removeItemsAt front", n, ops);
+    }
+    delete[] keys;
+}
+
+template<typename TYPE>
+static void bench_sorted(size_t n, int rounds)
+{
+    int* keys = makeKeys(n);
+    Timer add, index;
+
+    for (int r=0 ; r<rounds ; r++) {
+        SortedVector<TYPE> v;
+        if (n <= kQuadraticMax) {
+            add.start();
+            for (size_t i=0 ; i<n ; i++) {
+                v.add(TYPE(keys[i]));
+            }
+            add.stop();
+        } else {
+            Vector<TYPE> items;
+            for (size_t i=0 ; i<n ; i++) {
+                items.add(TYPE(keys[i]));
+            }
+            v.merge(items);
+        }
+        index.start();
+        for (size_t i=0 ; i<n ; i++) {
+            if (v.indexOf(TYPE(keys[i])) < 0) {
+                fprintf(stderr, "indexOf: lost key %d\n", keys[i]);
+                exit(1);
+            }
+        }
+        index.stop();
+    }
+
+    const size_t ops = n*rounds;
+    if (selected("SortedVector")) {
+        if (n <= kQuadraticMax) {
+            add.report("SortedVector add", n, ops);
+        }
+        index.report("SortedVector indexOf", n, ops);
+    }
+    delete[] keys;
+}
+
+enum MergeInput {
+    INTERLEAVED,    // every other key
+    OVERLAPPING,    // random keys, some equal
+    UNSORTED,       // random keys in a plain Vector
+};
+
+static const char* const kMergeNames[] = {
+    "interleaved", "overlapping", "unsorted"
+};
+
+template<typename TYPE>
+static void fill(SortedVector<TYPE>& dst, Vector<TYPE>& src, size_t n, MergeInput input)
+{
+    dst.clear();
+    src.clear();
+    for (size_t i=0 ; i<n ; i++) {
+        if (input == INTERLEAVED) {
+            dst.add(TYPE(int(2*i)));
+            src.push(TYPE(int(2*i + 1)));
+        } else {
+            dst.add(TYPE(rand() % int(4*n)));
+            src.push(TYPE(rand() % int(4*n)));
+        }
+    }
+}
+
+template<typename TYPE>
+static void bench_merge(size_t n, MergeInput input, int rounds)
+{
+    SortedVector<TYPE> dst;
+    SortedVector<TYPE> sorted;
+    Vector<TYPE> src;
+    Timer merge, add;
+    char name[64];
+
+    for (int r=0 ; r<rounds ; r++) {
+        fill(dst, src, n, input);
+        sorted.clear();
+        for (size_t i=0 ; i<src.size() ; i++) {
+            sorted.add(src[i]);
+        }
+
+        SortedVector<TYPE> a(dst);
+        merge.start();
+        if (input == UNSORTED) {
+            a.merge(src);
+        } else {
+            a.merge(sorted);
+        }
+        merge.stop();
+
+        SortedVector<TYPE> b(dst);
+        add.start();
+        for (size_t i=0 ; i<src.size() ; i++) {
+            b.add(src[i]);
+        }
+        add.stop();
+
+        if (a.size() != b.size()) {
+            fprintf(stderr, "merge mismatch: %zu != %zu\n", a.size(), b.size());
+            exit(1);
+        }
+        for (size_t i=0 ; i<a.size() ; i++) {
+            if (keyOf(a[i]) != keyOf(b[i])) {
+                fprintf(stderr, "merge mismatch at %zu: %d != %d\n",
+                        i, keyOf(a[i]), keyOf(b[i]));
+                exit(1);
+            }
+        }
+    }
+
+    if (!selected("merge")) {
+        return;
+    }
+    snprintf(name, sizeof(name), "merge %s", kMergeNames[input]);
+    merge.report(name, n, n*rounds);
+    snprintf(name, sizeof(name), "merge %s by add", kMergeNames[input]);
+    add.report(name, n, n*rounds);
+}
+
+template<typename TYPE>
+static void bench_type(const char* type, size_t max_items)
+{
+    gType = type;
+    srand(1);
+    for (size_t n=8 ; n<=max_items ; n*=8) {
+        if (n*8 > max_items) {
+            // always end with max_items
+            n = max_items;
+        }
+        // enough rounds for stable numbers on small sizes
+        const int rounds = n < 4096 ? int(65536 / n) : 1;
+        bench_vector<TYPE>(n, rounds);
+        bench_sorted<TYPE>(n, rounds);
+        // adding one by one is quadratic too
+        if (n <= kQuadraticMax) {
+            for (int input=INTERLEAVED ; input<=UNSORTED ; input++) {
+                bench_merge<TYPE>(n, MergeInput(input), rounds);
+            }
+        }
+    }
+}
+
+template<typename TYPE>
+static void check_storage()
+{
+    int* keys = makeKeys(1024);
+    check_inline<TYPE>(keys);
+    check_arena<TYPE>(keys);
+    delete[] keys;
+}
+
+int main(int argc, char** argv)
+{
+    size_t max_items = 1 << 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+        switch (opt) {
+        case 'n':
+            max_items = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            gFilter = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n max_items] [-f filter]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    srand(1);
+    check_storage<int>();
+    check_storage<Tracked>();
+    if (Tracked::live()) {
+        fprintf(stderr, "storage checks: %d items leaked\n", Tracked::live());
+        return 1;
+    }
+
+    bench_type<int>("trivial", max_items);
+    bench_type<Counted>("counted", max_items);
+    return 0;
+}
@@ -48,11 +48,15 @@ VectorImpl::VectorImpl(size_t itemSize, uint32_t flags)
 }
 
 VectorImpl::VectorImpl(const VectorImpl& rhs)
-    :   mStorage(rhs.mStorage), mCount(rhs.mCount),
-        mFlags(rhs.mFlags), mItemSize(rhs.mItemSize)
+    :   mStorage(0), mCount(0),
+        mFlags(rhs.mFlags & ~HAS_STORAGE_HOOKS), mItemSize(rhs.mItemSize)
 {
-    if (mStorage) {
+    if (rhs.mStorage && !(rhs.mFlags & HAS_STORAGE_HOOKS)) {
+        mStorage = rhs.mStorage;
+        mCount = rhs.mCount;
         SharedBuffer::bufferFromData(mStorage)->acquire();
+    } else {
+        _assign(rhs);
     }
 }
 
@@ -71,18 +75,77 @@ VectorImpl& VectorImpl::operator = (const VectorImpl& rhs)
         "Vector<> have different types (this=%p, rhs=%p)", this, &rhs);
     if (this != &rhs) {
         release_storage();
-        if (rhs.mCount) {
-            mStorage = rhs.mStorage;
-            mCount = rhs.mCount;
-            SharedBuffer::bufferFromData(mStorage)->acquire();
-        } else {
-            mStorage = 0;
-            mCount = 0;
-        }
+        _assign(rhs);
     }
     return *this;
 }
 
+void VectorImpl::_assign(const VectorImpl& rhs)
+{
+    mStorage = 0;
+    mCount = 0;
+    if (!rhs.mCount) {
+        return;
+    }
+    if (!(rhs.mFlags & HAS_STORAGE_HOOKS)) {
+        mStorage = rhs.mStorage;
+        mCount = rhs.mCount;
+        SharedBuffer::bufferFromData(mStorage)->acquire();
+        return;
+    }
+    // the storage of a hooked vector may live inside it, so it's never
+    // shared. use rhs to copy, our vtable may not be there yet.
+    SharedBuffer* sb = _alloc(max(kMinVectorCapacity, rhs.mCount) * mItemSize);
+    LOG_ALWAYS_FATAL_IF(sb == NULL);
+    rhs._do_copy(sb->data(), rhs.mStorage, rhs.mCount);
+    mStorage = sb->data();
+    mCount = rhs.mCount;
+}
+
+void VectorImpl::enable_storage_hooks()
+{
+    LOG_ALWAYS_FATAL_IF(mStorage,
+        "[%p] enable_storage_hooks() called on a vector with storage", this);
+    mFlags |= HAS_STORAGE_HOOKS;
+}
+
+void* VectorImpl::do_allocate(size_t& /*size*/)
+{
+    return 0;
+}
+
+bool VectorImpl::do_deallocate(void* /*block*/)
+{
+    return false;
+}
+
+// layout of SharedBuffer, which doesn't let us build one in place
+struct StorageHeader {
+    int32_t     refs;
+    size_t      size;
+    uint32_t    reserved[2];
+};
+
+typedef char StorageHeaderCheck[(sizeof(StorageHeader) == sizeof(SharedBuffer) &&
+        sizeof(StorageHeader) == VectorImpl::STORAGE_HEADER_SIZE) ? 1 : -1];
+
+SharedBuffer* VectorImpl::_alloc(size_t size, bool heap)
+{
+    if (mFlags & HAS_STORAGE_HOOKS) {
+        size_t block_size = 0;
+        LOG_ALWAYS_FATAL_IF(!safe_add(&block_size, size, sizeof(StorageHeader)));
+        void* block = do_allocate(block_size);
+        if (block) {
+            StorageHeader* header = reinterpret_cast<StorageHeader*>(block);
+            header->refs = 1;
+            header->size = block_size - sizeof(StorageHeader);
+            header->reserved[0] = header->reserved[1] = 0;
+            return reinterpret_cast<SharedBuffer*>(block);
+        }
+    }
+    return heap ? SharedBuffer::alloc(size) : 0;
+}
+
 void* VectorImpl::editArrayImpl()
 {
     if (mStorage) {
@@ -91,7 +154,7 @@ void* VectorImpl::editArrayImpl()
         if (editable == 0) {
             // If we're here, we're not the only owner of the buffer.
             // We must make a copy of it.
-            editable = SharedBuffer::alloc(sb->size());
+            editable = _alloc(sb->size());
             // Fail instead of returning a pointer to storage that's not
             // editable. Otherwise we'd be editing the contents of a buffer
             // for which we're not the only owner, which is undefined behaviour.
@@ -163,6 +226,94 @@ static int sortProxy(const void* lhs, const void* rhs, void* func)
     return (*(VectorImpl::compar_t)func)(lhs, rhs);
 }
 
+// runs shorter than this are insertion sorted before merging
+const size_t kSortRunLength = 16;
+
+struct SortContext {
+    VectorImpl::compar_r_t  cmp;
+    void*                   state;
+    size_t                  size;       // size of a sorted element
+    bool                    indirect;   // elements are pointers to the items
+};
+
+static inline int sortCompare(const SortContext& c, const char* lhs, const char* rhs)
+{
+    if (c.indirect) {
+        return c.cmp(*reinterpret_cast<void* const*>(lhs),
+                *reinterpret_cast<void* const*>(rhs), c.state);
+    }
+    return c.cmp(lhs, rhs, c.state);
+}
+
+static void insertionSort(const SortContext& c, char* array, size_t count, char* temp)
+{
+    const size_t s = c.size;
+    for (size_t i=1 ; i<count ; i++) {
+        char* item = array + s*i;
+        if (sortCompare(c, item - s, item) <= 0) {
+            continue;
+        }
+        memcpy(temp, item, s);
+        size_t j = i-1;
+        while (j > 0 && sortCompare(c, array + s*(j-1), temp) > 0) {
+            j--;
+        }
+        memmove(array + s*(j+1), array + s*j, s*(i-j));
+        memcpy(array + s*j, temp, s);
+    }
+}
+
+// merges src[lo, mid) and src[mid, hi) into dst[lo, hi)
+static void mergeRuns(const SortContext& c, const char* src, char* dst,
+        size_t lo, size_t mid, size_t hi)
+{
+    const size_t s = c.size;
+    if (mid == hi || sortCompare(c, src + s*(mid-1), src + s*mid) <= 0) {
+        memcpy(dst + s*lo, src + s*lo, s*(hi-lo));
+        return;
+    }
+    size_t i = lo, j = mid, k = lo;
+    while (i < mid && j < hi) {
+        // on equal items, the left one goes first
+        if (sortCompare(c, src + s*j, src + s*i) < 0) {
+            memcpy(dst + s*k++, src + s*j++, s);
+        } else {
+            memcpy(dst + s*k++, src + s*i++, s);
+        }
+    }
+    if (i < mid) {
+        memcpy(dst + s*k, src + s*i, s*(mid-i));
+    } else if (j < hi) {
+        memcpy(dst + s*k, src + s*j, s*(hi-j));
+    }
+}
+
+// sorts count elements of array, scratch must hold as many
+static void mergeSort(const SortContext& c, char* array, char* scratch, size_t count)
+{
+    const size_t s = c.size;
+    for (size_t lo=0 ; lo<count ; lo+=kSortRunLength) {
+        const size_t n = count-lo < kSortRunLength ? count-lo : kSortRunLength;
+        insertionSort(c, array + s*lo, n, scratch);
+    }
+
+    char* src = array;
+    char* dst = scratch;
+    for (size_t width=kSortRunLength ; width<count ; width*=2) {
+        for (size_t lo=0 ; lo<count ; lo+=2*width) {
+            const size_t mid = lo+width < count ? lo+width : count;
+            const size_t hi = mid+width < count ? mid+width : count;
+            mergeRuns(c, src, dst, lo, mid, hi);
+        }
+        char* t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != array) {
+        memcpy(array, src, s*count);
+    }
+}
+
 status_t VectorImpl::sort(VectorImpl::compar_t cmp)
 {
     return sort(sortProxy, (void*)cmp);
@@ -170,57 +321,76 @@ status_t VectorImpl::sort(VectorImpl::compar_t cmp)
 
 status_t VectorImpl::sort(VectorImpl::compar_r_t cmp, void* state)
 {
-    // the sort must be stable. we're using insertion sort which
-    // is well suited for small and already sorted arrays
-    // for big arrays, it could be better to use mergesort
-    const ssize_t count = size();
-    if (count > 1) {
-        void* array = const_cast<void*>(arrayImpl());
-        void* temp = 0;
-        ssize_t i = 1;
-        while (i < count) {
-            void* item = reinterpret_cast<char*>(array) + mItemSize*(i);
-            void* curr = reinterpret_cast<char*>(array) + mItemSize*(i-1);
-            if (cmp(curr, item, state) > 0) {
-
-                if (!temp) {
-                    // we're going to have to modify the array...
-                    array = editArrayImpl();
-                    if (!array) return NO_MEMORY;
-                    temp = malloc(mItemSize);
-                    if (!temp) return NO_MEMORY;
-                    item = reinterpret_cast<char*>(array) + mItemSize*(i);
-                    curr = reinterpret_cast<char*>(array) + mItemSize*(i-1);
-                } else {
-                    _do_destroy(temp, 1);
-                }
+    // the sort must be stable. we're using a bottom-up mergesort with
+    // insertion sort for the initial runs.
+    const size_t count = size();
+    if (count < 2) {
+        return NO_ERROR;
+    }
 
-                _do_copy(temp, item, 1);
-
-                ssize_t j = i-1;
-                void* next = reinterpret_cast<char*>(array) + mItemSize*(i);                    
-                do {
-                    _do_destroy(next, 1);
-                    _do_copy(next, curr, 1);
-                    next = curr;
-                    --j;
-                    curr = NULL;
-                    if (j >= 0) {
-                        curr = reinterpret_cast<char*>(array) + mItemSize*(j);
-                    }
-                } while (j>=0 && (cmp(curr, temp, state) > 0));
-
-                _do_destroy(next, 1);
-                _do_copy(next, temp, 1);
-            }
-            i++;
-        }
-        
-        if (temp) {
-            _do_destroy(temp, 1);
-            free(temp);
+    // don't touch (or unshare) the storage if it's already sorted
+    const char* const items = reinterpret_cast<const char*>(arrayImpl());
+    size_t i = 1;
+    while (i < count && cmp(items + mItemSize*(i-1), items + mItemSize*i, state) <= 0) {
+        i++;
+    }
+    if (i == count) {
+        return NO_ERROR;
+    }
+
+    SortContext ctx;
+    ctx.cmp = cmp;
+    ctx.state = state;
+    size_t scratch_size = 0;
+
+    if (mFlags & HAS_TRIVIAL_COPY) {
+        // items can be moved around with memcpy, sort them in place
+        LOG_ALWAYS_FATAL_IF(!safe_mul(&scratch_size, count, mItemSize));
+        void* array = editArrayImpl();
+        if (!array) return NO_MEMORY;
+        void* scratch = malloc(scratch_size);
+        if (!scratch) return NO_MEMORY;
+        ctx.size = mItemSize;
+        ctx.indirect = false;
+        mergeSort(ctx, reinterpret_cast<char*>(array),
+                reinterpret_cast<char*>(scratch), count);
+        free(scratch);
+        return NO_ERROR;
+    }
+
+    // otherwise sort pointers to the items, then copy each item once
+    // into a new buffer.
+    LOG_ALWAYS_FATAL_IF(!safe_mul(&scratch_size, count, 2*sizeof(void*)));
+    const void** order = reinterpret_cast<const void**>(malloc(scratch_size));
+    if (!order) return NO_MEMORY;
+    for (i = 0; i < count; i++) {
+        order[i] = items + mItemSize*i;
+    }
+    ctx.size = sizeof(void*);
+    ctx.indirect = true;
+    mergeSort(ctx, reinterpret_cast<char*>(order),
+            reinterpret_cast<char*>(order + count), count);
+
+    SharedBuffer* sb = _alloc(SharedBuffer::bufferFromData(mStorage)->size());
+    if (!sb) {
+        free(order);
+        return NO_MEMORY;
+    }
+    char* dest = reinterpret_cast<char*>(sb->data());
+    i = 0;
+    while (i < count) {
+        // items that kept their relative position are copied together
+        size_t n = 1;
+        while (i+n < count &&
+                order[i+n] == reinterpret_cast<const char*>(order[i]) + mItemSize*n) {
+            n++;
         }
+        _do_copy(dest + mItemSize*i, order[i], n);
+        i += n;
     }
+    free(order);
+    release_storage();
+    mStorage = dest;
     return NO_ERROR;
 }
 
@@ -342,7 +512,7 @@ ssize_t VectorImpl::setCapacity(size_t new_capacity)
 
     size_t new_allocation_size = 0;
     LOG_ALWAYS_FATAL_IF(!safe_mul(&new_allocation_size, new_capacity, mItemSize));
-    SharedBuffer* sb = SharedBuffer::alloc(new_allocation_size);
+    SharedBuffer* sb = _alloc(new_allocation_size);
     if (sb) {
         void* array = sb->data();
         _do_copy(array, mStorage, size());
@@ -370,11 +540,90 @@ void VectorImpl::release_storage()
         const SharedBuffer* sb = SharedBuffer::bufferFromData(mStorage);
         if (sb->release(SharedBuffer::eKeepStorage) == 1) {
             _do_destroy(mStorage, mCount);
-            SharedBuffer::dealloc(sb);
+            if (!(mFlags & HAS_STORAGE_HOOKS) ||
+                    !do_deallocate(const_cast<SharedBuffer*>(sb))) {
+                SharedBuffer::dealloc(sb);
+            }
         } 
     }
 }
 
+static inline const void* mergeItem(const void* items, size_t index,
+        size_t size, bool indirect)
+{
+    if (indirect) {
+        return reinterpret_cast<const void* const*>(items)[index];
+    }
+    return reinterpret_cast<const char*>(items) + size*index;
+}
+
+ssize_t VectorImpl::merge_sorted(const void* items, size_t count, bool indirect,
+        compar_r_t cmp, void* state)
+{
+    if (!count) {
+        return NO_ERROR;
+    }
+
+    size_t new_size;
+    LOG_ALWAYS_FATAL_IF(!safe_add(&new_size, mCount, count), "new_size overflow");
+    const size_t new_capacity = max(kMinVectorCapacity, new_size);
+    size_t new_alloc_size = 0;
+    LOG_ALWAYS_FATAL_IF(!safe_mul(&new_alloc_size, new_capacity, mItemSize),
+                        "new_alloc_size overflow");
+    SharedBuffer* sb = _alloc(new_alloc_size);
+    if (!sb) {
+        return NO_MEMORY;
+    }
+
+    // single pass, copying runs of items coming from the same side at once
+    const size_t s = mItemSize;
+    const char* array = reinterpret_cast<const char*>(mStorage);
+    char* dest = reinterpret_cast<char*>(sb->data());
+    size_t i = 0, j = 0, k = 0;
+    while (i < mCount && j < count) {
+        const int c = cmp(array + s*i, mergeItem(items, j, s, indirect), state);
+        size_t n = 1;
+        if (c < 0) {
+            while (i+n < mCount &&
+                    cmp(array + s*(i+n), mergeItem(items, j, s, indirect), state) < 0) {
+                n++;
+            }
+            _do_copy(dest + s*k, array + s*i, n);
+            i += n;
+        } else {
+            if (c == 0) {
+                // replaced by the new item
+                i++;
+            } else if (!indirect) {
+                while (j+n < count &&
+                        cmp(array + s*i, mergeItem(items, j+n, s, indirect), state) > 0) {
+                    n++;
+                }
+            }
+            _do_copy(dest + s*k, mergeItem(items, j, s, indirect), n);
+            j += n;
+        }
+        k += n;
+    }
+    if (i < mCount) {
+        _do_copy(dest + s*k, array + s*i, mCount - i);
+        k += mCount - i;
+    }
+    if (j < count && !indirect) {
+        _do_copy(dest + s*k, mergeItem(items, j, s, indirect), count - j);
+        k += count - j;
+    } else {
+        for ( ; j < count ; j++, k++) {
+            _do_copy(dest + s*k, mergeItem(items, j, s, indirect), 1);
+        }
+    }
+
+    release_storage();
+    mStorage = dest;
+    mCount = k;
+    return NO_ERROR;
+}
+
 void* VectorImpl::_grow(size_t where, size_t amount)
 {
 //    ALOGV("_grow(this=%p, where=%d, amount=%d) count=%d, capacity=%d",
@@ -410,7 +659,8 @@ void* VectorImpl::_grow(size_t where, size_t amount)
         if ((mStorage) &&
             (mCount==where) &&
             (mFlags & HAS_TRIVIAL_COPY) &&
-            (mFlags & HAS_TRIVIAL_DTOR))
+            (mFlags & HAS_TRIVIAL_DTOR) &&
+            !(mFlags & HAS_STORAGE_HOOKS))
         {
             const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_alloc_size);
@@ -420,7 +670,7 @@ void* VectorImpl::_grow(size_t where, size_t amount)
                 return NULL;
             }
         } else {
-            SharedBuffer* sb = SharedBuffer::alloc(new_alloc_size);
+            SharedBuffer* sb = _alloc(new_alloc_size);
             if (sb) {
                 void* array = sb->data();
                 if (where != 0) {
@@ -465,9 +715,15 @@ void VectorImpl::_shrink(size_t where, size_t amount)
     size_t new_size;
     LOG_ALWAYS_FATAL_IF(!safe_sub(&new_size, mCount, amount));
 
-    if (new_size < (capacity() / 2)) {
+    // Shrink only once less than a quarter is used, to half the new size:
+    // popping and pushing around one size doesn't reallocate every time.
+    const size_t cur_capacity = capacity();
+    const bool hooked = (mFlags & HAS_STORAGE_HOOKS) != 0;
+    bool reallocated = false;
+    if (new_size < (cur_capacity / 4) &&
+        max(kMinVectorCapacity, new_size * 2) < cur_capacity) {
         // NOTE: (new_size * 2) is safe because capacity didn't overflow and
-        // new_size < (capacity / 2)).
+        // new_size < (capacity / 4)).
         const size_t new_capacity = max(kMinVectorCapacity, new_size * 2);
 
         // NOTE: (new_capacity * mItemSize), (where * mItemSize) and
@@ -477,7 +733,8 @@ void VectorImpl::_shrink(size_t where, size_t amount)
         // where < (where + amount) < new_capacity < old_capacity.
         if ((where == new_size) &&
             (mFlags & HAS_TRIVIAL_COPY) &&
-            (mFlags & HAS_TRIVIAL_DTOR))
+            (mFlags & HAS_TRIVIAL_DTOR) &&
+            !hooked)
         {
             const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
@@ -486,8 +743,11 @@ void VectorImpl::_shrink(size_t where, size_t amount)
             } else {
                 return;
             }
+            reallocated = true;
         } else {
-            SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
+            // a hooked vector only moves to storage from its hook, never
+            // from inline storage to the heap.
+            SharedBuffer* sb = _alloc(new_capacity * mItemSize, !hooked);
             if (sb) {
                 void* array = sb->data();
                 if (where != 0) {
@@ -500,11 +760,13 @@ void VectorImpl::_shrink(size_t where, size_t amount)
                 }
                 release_storage();
                 mStorage = const_cast<void*>(array);
-            } else{
+                reallocated = true;
+            } else if (!hooked) {
                 return;
             }
         }
-    } else {
+    }
+    if (!reallocated) {
         void* array = editArrayImpl();
         void* to = reinterpret_cast<uint8_t *>(array) + where*mItemSize;
         _do_destroy(to, amount);
@@ -639,21 +901,55 @@ ssize_t SortedVectorImpl::add(const void* item)
     return index;
 }
 
+int SortedVectorImpl::compareProxy(const void* lhs, const void* rhs, void* self)
+{
+    return static_cast<const SortedVectorImpl*>(self)->do_compare(lhs, rhs);
+}
+
 ssize_t SortedVectorImpl::merge(const VectorImpl& vector)
 {
-    // naive merge...
-    if (!vector.isEmpty()) {
-        const void* buffer = vector.arrayImpl();
-        const size_t is = itemSize();
-        size_t s = vector.size();
-        for (size_t i=0 ; i<s ; i++) {
-            ssize_t err = add( reinterpret_cast<const char*>(buffer) + i*is );
-            if (err<0) {
-                return err;
-            }
+    const size_t count = vector.size();
+    if (count == 0) {
+        return NO_ERROR;
+    }
+    if (count == 1) {
+        ssize_t err = add(vector.arrayImpl());
+        return err < 0 ? err : (ssize_t)NO_ERROR;
+    }
+
+    // sort pointers to the new items, the same way sort() does
+    size_t scratch_size = 0;
+    LOG_ALWAYS_FATAL_IF(!safe_mul(&scratch_size, count, 2*sizeof(void*)));
+    const void** order = reinterpret_cast<const void**>(malloc(scratch_size));
+    if (!order) {
+        return NO_MEMORY;
+    }
+    const char* const items = reinterpret_cast<const char*>(vector.arrayImpl());
+    const size_t is = itemSize();
+    for (size_t i=0 ; i<count ; i++) {
+        order[i] = items + is*i;
+    }
+    SortContext ctx;
+    ctx.cmp = compareProxy;
+    ctx.state = this;
+    ctx.size = sizeof(void*);
+    ctx.indirect = true;
+    mergeSort(ctx, reinterpret_cast<char*>(order),
+            reinterpret_cast<char*>(order + count), count);
+
+    // adding them one by one would leave the last of equal items,
+    // the sort is stable so that's the last of each run.
+    size_t unique = 0;
+    for (size_t i=0 ; i<count ; i++) {
+        if (unique && do_compare(order[unique-1], order[i]) == 0) {
+            unique--;
         }
+        order[unique++] = order[i];
     }
-    return NO_ERROR;
+
+    ssize_t err = merge_sorted(order, unique, true, compareProxy, this);
+    free(order);
+    return err;
 }
 
 ssize_t SortedVectorImpl::merge(const SortedVectorImpl& vector)
@@ -662,13 +958,14 @@ ssize_t SortedVectorImpl::merge(const SortedVectorImpl& vector)
     ssize_t err = NO_ERROR;
     if (!vector.isEmpty()) {
         // first take care of the case where the vectors are sorted together
-        if (do_compare(vector.itemLocation(vector.size()-1), arrayImpl()) <= 0) {
+        if (isEmpty() ||
+                do_compare(vector.itemLocation(vector.size()-1), arrayImpl()) < 0) {
             err = VectorImpl::insertVectorAt(static_cast<const VectorImpl&>(vector), 0);
-        } else if (do_compare(vector.arrayImpl(), itemLocation(size()-1)) >= 0) {
+        } else if (do_compare(vector.arrayImpl(), itemLocation(size()-1)) > 0) {
             err = VectorImpl::appendVector(static_cast<const VectorImpl&>(vector));
         } else {
-            // this could be made a little better
-            err = merge(static_cast<const VectorImpl&>(vector));
+            err = merge_sorted(vector.arrayImpl(), vector.size(), false,
+                    compareProxy, this);
         }
     }
     return err;
@@ -694,5 +991,55 @@ void SortedVectorImpl::reservedSortedVectorImpl8() { };
 
 /*****************************************************************************/
 
+VectorArena::VectorArena(void* buffer, size_t size)
+    : mBase(reinterpret_cast<char*>(buffer)), mSize(size), mUsed(0), mLast(0)
+{
+    // keep every block aligned like the heap would
+    const size_t skew = reinterpret_cast<uintptr_t>(mBase) & (sizeof(double) - 1);
+    if (skew) {
+        const size_t pad = sizeof(double) - skew;
+        mBase += pad;
+        mSize = mSize > pad ? mSize - pad : 0;
+    }
+}
+
+void* VectorArena::allocate(size_t& size)
+{
+    const size_t aligned = (size + sizeof(double) - 1) & ~(sizeof(double) - 1);
+    if (aligned < size || aligned > mSize - mUsed) {
+        return 0;
+    }
+    mLast = mUsed;
+    mUsed += aligned;
+    size = aligned;
+    return mBase + mLast;
+}
+
+bool VectorArena::deallocate(void* block)
+{
+    if (!owns(block)) {
+        return false;
+    }
+    if (reinterpret_cast<char*>(block) == mBase + mLast) {
+        // the last block can be handed out again
+        mUsed = mLast;
+    }
+    return true;
+}
+
+bool VectorArena::owns(const void* block) const
+{
+    const char* p = reinterpret_cast<const char*>(block);
+    return p >= mBase && p < mBase + mSize;
+}
+
+void VectorArena::reset()
+{
+    mUsed = 0;
+    mLast = 0;
+}
+
+/*****************************************************************************/
+
 }; // namespace android
 
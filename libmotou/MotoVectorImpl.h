@@ -28,6 +28,8 @@
 
 namespace android {
 
+class SharedBuffer;
+
 /*!
  * Implementation of the guts of the vector<> class
  * this ensures backward binary compatibility and
@@ -44,6 +46,13 @@ public:
         HAS_TRIVIAL_CTOR    = 0x00000001,
         HAS_TRIVIAL_DTOR    = 0x00000002,
         HAS_TRIVIAL_COPY    = 0x00000004,
+        HAS_STORAGE_HOOKS   = 0x00000008,   // set by enable_storage_hooks()
+    };
+
+    /*! size of the header in front of each storage block */
+    enum {
+        STORAGE_HEADER_SIZE = (sizeof(int32_t) + sizeof(size_t) + 2*sizeof(uint32_t)
+                               + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1)
     };
 
                             VectorImpl(size_t itemSize, uint32_t flags);
@@ -99,6 +108,18 @@ protected:
             size_t          itemSize() const;
             void            release_storage();
 
+            /*! merges count sorted, unique items into this sorted vector,
+             *  an item replaces the one it compares equal to. items is an
+             *  array of items or, if indirect, of pointers to items. */
+            ssize_t         merge_sorted(const void* items, size_t count, bool indirect,
+                                    compar_r_t cmp, void* state);
+
+            /*! routes storage allocation through do_allocate() and
+             *  do_deallocate(). must be called from the subclass constructor,
+             *  and such a subclass must call finish_vector() in its own
+             *  destructor. its storage is copied rather than shared. */
+            void            enable_storage_hooks();
+
     virtual void            do_construct(void* storage, size_t num) const = 0;
     virtual void            do_destroy(void* storage, size_t num) const = 0;
     virtual void            do_copy(void* dest, const void* from, size_t num) const = 0;
@@ -106,9 +127,13 @@ protected:
     virtual void            do_move_forward(void* dest, const void* from, size_t num) const = 0;
     virtual void            do_move_backward(void* dest, const void* from, size_t num) const = 0;
 
+    /*! returns a block of at least size bytes (STORAGE_HEADER_SIZE included),
+     *  or 0 to use the heap. size may be raised to what the block holds. */
+    virtual void*           do_allocate(size_t& size);
+    /*! returns true if block came from do_allocate() and was released */
+    virtual bool            do_deallocate(void* block);
+
     // take care of FBC...
-    virtual void            reservedVectorImpl1();
-    virtual void            reservedVectorImpl2();
     virtual void            reservedVectorImpl3();
     virtual void            reservedVectorImpl4();
     virtual void            reservedVectorImpl5();
@@ -117,8 +142,14 @@ protected:
     virtual void            reservedVectorImpl8();
  
 private:
+        // were reserved slots 1 and 2, still exported for older vtables
+        void  reservedVectorImpl1();
+        void  reservedVectorImpl2();
+
         void* _grow(size_t where, size_t amount);
         void  _shrink(size_t where, size_t amount);
+        void  _assign(const VectorImpl& rhs);
+        SharedBuffer* _alloc(size_t size, bool heap = true);
 
         inline void _do_construct(void* storage, size_t num) const;
         inline void _do_destroy(void* storage, size_t num) const;
@@ -132,7 +163,7 @@ private:
             void *      mStorage;   // base address of the vector
             size_t      mCount;     // number of items
 
-    const   uint32_t    mFlags;
+            uint32_t    mFlags;
     const   size_t      mItemSize;
 };
 
@@ -178,6 +209,7 @@ protected:
 
 private:
             ssize_t         _indexOrderOf(const void* item, size_t* order = 0) const;
+    static  int             compareProxy(const void* lhs, const void* rhs, void* self);
 
             // these are made private, because they can't be used on a SortedVector
             // (they don't have an implementation either)
@@ -195,6 +227,34 @@ private:
             ssize_t         replaceAt(const void* item, size_t index);
 };
 
+/*!
+ * Memory for the storage of short-lived vectors (see ArenaVector in
+ * MotoVector.h). Blocks are carved from a caller-provided buffer and only
+ * given back if they're the last one handed out; reset() reclaims all of
+ * it once no vector uses the arena anymore.
+ */
+
+class VectorArena
+{
+public:
+                            VectorArena(void* buffer, size_t size);
+
+            void*           allocate(size_t& size);
+            bool            deallocate(void* block);
+            bool            owns(const void* block) const;
+            void            reset();
+    inline  size_t          used() const        { return mUsed; }
+
+private:
+                            VectorArena(const VectorArena&);
+            VectorArena&    operator = (const VectorArena&);
+
+            char*           mBase;
+            size_t          mSize;
+            size_t          mUsed;
+            size_t          mLast;      // offset of the last block
+};
+
 }; // namespace android
 
 